@@ -27,8 +27,94 @@
 #include "range.hpp"
 #include "pixel.hpp"
 #include "matrix.hpp"
+#include "simd_avx2.hpp"
 
 namespace c4 {
+#ifdef __C4_AVX2__
+    namespace detail {
+        // 16 pixels of row i per step, the 128-bit loop takes over from the returned column
+        C4_TARGET_AVX2 inline int bilateral_filter_row_avx2(const c4::matrix<uint16_t>& src_r, const c4::matrix<uint16_t>& src_g, const c4::matrix<uint16_t>& src_b,
+            c4::pixel<uint8_t>* dst, int width, int i, int r, int wr, int wg, int wb, int colorThreshold) {
+            using namespace c4::simd::avx2;
+
+            const uint16x16 vwr(wr);
+            const uint16x16 vwg(wg);
+            const uint16x16 vwb(wb);
+
+            const uint16x16 v_color_threshold(colorThreshold);
+
+            const uint16_t* psrc0_r = src_r[i].data();
+            const uint16_t* psrc0_g = src_g[i].data();
+            const uint16_t* psrc0_b = src_b[i].data();
+
+            const int i0 = std::max<int>(i - r, 0);
+            const int i1 = std::min<int>(i + r + 1, src_r.height());
+
+            int j = 0;
+            for (; j + 16 < width; j += 16) {
+                const int j0 = r + j - r;
+                const int j1 = r + j + r + 1;
+
+                uint32x8x2 nom_r{ set_zero<uint32x8>(), set_zero<uint32x8>() };
+                uint32x8x2 nom_g{ set_zero<uint32x8>(), set_zero<uint32x8>() };
+                uint32x8x2 nom_b{ set_zero<uint32x8>(), set_zero<uint32x8>() };
+
+                uint32x8x2 denom{ set_zero<uint32x8>(), set_zero<uint32x8>() };
+
+                const uint16x16 p0_r = load(psrc0_r + j + r);
+                const uint16x16 p0_g = load(psrc0_g + j + r);
+                const uint16x16 p0_b = load(psrc0_b + j + r);
+
+                for (int ii : c4::range(i0, i1)) {
+                    const uint16_t* psrc1_r = src_r[ii].data();
+                    const uint16_t* psrc1_g = src_g[ii].data();
+                    const uint16_t* psrc1_b = src_b[ii].data();
+
+                    for (int jj : c4::range(j0, j1)) {
+                        const uint16x16 p_r = load(psrc1_r + jj);
+                        const uint16x16 p_g = load(psrc1_g + jj);
+                        const uint16x16 p_b = load(psrc1_b + jj);
+
+                        uint16x16 d = mul_lo(abs_diff(p_r, p0_r), vwr);
+                        d = mul_acc(d, abs_diff(p_g, p0_g), vwg);
+                        d = mul_acc(d, abs_diff(p_b, p0_b), vwb);
+
+                        uint16x16 w = sub_saturate(v_color_threshold, d);
+
+                        nom_r = add(nom_r, mul_long_in_lanes(p_r, w));
+                        nom_g = add(nom_g, mul_long_in_lanes(p_g, w));
+                        nom_b = add(nom_b, mul_long_in_lanes(p_b, w));
+
+                        denom = add(denom, long_move_in_lanes(w));
+                    }
+                }
+
+                // each half of 8 pixels is normalized exactly as in the 128-bit loop
+                for (int h = 0; h < 2; h++) {
+                    simd::uint32x4x2 hdenom = h == 0 ? get_low_in_lanes(denom) : get_high_in_lanes(denom);
+                    simd::uint32x4x2 hnom_r = h == 0 ? get_low_in_lanes(nom_r) : get_high_in_lanes(nom_r);
+                    simd::uint32x4x2 hnom_g = h == 0 ? get_low_in_lanes(nom_g) : get_high_in_lanes(nom_g);
+                    simd::uint32x4x2 hnom_b = h == 0 ? get_low_in_lanes(nom_b) : get_high_in_lanes(nom_b);
+
+                    simd::float32x4x2 inv_denom = simd::reciprocal(simd::to_float(simd::reinterpret_signed(hdenom)));
+
+                    simd::float32x4x2 vr = simd::mul(simd::to_float(simd::reinterpret_signed(hnom_r)), inv_denom);
+                    simd::float32x4x2 vg = simd::mul(simd::to_float(simd::reinterpret_signed(hnom_g)), inv_denom);
+                    simd::float32x4x2 vb = simd::mul(simd::to_float(simd::reinterpret_signed(hnom_b)), inv_denom);
+
+                    simd::int16x8x3 dp;
+                    dp.val[0] = simd::narrow(simd::round_to_int(vr));
+                    dp.val[1] = simd::narrow(simd::round_to_int(vg));
+                    dp.val[2] = simd::narrow(simd::round_to_int(vb));
+
+                    simd::store_3_interleaved_narrow_unsigned_saturate((uint8_t*)(dst + j + 8 * h), dp);
+                }
+            }
+
+            return j;
+        }
+    };
+#endif
 
     void bilateral_filter(c4::matrix_ref<c4::pixel<uint8_t>>& dst, float sd, float sr, c4::rgb_weights rgbWeights) {
         const int wr = int(rgbWeights.wR() * 255);
@@ -89,6 +175,10 @@ namespace c4 {
             const int i1 = std::min<int>(i + r + 1, src_r.height());
 
             int j = 0;
+#ifdef __C4_AVX2__
+            if (simd::avx2::is_supported())
+                j = detail::bilateral_filter_row_avx2(src_r, src_g, src_b, dst[i].data(), dst.width(), i, r, wr, wg, wb, colorThreshold);
+#endif
 #ifdef __C4_SIMD__
             for (; j + 8 < dst.width(); j += 8) {
                 const int j0 = r + j - r;
@@ -165,18 +165,21 @@ namespace c4 {
         if (info.bpp != 24)
             throw std::logic_error("BMP type not supported: bpp = " + std::to_string(info.bpp));
 
-        out.resize(info.img_height, info.img_width);
+        out.resize_for_overwrite(info.img_height, info.img_width);
 
         skip(in, info.offset - 14 - info.hsz);
 
         int pad = (-3 * info.img_width) & 3;
 
+        // resize_for_overwrite leaves the pixels uninitialized, so a short read is an error
         for (int j = 0; j < (int)info.img_height; ++j) {
             for (int i = 0; i < (int)info.img_width; ++i) {
                 out[j][i].b = get8(in);
                 out[j][i].g = get8(in);
                 out[j][i].r = get8(in);
             }
+            if (!in)
+                throw std::logic_error("Truncated BMP");
             skip(in, pad);
         }
 
@@ -0,0 +1,189 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#pragma once
+
+#include <new>
+#include <bit>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+namespace c4 {
+    // Recycles memory blocks by size, so that processing frames of the same size again and again doesn't go to malloc.
+    // Sizes are rounded up to one of four classes per power of two, which wastes at most a quarter of a block.
+    // Freed blocks go to the shard of the freeing thread and allocations look there first, so threads rarely
+    // meet on a mutex; a thread whose shard is empty takes a block from the others before allocating a new one.
+    // Blocks are 64-byte aligned. The pool must outlive everything allocated from it.
+    class buffer_pool {
+    public:
+        static constexpr size_t block_alignment = 64;
+
+        struct stats_snapshot {
+            uint64_t allocated = 0;     // blocks that had to be allocated from the system
+            uint64_t reused = 0;        // allocations served from the pool
+            size_t cached_bytes = 0;    // free blocks held by the pool
+        };
+
+    private:
+        static constexpr int num_classes = 4 * 65;
+
+        struct alignas(64) shard {
+            std::mutex mu;
+            std::array<std::vector<void*>, num_classes> blocks;
+        };
+
+        const size_t max_cached_bytes;
+        const int num_shards;
+        std::unique_ptr<shard[]> shards;
+
+        std::atomic<size_t> cached_bytes = 0;
+        std::atomic<uint64_t> allocated = 0;
+        std::atomic<uint64_t> reused = 0;
+
+        // Class of a block of at least bytes bytes, and the block size it stands for
+        static int size_class(size_t bytes, size_t& block_size) {
+            bytes = std::max(bytes, block_alignment);
+
+            const int k = std::bit_width(bytes - 1) - 1;   // 2^k < bytes <= 2^(k+1)
+            const size_t step = size_t(1) << (k - 2);
+
+            block_size = (bytes + step - 1) / step * step;
+            return 4 * k + int(block_size / step) - 4;
+        }
+
+        static size_t class_block_size(int c) {
+            return size_t(c % 4 + 4) << (c / 4 - 2);
+        }
+
+        shard& local_shard() {
+            static std::atomic<unsigned> counter = 0;
+            thread_local const unsigned index = counter++;
+
+            return shards[index % num_shards];
+        }
+
+        static void* system_allocate(size_t bytes, size_t alignment) {
+            return ::operator new(bytes, std::align_val_t(alignment));
+        }
+
+        static void system_deallocate(void* p, size_t alignment) {
+            ::operator delete(p, std::align_val_t(alignment));
+        }
+
+    public:
+        explicit buffer_pool(size_t max_cached_bytes = SIZE_MAX, int shard_count = std::thread::hardware_concurrency())
+            : max_cached_bytes(max_cached_bytes), num_shards(std::max(shard_count, 1)), shards(new shard[num_shards]) {}
+
+        buffer_pool(const buffer_pool&) = delete;
+        buffer_pool& operator=(const buffer_pool&) = delete;
+
+        ~buffer_pool() {
+            trim();
+        }
+
+        void* allocate(size_t bytes, size_t alignment = block_alignment) {
+            if (alignment > block_alignment)
+                return system_allocate(bytes, alignment);
+
+            size_t block_size;
+            const int c = size_class(bytes, block_size);
+
+            shard& local = local_shard();
+
+            for (int k = 0; k < num_shards; k++) {
+                shard& s = k == 0 ? local : shards[(&local - shards.get() + k) % num_shards];
+
+                std::lock_guard<std::mutex> lock(s.mu);
+                if (!s.blocks[c].empty()) {
+                    void* p = s.blocks[c].back();
+                    s.blocks[c].pop_back();
+
+                    cached_bytes -= block_size;
+                    reused.fetch_add(1, std::memory_order_relaxed);
+                    return p;
+                }
+            }
+
+            allocated.fetch_add(1, std::memory_order_relaxed);
+            return system_allocate(block_size, block_alignment);
+        }
+
+        // bytes and alignment must be the same as passed to allocate()
+        void deallocate(void* p, size_t bytes, size_t alignment = block_alignment) {
+            if (alignment > block_alignment) {
+                system_deallocate(p, alignment);
+                return;
+            }
+
+            size_t block_size;
+            const int c = size_class(bytes, block_size);
+
+            if (cached_bytes.fetch_add(block_size) + block_size > max_cached_bytes) {
+                cached_bytes -= block_size;
+                system_deallocate(p, block_alignment);
+                return;
+            }
+
+            shard& s = local_shard();
+
+            std::lock_guard<std::mutex> lock(s.mu);
+            s.blocks[c].push_back(p);
+        }
+
+        // Gives all cached blocks back to the system
+        void trim() {
+            for (int k = 0; k < num_shards; k++) {
+                std::lock_guard<std::mutex> lock(shards[k].mu);
+
+                for (int c = 0; c < num_classes; c++) {
+                    for (void* p : shards[k].blocks[c]) {
+                        cached_bytes -= class_block_size(c);
+                        system_deallocate(p, block_alignment);
+                    }
+
+                    shards[k].blocks[c].clear();
+                    shards[k].blocks[c].shrink_to_fit();
+                }
+            }
+        }
+
+        stats_snapshot get_stats() const {
+            return { allocated.load(std::memory_order_relaxed), reused.load(std::memory_order_relaxed), cached_bytes.load(std::memory_order_relaxed) };
+        }
+
+        static constexpr size_t default_pool_max_cached_bytes = size_t(256) << 20;
+
+        // Never destroyed, so that matrices with static storage duration can still give their blocks back at exit.
+        // Nothing uses it unless asked to, and it keeps at most default_pool_max_cached_bytes of free blocks.
+        static buffer_pool& get_default_pool() {
+            static buffer_pool* pool = new buffer_pool(default_pool_max_cached_bytes);
+            return *pool;
+        }
+    };
+};
@@ -23,6 +23,7 @@
 #pragma once
 
 #include "simd.hpp"
+#include "simd_avx2.hpp"
 #include "pixel.hpp"
 #include "range.hpp"
 #include "matrix.hpp"
@@ -98,7 +99,7 @@ namespace c4 {
     }
 
     inline void rgb_to_img(const uint8_t* ptr, int width, int height, int strideBytes, RgbByteOrder byteOrder, matrix<pixel<uint8_t>>& img) {
-        img.resize(height, width);
+        img.resize_for_overwrite(height, width);
 
         for(int i : range(height)) {
             c4::pixel<uint8_t>* pdst = img[i];
@@ -295,6 +296,62 @@ namespace c4 {
 
     static yuv_to_rgb_coefficients ITU_R{359, -183, -88, 454 };
 
+#ifdef __C4_AVX2__
+    namespace detail {
+        // 16 chroma pairs, i.e. 32 pixels of both rows, per step; the 128-bit loop takes over from the returned pair.
+        // The arithmetic is 256-bit, the interleaved stores go through the 128-bit setRGB, 8 pixels at a time.
+        template<UvByteOrder uvByteOrder, RgbByteOrder dstByteOrder>
+        C4_TARGET_AVX2 inline int yuv420_to_rgb_row_avx2(const uint8_t* py0, const uint8_t* py1, const uint8_t* puv, uint8_t* pdst0, uint8_t* pdst1, int w2,
+            const yuv_to_rgb_coefficients& c, const c4::pixel<int>& add) {
+            using namespace c4::simd::avx2;
+
+            const int16x16 c128(128);
+            const c4::simd::int16x8 c255(255);
+
+            const int32x8 radd(add.r);
+            const int32x8 gadd(add.g);
+            const int32x8 badd(add.b);
+
+            const int32x8 crv(c.rv);
+            const int32x8 cgv(c.gv);
+            const int32x8 cgu(c.gu);
+            const int32x8 cbu(c.bu);
+
+            int j = 0;
+            for (; j + 16 < w2; j += 16) {
+                const int16x16x2 y0 = reinterpret_signed(long_move(load(py0 + 2 * j)));
+                const int16x16x2 y1 = reinterpret_signed(long_move(load(py1 + 2 * j)));
+                const int16x16x2 uv = reinterpret_signed(long_move(load(puv + 2 * j)));
+
+                for (int h : range(2)) {
+                    const int32x8x2 uvd = deinterleave(long_move(sub(uv.val[h], c128)));
+                    const int32x8 u = uvByteOrder == UvByteOrder::UV ? uvd.val[0] : uvd.val[1];
+                    const int32x8 v = uvByteOrder == UvByteOrder::UV ? uvd.val[1] : uvd.val[0];
+
+                    const int32x8 tr = c4::simd::avx2::add(shift_right<8>(mul_lo(v, crv)), radd);
+                    const int32x8 tg = c4::simd::avx2::add(shift_right<8>(mul_acc(mul_lo(v, cgv), u, cgu)), gadd);
+                    const int32x8 tb = c4::simd::avx2::add(shift_right<8>(mul_lo(u, cbu)), badd);
+
+                    const int16x16 tRd = narrow(interleave({ tr, tr }));
+                    const int16x16 tGd = narrow(interleave({ tg, tg }));
+                    const int16x16 tBd = narrow(interleave({ tb, tb }));
+
+                    const int16x16 r0 = c4::simd::avx2::add(y0.val[h], tRd), g0 = c4::simd::avx2::add(y0.val[h], tGd), b0 = c4::simd::avx2::add(y0.val[h], tBd);
+                    const int16x16 r1 = c4::simd::avx2::add(y1.val[h], tRd), g1 = c4::simd::avx2::add(y1.val[h], tGd), b1 = c4::simd::avx2::add(y1.val[h], tBd);
+
+                    const int x = 2 * j + 16 * h;
+                    setRGB<dstByteOrder>()(pdst0, x + 0, get_low(r0), get_low(g0), get_low(b0), c255);
+                    setRGB<dstByteOrder>()(pdst0, x + 8, get_high(r0), get_high(g0), get_high(b0), c255);
+                    setRGB<dstByteOrder>()(pdst1, x + 0, get_low(r1), get_low(g1), get_low(b1), c255);
+                    setRGB<dstByteOrder>()(pdst1, x + 8, get_high(r1), get_high(g1), get_high(b1), c255);
+                }
+            }
+
+            return j;
+        }
+    };
+#endif
+
     template<UvByteOrder uvByteOrder, RgbByteOrder dstByteOrder>
     inline void yuv420_to_rgb(const c4::matrix_ref<uint8_t>& Y, const c4::matrix_ref<std::pair<uint8_t, uint8_t> >& UV, uint8_t* dst, int dstStrideBytes, const yuv_to_rgb_coefficients c = ITU_R, const c4::pixel<int> add = c4::pixel<int>()) {
         int w2 = Y.width() / 2;
@@ -317,6 +374,10 @@ namespace c4 {
 
             int j = 0;
 
+#ifdef __C4_AVX2__
+            if (simd::avx2::is_supported())
+                j = detail::yuv420_to_rgb_row_avx2<uvByteOrder, dstByteOrder>(py0, py1, puv, pdst0, pdst1, w2, c, add);
+#endif
 #ifdef __C4_SIMD__
             using namespace c4::simd;
 
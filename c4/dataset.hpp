@@ -133,7 +133,8 @@ namespace c4 {
 
             progress_indicator progress((uint32_t)mds.data.size(), "dataset::load");
 
-            parallel_for(range(mds.data), [&](int i) {
+            // images differ a lot in the number of objects, so they are handed out one by one
+            parallel_for(range(mds.data), 1, Schedule::Dynamic, [&](int i) {
                 const auto& file_meta = mds.data[i];
 
                 auto& xp = ts_xp.local();
@@ -149,7 +150,7 @@ namespace c4 {
 
             auto counter = [](int a, const std::vector<matrix<uint8_t>>& v) { return a + isize(v); };
             
-            for (int i : range(ts_xn)) {
+            for (int i : range(ts_xn.size())) {
                 int num_p = isize(ts_xp[i]);
                 int num_n = isize(ts_xn[i]);
 
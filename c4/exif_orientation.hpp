@@ -26,6 +26,8 @@
 
 #include <cstring>
 
+#include "matrix.hpp"
+
 namespace c4 {
     namespace detail {
         inline uint16_t get_uint16(const unsigned char * buf, bool intel) {
@@ -119,4 +121,22 @@ namespace c4 {
 
         return ExifOrienation::UNSPECIFIED;
     }
+
+    // Turns an image stored with orientation o upright
+    template<class T>
+    inline void apply_exif_orientation(matrix<T>& img, ExifOrienation o) {
+        switch (o) {
+        case ExifOrienation::LOWER_RIGHT:
+            rotate180(img);
+            break;
+        case ExifOrienation::UPPER_RIGHT:
+            rotate90cw(img);
+            break;
+        case ExifOrienation::LOWER_LEFT:
+            rotate270cw(img);
+            break;
+        default:
+            break;
+        }
+    }
 };
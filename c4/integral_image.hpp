@@ -22,25 +22,234 @@
 
 #pragma once
 
+#include <vector>
+#include <type_traits>
+
+#include <c4/simd.hpp>
 #include <c4/matrix.hpp>
+#include <c4/geometry.hpp>
+#include <c4/parallel.hpp>
 
 namespace c4 {
-    static void calc_integral_image(const matrix_ref<uint8_t>& src, matrix<uint32_t>& dst) {
-        dst.resize(src.dimensions());
-        uint32_t row_sum = 0;
-        for (int j : range(src.width())) {
-            row_sum += src[0][j];
-            dst[0][j] = row_sum;
+    namespace detail {
+        struct integral_value {
+            static constexpr bool squared = false;
+
+            template<class D, class S>
+            static D get(S x) {
+                return D(x);
+            }
+        };
+
+        struct integral_square {
+            static constexpr bool squared = true;
+
+            template<class D, class S>
+            static D get(S x) {
+                return D(x) * D(x);
+            }
+        };
+
+        // dst[j] = up[j] + the sum of Map(src[k]) for k <= j, up is nullptr for the first row
+        template<class Map, class S, class D>
+        inline void integral_row(const S* src, const D* up, D* dst, int n) {
+            int j = 0;
+            D row_sum = 0;
+
+#ifdef __C4_SIMD__
+            if constexpr (std::is_same<S, uint8_t>::value && std::is_same<D, uint32_t>::value) {
+                simd::uint32x4 carry(0u);
+
+                for (; j + 16 <= n; j += 16) {
+                    simd::uint16x8 lo = simd::load_long(src + j);
+                    simd::uint16x8 hi = simd::load_long(src + j + 8);
+
+                    if constexpr (Map::squared) {
+                        lo = simd::mul_lo(lo, lo);
+                        hi = simd::mul_lo(hi, hi);
+                    }
+
+                    const simd::uint32x4x2 l = simd::long_move(lo);
+                    const simd::uint32x4x2 h = simd::long_move(hi);
+                    simd::uint32x4 v[4] = { l.val[0], l.val[1], h.val[0], h.val[1] };
+
+                    // prefix sums within the registers first, so that only the carries depend on each other
+                    for (int k = 0; k < 4; k++) {
+                        v[k] = simd::add(v[k], simd::shift_lanes_up<1>(v[k]));
+                        v[k] = simd::add(v[k], simd::shift_lanes_up<2>(v[k]));
+                    }
+
+                    for (int k = 0; k < 4; k++) {
+                        v[k] = simd::add(v[k], carry);
+                        carry = simd::broadcast_lane<3>(v[k]);
+
+                        simd::store(dst + j + 4 * k, up ? simd::add(v[k], simd::load(up + j + 4 * k)) : v[k]);
+                    }
+                }
+
+                row_sum = simd::get<0>(carry);
+            }
+#endif
+            for (; j < n; j++) {
+                row_sum += Map::template get<D>(src[j]);
+                dst[j] = up ? up[j] + row_sum : row_sum;
+            }
         }
 
-        for (int i : range(1, src.height())) {
-            row_sum = 0;
-            for (int j : range(src.width())) {
-                row_sum += src[i][j];
-                dst[i][j] = dst[i - 1][j] + row_sum;
+        // Each band of rows is summed up on its own, then every band gets the last row of the bands above it added
+        template<class Map, class S, class D>
+        inline void integral_image(const matrix_ref<S>& src, matrix<D>& dst, thread_pool& tp) {
+            dst.resize_for_overwrite(src.dimensions());
+
+            const int height = src.height();
+            const int width = src.width();
+
+            // a single thread is better off without the second pass
+            const int band = tp.get_num_threads() > 1 ? std::max((1 << 16) / std::max(width, 1), 1) : std::max(height, 1);
+            const int num_bands = (height + band - 1) / band;
+
+            auto sum_band = [&](int b) {
+                for (int i = b * band; i < std::min((b + 1) * band, height); i++)
+                    integral_row<Map>(src[i].data(), i == b * band ? nullptr : dst[i - 1].data(), dst[i].data(), width);
+            };
+
+            if (num_bands < 2) {
+                if (num_bands == 1)
+                    sum_band(0);
+                return;
             }
+
+            parallel_for(range(num_bands), 1, sum_band, tp);
+
+            // carries[b] is the sum of all rows above band b + 1
+            matrix<D> carries(num_bands - 1, width);
+            std::copy(dst[band - 1].begin(), dst[band - 1].end(), carries[0].begin());
+
+            for (int b = 1; b + 1 < num_bands; b++) {
+                const D* last = dst[(b + 1) * band - 1].data();
+                const D* prev = carries[b - 1].data();
+                D* c = carries[b].data();
+
+                for (int j = 0; j < width; j++)
+                    c[j] = prev[j] + last[j];
+            }
+
+            parallel_for(range(1, num_bands), 1, [&](int b) {
+                const D* c = carries[b - 1].data();
+
+                for (int i = b * band; i < std::min((b + 1) * band, height); i++) {
+                    D* d = dst[i].data();
+
+                    for (int j = 0; j < width; j++)
+                        d[j] += c[j];
+                }
+            }, tp);
         }
+    };
+
+    // dst[i][j] is the sum of src[y][x] for y <= i and x <= j.
+    // D has to hold the sum of the whole image: uint32_t is enough for 8-bit images of up to 16M pixels,
+    // uint64_t, float and double are there for bigger sums. 8-bit images with uint32_t sums go through simd.
+    template<class S, class D>
+    inline void calc_integral_image(const matrix_ref<S>& src, matrix<D>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        detail::integral_image<detail::integral_value>(src, dst, tp);
     }
 
-    // TODO: add more stuff
+    // Same for the squares of src, together with the plain one gives the variance of any rectangle
+    template<class S, class D>
+    inline void calc_squared_integral_image(const matrix_ref<S>& src, matrix<D>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        detail::integral_image<detail::integral_square>(src, dst, tp);
+    }
+
+    // Sum of the rectangle r from an integral image
+    template<class D>
+    inline D integral_sum(const matrix_ref<D>& ii, const rectangle<int>& r) {
+        assert(ii.is_inside(r));
+
+        if (r.w <= 0 || r.h <= 0)
+            return D(0);
+
+        const int x0 = r.x - 1;
+        const int y0 = r.y - 1;
+        const int x1 = r.x + r.w - 1;
+        const int y1 = r.y + r.h - 1;
+
+        D s = ii[y1][x1];
+
+        if (y0 >= 0)
+            s -= ii[y0][x1];
+
+        if (x0 >= 0)
+            s -= ii[y1][x0];
+
+        if (x0 >= 0 && y0 >= 0)
+            s += ii[y0][x0];
+
+        return s;
+    }
+
+    // dst[i][j] is the sum of src[y][x] for y <= i and |x - j| <= i - y, a triangle with the corner at (i, j),
+    // for sums of rectangles turned by 45 degrees, see tilted_integral_sum().
+    template<class S, class D>
+    inline void calc_tilted_integral_image(const matrix_ref<S>& src, matrix<D>& dst) {
+        dst.resize_for_overwrite(src.dimensions());
+
+        const int width = src.width();
+
+        // a[k] and b[k] add up the prefix sums of every row y above, up to element k + (i - y) and k - (i - y),
+        // so the triangle at (i, j) is a[j] - b[j - 1]. Past the right edge the prefix sums stop growing.
+        std::vector<D> row(width), a(width), b(width);
+        D total = 0;
+
+        for (int i = 0; i < src.height(); i++) {
+            detail::integral_row<detail::integral_value, S, D>(src[i].data(), nullptr, row.data(), width);
+
+            const D a_right = total;
+            for (int k = 0; k + 1 < width; k++)
+                a[k] = row[k] + a[k + 1];
+
+            if (width > 0) {
+                a[width - 1] = row[width - 1] + a_right;
+                total += row[width - 1];
+            }
+
+            for (int k = width - 1; k > 0; k--)
+                b[k] = row[k] + b[k - 1];
+
+            if (width > 0)
+                b[0] = row[0];
+
+            D* d = dst[i].data();
+
+            if (width > 0)
+                d[0] = a[0];
+
+            for (int k = 1; k < width; k++)
+                d[k] = a[k] - b[k - 1];
+        }
+    }
+
+    // Sum of a rectangle turned by 45 degrees, from a tilted integral image. Its top pixel is (x, y),
+    // it goes w pixels down and right from there and h pixels down and left, 2 * w * h pixels in total,
+    // and spans columns x - h + 1 to x + w - 1 and rows y to y + w + h - 1.
+    template<class D>
+    inline D tilted_integral_sum(const matrix_ref<D>& tii, int x, int y, int w, int h) {
+        assert(x - h + 1 >= 0 && x + w <= tii.width() && y >= 0 && y + w + h <= tii.height());
+
+        // triangles with the corner just outside the left or the right edge are the ones a row above
+        auto at = [&](int j, int i) -> D {
+            if (j < 0) {
+                j++;
+                i--;
+            }
+            else if (j >= tii.width()) {
+                j--;
+                i--;
+            }
+
+            return i >= 0 ? tii[i][j] : D(0);
+        };
+
+        return at(x - h + w, y + w + h - 1) + at(x, y - 1) - at(x - h, y + h - 1) - at(x + w, y + w - 1);
+    }
 };
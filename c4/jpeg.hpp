@@ -1581,14 +1581,13 @@ namespace c4 {
             }
 
             // can't error after this so, this is safe
-            img.resize(z.os.img_y, z.os.img_x);
-            uint8_t *output = (uint8_t *)img.data();
+            img.resize_for_overwrite(z.os.img_y, z.os.img_x);
 
             uint8_t *coutput[4] = { NULL, NULL, NULL, NULL };
 
             // now go ahead and resample
             for (uint32_t j = 0; j < z.os.img_y; ++j) {
-                uint8_t *out = output + n * z.os.img_x * j;
+                uint8_t *out = (uint8_t *)img[j].data();
                 for (int k = 0; k < decode_n; ++k) {
                     auto *r = &res_comp[k];
                     int y_bot = r->ystep >= (r->vs >> 1);
@@ -30,8 +30,9 @@ namespace c4 {
         static constexpr int row_step = n;
         static constexpr int d = 2 * n;
 
-        static c4::matrix<uint8_t> transform(const c4::matrix<uint8_t>& img) {
-            c4::matrix<uint8_t> lbp(calc_dimensions(img.dimensions()));
+        static c4::matrix<uint8_t> transform(const c4::matrix_ref<uint8_t>& img, buffer_pool* pool = nullptr) {
+            c4::matrix<uint8_t> lbp(pool);
+            lbp.resize_for_overwrite(calc_dimensions(img.dimensions()));
 
             for (int i : c4::range(lbp.height())) {
                 int k = i % n + 1;
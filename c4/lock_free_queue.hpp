@@ -1,74 +1,339 @@
-//MIT License
-//
-//Copyright(c) 2022 Alex Kasitskyi
-//
-//Permission is hereby granted, free of charge, to any person obtaining a copy
-//of this software and associated documentation files(the "Software"), to deal
-//in the Software without restriction, including without limitation the rights
-//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
-//copies of the Software, and to permit persons to whom the Software is
-//furnished to do so, subject to the following conditions :
-//
-//The above copyright notice and this permission notice shall be included in all
-//copies or substantial portions of the Software.
-//
-//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
-//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
-//SOFTWARE.
-
-#pragma once
-
-#include <atomic>
-#include <cstdint>
-
-namespace c4 {
-    // Lock-free queue for single producer -> single consumer.
-    template <typename T, uint32_t capacity>
-    class lock_free_queue {
-        T buffer[capacity] = { 0 };
-        std::atomic<uint32_t> wc = 0;
-        std::atomic<uint32_t> rc = 0;
-
-        static inline uint32_t mask(uint32_t i) {
-            return i & (capacity - 1);
-        }
-
-    public:
-        static_assert((capacity & (capacity-1)) == 0, "Capacity must be a power of 2");
-
-        uint32_t size() const {
-            return wc - rc;
-        }
-
-        bool empty() const {
-            return rc == wc;
-        }
-
-        bool full() const {
-            return rc + capacity == wc;
-        }
-
-        void push(const T& t) {
-            buffer[mask(wc)] = t;
-            ++wc;
-        }
-
-        T& front() {
-            return buffer[mask(rc)];
-        }
-
-        void pop() {
-            ++rc;
-        }
-
-        T pop_it() {
-        	T r = buffer[mask(rc)];
-        	++rc;
-            return r;
-        }
-    };
-};
+//MIT License
+//
+//Copyright(c) 2022 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace c4 {
+    // Lock-free queue for single producer -> single consumer.
+    // Each side keeps its own index and a cached copy of the other one on its own cache line,
+    // and only rereads the other side's index when the cached value says the queue is full / empty.
+    // With blocking = true, push_wait() / pop_wait() sleep in std::atomic::wait instead of spinning.
+    template <typename T, uint32_t capacity, bool blocking = false>
+    class lock_free_queue {
+        // Producer's line
+        alignas(64) std::atomic<uint32_t> wc = 0;
+        uint32_t rc_cache = 0;
+
+        // Consumer's line
+        alignas(64) std::atomic<uint32_t> rc = 0;
+        uint32_t wc_cache = 0;
+
+        // Only written when a side goes to sleep
+        alignas(64) std::atomic<bool> producer_waiting = false;
+        std::atomic<bool> consumer_waiting = false;
+
+        alignas(64) T buffer[capacity] = {};
+
+        static inline uint32_t mask(uint32_t i) {
+            return i & (capacity - 1);
+        }
+
+        // Producer: room for at least n elements, or as much as there is
+        uint32_t free_space(uint32_t w, uint32_t n) {
+            if (capacity - (w - rc_cache) < n)
+                rc_cache = rc.load(std::memory_order_acquire);
+
+            return capacity - (w - rc_cache);
+        }
+
+        // Consumer: at least n elements, or as many as there are
+        uint32_t available(uint32_t r, uint32_t n) {
+            if (wc_cache - r < n)
+                wc_cache = wc.load(std::memory_order_acquire);
+
+            return wc_cache - r;
+        }
+
+        // In blocking mode the index store and the flag load are seq_cst, as are the flag store and the index load
+        // in wait_while(): either the sleeper sees the new index, or we see its flag and wake it up
+        static void publish(std::atomic<uint32_t>& index, uint32_t value, std::atomic<bool>& other_waiting) {
+            if constexpr (blocking) {
+                index.store(value, std::memory_order_seq_cst);
+                if (other_waiting.load(std::memory_order_seq_cst))
+                    index.notify_one();
+            } else {
+                index.store(value, std::memory_order_release);
+            }
+        }
+
+        static void wait_while(std::atomic<uint32_t>& index, uint32_t value, std::atomic<bool>& waiting) {
+            waiting.store(true, std::memory_order_seq_cst);
+            index.wait(value, std::memory_order_seq_cst);
+            waiting.store(false, std::memory_order_relaxed);
+        }
+
+    public:
+        static_assert((capacity & (capacity-1)) == 0, "Capacity must be a power of 2");
+
+        uint32_t size() const {
+            return wc - rc;
+        }
+
+        bool empty() const {
+            return rc == wc;
+        }
+
+        bool full() const {
+            return rc + capacity == wc;
+        }
+
+        // Producer side
+
+        // Doesn't check for room: overwrites the oldest element when full
+        void push(const T& t) {
+            const uint32_t w = wc.load(std::memory_order_relaxed);
+            buffer[mask(w)] = t;
+            publish(wc, w + 1, consumer_waiting);
+        }
+
+        bool try_push(const T& t) {
+            return push_n(&t, 1) == 1;
+        }
+
+        // Pushes as much of [first, first + n) as fits; returns how many
+        template<class iterator>
+        uint32_t push_n(iterator first, uint32_t n) {
+            const uint32_t w = wc.load(std::memory_order_relaxed);
+            const uint32_t k = std::min(n, free_space(w, n));
+
+            for (uint32_t i = 0; i < k; i++, ++first)
+                buffer[mask(w + i)] = *first;
+
+            if (k)
+                publish(wc, w + k, consumer_waiting);
+
+            return k;
+        }
+
+        void push_wait(const T& t) {
+            static_assert(blocking, "push_wait() needs lock_free_queue<T, capacity, true>");
+
+            while (!try_push(t))
+                wait_while(rc, wc.load(std::memory_order_relaxed) - capacity, producer_waiting);
+        }
+
+        // Consumer side
+
+        T& front() {
+            return buffer[mask(rc)];
+        }
+
+        void pop() {
+            publish(rc, rc.load(std::memory_order_relaxed) + 1, producer_waiting);
+        }
+
+        T pop_it() {
+            T r = front();
+            pop();
+            return r;
+        }
+
+        bool try_pop(T& t) {
+            return pop_n(&t, 1) == 1;
+        }
+
+        // Pops up to n elements into out; returns how many
+        template<class iterator>
+        uint32_t pop_n(iterator out, uint32_t n) {
+            const uint32_t r = rc.load(std::memory_order_relaxed);
+            const uint32_t k = std::min(n, available(r, n));
+
+            for (uint32_t i = 0; i < k; i++, ++out)
+                *out = std::move(buffer[mask(r + i)]);
+
+            if (k)
+                publish(rc, r + k, producer_waiting);
+
+            return k;
+        }
+
+        T pop_wait() {
+            static_assert(blocking, "pop_wait() needs lock_free_queue<T, capacity, true>");
+
+            T t;
+            while (!try_pop(t))
+                wait_while(wc, rc.load(std::memory_order_relaxed), consumer_waiting);
+
+            return t;
+        }
+    };
+
+    namespace detail {
+        inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+            _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            asm volatile("yield");
+#endif
+        }
+
+        // Spins with exponentially growing pauses, then falls back to yielding the time slice.
+        class backoff {
+            int step = 0;
+
+        public:
+            void operator()() {
+                if (step < 10) {
+                    for (int i = 0; i < (1 << step); i++)
+                        cpu_relax();
+                    step++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        };
+    };
+
+    // Bounded lock-free queue for multiple producers -> multiple consumers.
+    // Every cell carries a sequence number telling which lap of the ring it is ready for (D. Vyukov's design),
+    // so producers and consumers only contend on their own index.
+    template <typename T, uint32_t capacity>
+    class mpmc_queue {
+        struct cell {
+            std::atomic<uint32_t> seq;
+            T value;
+        };
+
+        alignas(64) cell buffer[capacity];
+        alignas(64) std::atomic<uint32_t> wc = 0;
+        alignas(64) std::atomic<uint32_t> rc = 0;
+
+        static inline uint32_t mask(uint32_t i) {
+            return i & (capacity - 1);
+        }
+
+        // Claims up to n consecutive cells at the head of the ring, whose sequence is pos + ready; returns pos and the number claimed
+        std::pair<uint32_t, uint32_t> claim(std::atomic<uint32_t>& index, uint32_t n, uint32_t ready) {
+            uint32_t pos = index.load(std::memory_order_relaxed);
+
+            for (;;) {
+                uint32_t k = 0;
+                while (k < n && buffer[mask(pos + k)].seq.load(std::memory_order_acquire) == pos + k + ready)
+                    k++;
+
+                if (k == 0) {
+                    const int32_t diff = int32_t(buffer[mask(pos)].seq.load(std::memory_order_acquire) - (pos + ready));
+
+                    // The cell is still a lap behind: the ring is full (or empty)
+                    if (diff < 0)
+                        return { pos, 0 };
+
+                    // Somebody else took pos already
+                    pos = index.load(std::memory_order_relaxed);
+                    continue;
+                }
+
+                if (index.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+                    return { pos, k };
+            }
+        }
+
+    public:
+        static_assert((capacity & (capacity-1)) == 0, "Capacity must be a power of 2");
+        static_assert(capacity >= 2, "Capacity must be at least 2");
+
+        mpmc_queue() {
+            for (uint32_t i = 0; i < capacity; i++)
+                buffer[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        mpmc_queue(const mpmc_queue&) = delete;
+        mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+        // Approximate when other threads are pushing or popping
+        uint32_t size() const {
+            const uint32_t r = rc.load(std::memory_order_relaxed);
+            const uint32_t w = wc.load(std::memory_order_relaxed);
+            return std::min(w - r, capacity);
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        bool try_push(const T& t) {
+            return try_push_n(&t, 1) == 1;
+        }
+
+        bool try_push(T&& t) {
+            return try_push_n(std::make_move_iterator(&t), 1) == 1;
+        }
+
+        bool try_pop(T& t) {
+            return try_pop_n(&t, 1) == 1;
+        }
+
+        // Pushes a prefix of [first, first + n) with a single index update; returns its length
+        template<class iterator>
+        uint32_t try_push_n(iterator first, uint32_t n) {
+            auto [pos, k] = claim(wc, n, 0);
+
+            for (uint32_t i = 0; i < k; i++, ++first) {
+                cell& c = buffer[mask(pos + i)];
+                c.value = *first;
+                c.seq.store(pos + i + 1, std::memory_order_release);
+            }
+
+            return k;
+        }
+
+        // Pops up to n elements into out with a single index update; returns how many
+        template<class iterator>
+        uint32_t try_pop_n(iterator out, uint32_t n) {
+            auto [pos, k] = claim(rc, n, 1);
+
+            for (uint32_t i = 0; i < k; i++, ++out) {
+                cell& c = buffer[mask(pos + i)];
+                *out = std::move(c.value);
+                c.seq.store(pos + i + capacity, std::memory_order_release);
+            }
+
+            return k;
+        }
+
+        // Blocking versions: spin with backoff until there is room / an element
+        void push(const T& t) {
+            for (detail::backoff wait; !try_push(t); wait());
+        }
+
+        void push(T&& t) {
+            for (detail::backoff wait; !try_push(std::move(t)); wait());
+        }
+
+        T pop() {
+            T t;
+            for (detail::backoff wait; !try_pop(t); wait());
+            return t;
+        }
+    };
+};
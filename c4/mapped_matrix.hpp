@@ -0,0 +1,225 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "matrix.hpp"
+#include "exception.hpp"
+
+namespace c4 {
+    namespace detail {
+        // The whole file mapped read-only. Pages are shared with every other process that maps
+        // or reads the file, and are loaded and evicted by the OS page cache.
+        class mapped_file {
+            const uint8_t* ptr = nullptr;
+            size_t size_ = 0;
+
+            void unmap() {
+                if (ptr == nullptr)
+                    return;
+#if defined(_WIN32)
+                UnmapViewOfFile(ptr);
+#else
+                munmap((void*)ptr, size_);
+#endif
+                ptr = nullptr;
+                size_ = 0;
+            }
+
+        public:
+            mapped_file() = default;
+
+            explicit mapped_file(const std::string& filepath) {
+#if defined(_WIN32)
+                HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (file == INVALID_HANDLE_VALUE)
+                    THROW_EXCEPTION("Can't open " + filepath);
+
+                LARGE_INTEGER file_size;
+                if (!GetFileSizeEx(file, &file_size)) {
+                    CloseHandle(file);
+                    THROW_EXCEPTION("Can't get the size of " + filepath);
+                }
+
+                size_ = size_t(file_size.QuadPart);
+
+                if (size_ != 0) {
+                    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                    CloseHandle(file);
+
+                    if (mapping == NULL)
+                        THROW_EXCEPTION("Can't map " + filepath);
+
+                    ptr = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    CloseHandle(mapping);
+                }
+                else {
+                    CloseHandle(file);
+                }
+#else
+                const int fd = ::open(filepath.c_str(), O_RDONLY);
+                if (fd == -1)
+                    THROW_EXCEPTION("Can't open " + filepath);
+
+                struct stat st;
+                if (fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    THROW_EXCEPTION("Can't get the size of " + filepath);
+                }
+
+                size_ = size_t(st.st_size);
+
+                if (size_ != 0) {
+                    void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+                    ptr = p == MAP_FAILED ? nullptr : (const uint8_t*)p;
+                }
+
+                ::close(fd);
+#endif
+                if (size_ != 0 && ptr == nullptr)
+                    THROW_EXCEPTION("Can't map " + filepath);
+            }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            mapped_file(mapped_file&& b) noexcept : ptr(std::exchange(b.ptr, nullptr)), size_(std::exchange(b.size_, 0)) {}
+
+            mapped_file& operator=(mapped_file&& b) noexcept {
+                if (this != &b) {
+                    unmap();
+                    ptr = std::exchange(b.ptr, nullptr);
+                    size_ = std::exchange(b.size_, 0);
+                }
+
+                return *this;
+            }
+
+            ~mapped_file() {
+                unmap();
+            }
+
+            const uint8_t* data() const {
+                return ptr;
+            }
+
+            size_t size() const {
+                return size_;
+            }
+        };
+    };
+
+    // A read-only matrix that lives in a memory-mapped file, so opening it costs next to nothing
+    // and rows are only read from disk when touched. The file can be bigger than RAM.
+    //     mapped_matrix<float> features("features.bin");
+    //     float x = features[i][j];
+    // By default the file is what c4::save() writes for a matrix<T>: height, width and stride as int32,
+    // the uint32 number of elements, then height * stride elements.
+    // The mapping goes away with the object, so rows taken from it must not outlive it.
+    template<class T>
+    class mapped_matrix : public matrix_ref<const T> {
+        static_assert(std::is_trivially_copyable<T>::value, "mapped_matrix needs a trivially copyable T");
+
+        detail::mapped_file file;
+
+        void set_layout(int height, int width, int stride, size_t offset, const std::string& filepath) {
+            if (height < 0 || width < 0 || stride < width || (height > 0 && stride == 0))
+                THROW_EXCEPTION("Bad matrix layout in " + filepath);
+
+            if (offset % alignof(T) != 0)
+                THROW_EXCEPTION("Misaligned matrix data in " + filepath);
+
+            if (file.size() < offset || (file.size() - offset) / sizeof(T) / std::max(stride, 1) < size_t(height))
+                THROW_EXCEPTION("File is too short for the matrix: " + filepath);
+
+            this->height_ = height;
+            this->width_ = width;
+            this->stride_ = stride;
+            this->ptr_ = height > 0 ? (const T*)(file.data() + offset) : nullptr;
+        }
+
+    public:
+        mapped_matrix() = default;
+
+        explicit mapped_matrix(const std::string& filepath) : file(filepath) {
+            constexpr size_t header_size = 3 * sizeof(int32_t) + sizeof(uint32_t);
+
+            if (file.size() < header_size)
+                THROW_EXCEPTION("File is too short for a matrix header: " + filepath);
+
+            int32_t header[3];
+            uint32_t size;
+            std::memcpy(header, file.data(), sizeof(header));
+            std::memcpy(&size, file.data() + sizeof(header), sizeof(size));
+
+            if (int64_t(header[0]) * header[2] != size)
+                THROW_EXCEPTION("Bad matrix header in " + filepath);
+
+            set_layout(header[0], header[1], header[2], header_size, filepath);
+        }
+
+        // A headerless file of height rows, stride elements apart, the first of which starts offset bytes in
+        mapped_matrix(const std::string& filepath, int height, int width, int stride, size_t offset = 0) : file(filepath) {
+            set_layout(height, width, stride, offset, filepath);
+        }
+
+        mapped_matrix(const std::string& filepath, matrix_dimensions dims, size_t offset = 0) : mapped_matrix(filepath, dims.height, dims.width, dims.width, offset) {}
+
+        mapped_matrix(mapped_matrix&& b) noexcept : matrix_ref<const T>(b.height_, b.width_, b.stride_, b.ptr_), file(std::move(b.file)) {
+            b.height_ = b.width_ = b.stride_ = 0;
+            b.ptr_ = nullptr;
+        }
+
+        mapped_matrix& operator=(mapped_matrix&& b) noexcept {
+            if (this != &b) {
+                file = std::move(b.file);
+                this->height_ = std::exchange(b.height_, 0);
+                this->width_ = std::exchange(b.width_, 0);
+                this->stride_ = std::exchange(b.stride_, 0);
+                this->ptr_ = std::exchange(b.ptr_, nullptr);
+            }
+
+            return *this;
+        }
+    };
+};
@@ -22,16 +22,28 @@
 
 #pragma once
 
+#include <new>
 #include <vector>
 #include <cassert>
+#include <numeric>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
 
+#include "simd.hpp"
 #include "range.hpp"
 #include "geometry.hpp"
+#include "parallel.hpp"
+#include "buffer_pool.hpp"
 
 namespace c4 {
     template<class T>
     class matrix_ref;
 
+    template<class E>
+    class matrix_expr;
+
     template<class T>
     class vector_ref {
         friend class matrix_ref<T>;
@@ -373,19 +385,138 @@ namespace c4 {
         }
     };
 
+    // Matrix buffers start at this alignment, and so do the rows of padded matrices.
+    constexpr int matrix_alignment = 64;
+
+    // Layout for SIMD kernels: every row starts at a matrix_alignment boundary and takes a whole number of them,
+    // so loads can be aligned and may run over the end of a row. border adds at least that many rows and columns
+    // on each side, which belong to the matrix and can be read and written.
+    struct matrix_padding {
+        int border = 0;
+    };
+
     namespace detail {
+        // Takes memory from pool if there is one, the pool travels with the buffer on moves and swaps
+        template<class T, size_t alignment>
+        struct aligned_allocator {
+            typedef T value_type;
+            typedef std::true_type propagate_on_container_move_assignment;
+            typedef std::true_type propagate_on_container_swap;
+
+            template<class U>
+            struct rebind {
+                typedef aligned_allocator<U, alignment> other;
+            };
+
+            buffer_pool* pool = nullptr;
+
+            aligned_allocator() = default;
+            aligned_allocator(buffer_pool* pool) : pool(pool) {}
+
+            template<class U>
+            aligned_allocator(const aligned_allocator<U, alignment>& o) : pool(o.pool) {}
+
+            T* allocate(size_t n) {
+                if (pool)
+                    return static_cast<T*>(pool->allocate(n * sizeof(T), std::max(alignment, alignof(T))));
+
+                return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(std::max(alignment, alignof(T)))));
+            }
+
+            void deallocate(T* p, size_t n) {
+                if (pool)
+                    pool->deallocate(p, n * sizeof(T), std::max(alignment, alignof(T)));
+                else
+                    ::operator delete(p, std::align_val_t(std::max(alignment, alignof(T))));
+            }
+
+            // Default-initializes instead of value-initializing, so that growing a buffer of pixels doesn't zero it.
+            // matrix_buffer zeroes explicitly where that's needed.
+            template<class U, class... Args>
+            void construct(U* p, Args&&... args) {
+                if constexpr (sizeof...(Args) == 0)
+                    ::new((void*)p) U;
+                else
+                    ::new((void*)p) U(std::forward<Args>(args)...);
+            }
+
+            template<class U>
+            bool operator==(const aligned_allocator<U, alignment>& o) const {
+                return pool == o.pool;
+            }
+
+            template<class U>
+            bool operator!=(const aligned_allocator<U, alignment>& o) const {
+                return pool != o.pool;
+            }
+        };
+
         template<class T>
         class matrix_buffer {
         protected:
-            std::vector<T> v;
+            std::vector<T, aligned_allocator<T, matrix_alignment>> v;
             matrix_buffer() {}
-            matrix_buffer(size_t size) : v(size) {}
+            matrix_buffer(buffer_pool* pool) : v(aligned_allocator<T, matrix_alignment>(pool)) {}
+            matrix_buffer(size_t size) : v(size, T()) {}
             matrix_buffer(size_t size, const T& init) : v(size, init) {}
+
+            // New elements are zeroed like std::vector::resize() does, unless they are about to be overwritten
+            void resize_buffer(size_t size, bool zero_new) {
+                const size_t old_size = v.size();
+                v.resize(size);
+
+                if (zero_new && size > old_size)
+                    std::fill(v.begin() + old_size, v.end(), T());
+            }
         };
     };
 
     template<class T>
     class matrix : private detail::matrix_buffer<T>, public matrix_ref<T> {
+        bool padded_ = false;
+        int border_ = 0;
+
+        // Smallest number of elements that is a whole number of matrix_alignment blocks
+        static constexpr int alignment_elements() {
+            return matrix_alignment / std::gcd(matrix_alignment, int(sizeof(T)));
+        }
+
+        static int align_up(int n) {
+            return (n + alignment_elements() - 1) / alignment_elements() * alignment_elements();
+        }
+
+        void set_layout(int height, int width, int stride, bool zero_new) {
+            padded_ = false;
+            border_ = 0;
+
+            this->height_ = height;
+            this->width_ = width;
+            this->stride_ = stride;
+            this->resize_buffer(height * stride, zero_new);
+            this->ptr_ = this->v.data();
+        }
+
+        void set_layout(int height, int width, bool zero_new) {
+            if (!padded_) {
+                set_layout(height, width, width, zero_new);
+                return;
+            }
+
+            // the left border is rounded up, so that rows stay aligned
+            const int left = align_up(border_);
+            const int stride = align_up(left + width + border_);
+
+            this->height_ = height;
+            this->width_ = width;
+            this->stride_ = stride;
+            this->resize_buffer((height + 2 * border_) * stride, zero_new);
+            this->ptr_ = this->v.data() + border_ * stride + left;
+        }
+
+        bool same_layout(const matrix& b) const {
+            return this->stride_ == b.stride_ && this->v.size() == b.v.size() && this->ptr_ - this->v.data() == b.ptr_ - b.v.data();
+        }
+
     public:
         matrix(int height, int width, int stride) : detail::matrix_buffer<T>(height * stride), matrix_ref<T>(height, width, stride, detail::matrix_buffer<T>::v.data()) {}
         matrix(int height, int width, int stride, const T& init) : detail::matrix_buffer<T>(height * stride, init), matrix_ref<T>(height, width, stride, detail::matrix_buffer<T>::v.data()) {}
@@ -393,21 +524,73 @@ namespace c4 {
         matrix(matrix_dimensions dims, int stride) : matrix(dims.height, dims.width, stride) {}
         matrix(matrix_dimensions dims) : matrix(dims.height, dims.width) {}
         matrix() : matrix(0, 0, 0) {}
+
+        // The padding is kept by later resize(height, width) calls and by assignments to this matrix
+        matrix(int height, int width, matrix_padding padding) : padded_(true), border_(std::max(padding.border, 0)) {
+            resize(height, width);
+        }
+
+        matrix(matrix_dimensions dims, matrix_padding padding) : matrix(dims.height, dims.width, padding) {}
+
+        // Memory comes from pool, also after resizes, and goes back there when the matrix is destroyed.
+        // Copies and moves take the pool along. Copy assignment keeps the pool of the target, move assignment takes the pool of the source.
+        // A null pool means plain allocation, as with the constructors above.
+        explicit matrix(buffer_pool* pool) : detail::matrix_buffer<T>(pool) {}
+
+        matrix(int height, int width, buffer_pool* pool) : matrix(pool) {
+            resize(height, width);
+        }
+
+        matrix(matrix_dimensions dims, buffer_pool* pool) : matrix(dims.height, dims.width, pool) {}
+
+        matrix(int height, int width, matrix_padding padding, buffer_pool* pool) : detail::matrix_buffer<T>(pool), padded_(true), border_(std::max(padding.border, 0)) {
+            resize(height, width);
+        }
         
         matrix& operator=(const matrix& b) {
-            resize(b.dimensions());
-            std::copy(b.v.begin(), b.v.end(), this->v.begin());
+            resize_for_overwrite(b.dimensions());
+
+            if (same_layout(b)) {
+                std::copy(b.v.begin(), b.v.end(), this->v.begin());
+            }
+            else {
+                for (int i = 0; i < b.height(); i++)
+                    std::copy(b[i].begin(), b[i].end(), (*this)[i].begin());
+            }
+
+            return *this;
+        }
+
+        matrix(const matrix& b) : detail::matrix_buffer<T>(b), matrix_ref<T>(b.height_, b.width_, b.stride_, nullptr), padded_(b.padded_), border_(b.border_) {
+            this->ptr_ = this->v.data() + (b.ptr_ - b.v.data());
+        }
+
+        // Takes over b's buffer and layout, b is left empty
+        matrix(matrix&& b) noexcept : matrix() {
+            swap(b);
+        }
+
+        matrix& operator=(matrix&& b) noexcept {
+            if (this != &b) {
+                matrix t(std::move(b));
+                swap(t);
+            }
 
             return *this;
         }
 
-        matrix(const matrix& b) {
-            resize(b.dimensions());
-            std::copy(b.v.begin(), b.v.end(), this->v.begin());
+        void swap(matrix& b) noexcept {
+            this->v.swap(b.v);
+            std::swap(this->height_, b.height_);
+            std::swap(this->width_, b.width_);
+            std::swap(this->stride_, b.stride_);
+            std::swap(this->ptr_, b.ptr_);
+            std::swap(padded_, b.padded_);
+            std::swap(border_, b.border_);
         }
 
         matrix& operator=(const matrix_ref<T>& b) {
-            resize(b.dimensions());
+            resize_for_overwrite(b.dimensions());
 
             for (int i = 0; i < b.height(); i++)
                 std::copy(b[i].begin(), b[i].end(), (*this)[i].begin());
@@ -416,39 +599,85 @@ namespace c4 {
         }
 
         matrix(const matrix_ref<T>& b) {
-            resize(b.dimensions());
+            resize_for_overwrite(b.dimensions());
 
             for(int i = 0; i < b.height(); i++)
                 std::copy(b[i].data(), b[i].data() + b.width(), (*this)[i].data());
         }
 
+        // Evaluates a lazy expression, see matrix_expr
+        template<class E>
+        matrix(const matrix_expr<E>& e) {
+            resize_for_overwrite(e.dimensions());
+            assign(*this, e);
+        }
+
+        template<class E>
+        matrix& operator=(const matrix_expr<E>& e) {
+            resize_for_overwrite(e.dimensions());
+            assign(*this, e);
+            return *this;
+        }
+
+        // nullptr if the matrix allocates on its own
+        buffer_pool* pool() const {
+            return this->v.get_allocator().pool;
+        }
+
+        bool is_padded() const {
+            return padded_;
+        }
+
+        int border() const {
+            return border_;
+        }
+
+        // Drops the padding
         void resize(int height, int width, int stride){
-            this->height_ = height;
-            this->width_ = width;
-            this->stride_ = stride;
-            this->v.resize(height * stride);
-            this->ptr_ = this->v.data();
+            set_layout(height, width, stride, true);
         }
 
         void resize(int height, int width){
-            resize(height, width, width);
+            set_layout(height, width, true);
+        }
+
+        void resize(matrix_dimensions dims){
+            resize(dims.height, dims.width);
+        }
+
+        // Same as resize(), but new elements of trivial types are left uninitialized.
+        // For outputs that are overwritten completely right after, like decoded or scaled images.
+        void resize_for_overwrite(int height, int width, int stride){
+            set_layout(height, width, stride, false);
+        }
+
+        void resize_for_overwrite(int height, int width){
+            set_layout(height, width, false);
+        }
+
+        void resize_for_overwrite(matrix_dimensions dims){
+            resize_for_overwrite(dims.height, dims.width);
         }
 
         void shrink_to_fit(){
+            const ptrdiff_t offset = this->ptr_ - this->v.data();
             this->v.shrink_to_fit();
+            this->ptr_ = this->v.data() + offset;
         }
 
         void clear_and_shrink() {
             resize(0, 0);
-            this->v.shrink_to_fit();
-        }
-
-        void resize(matrix_dimensions dims){
-            resize(dims.height, dims.width);
+            shrink_to_fit();
         }
 
+        // Matrices with a border are saved without it, so they load as unpadded ones
         template <typename Archive>
         void save(Archive& archive) const {
+            if (this->ptr_ != this->v.data()) {
+                matrix<T>(static_cast<const matrix_ref<T>&>(*this)).save(archive);
+                return;
+            }
+
             archive(this->height_, this->width_, this->stride_);
             archive(this->v);
         }
@@ -457,167 +686,556 @@ namespace c4 {
         void load(Archive& archive) {
             int height, width, stride;
             archive(height, width, stride);
-            resize(height, width, stride);
+            resize_for_overwrite(height, width, stride);
             archive(this->v);
+            this->ptr_ = this->v.data();
         }
     };
 
-    template<class T1, class T2>
-    inline matrix_ref<T1>& operator+=(matrix_ref<T1>& a, const matrix_ref<T2>& b) {
-        assert(a.height() == b.height() && a.width() == b.width());
+    // Element-wise arithmetic over matrices that is evaluated lazily: operators build a tree of nodes
+    // and nothing is computed until the expression is assigned to a matrix, which is done in one pass:
+    //     matrix<float> r = lazy(a) * 0.5f + b - c;
+    // Every row is computed by a plain loop over row pointers, which the compiler vectorizes,
+    // and large matrices are split into bands of rows that run in parallel.
+    // Nodes keep pointers into the operands, so build and assign the expression in the same statement.
+    // The target may also be an operand, as every element only depends on the same position in the others.
+    namespace detail {
+        template<class T>
+        struct matrix_leaf {
+            static constexpr bool is_scalar = false;
 
-        for (int i = 0; i < a.height(); i++) {
-            for (int j = 0; j < a.width(); j++) {
-                a[i][j] += b[i][j];
+            const T* ptr;
+            int stride;
+            matrix_dimensions dims;
+
+            matrix_dimensions dimensions() const {
+                return dims;
             }
-        }
 
-        return a;
-    }
+            const T* row(int i) const {
+                return ptr + ptrdiff_t(i) * stride;
+            }
+        };
 
-    template<class T1, class T2>
-    inline matrix<decltype(T1() + T2())> operator+(const matrix_ref<T1>& a, const matrix_ref<T2>& b) {
-        assert(a.dimensions() == b.dimensions());
+        template<class S>
+        struct scalar_row {
+            S v;
 
-        matrix<decltype(T1() + T2())> r(a.dimensions());
+            S operator[](int) const {
+                return v;
+            }
+        };
+
+        template<class S>
+        struct scalar_leaf {
+            static constexpr bool is_scalar = true;
+
+            S v;
+
+            scalar_row<S> row(int) const {
+                return { v };
+            }
+        };
+
+        template<class Op, class A, class B>
+        struct binary_row {
+            A a;
+            B b;
 
-        for (int i = 0; i < a.height(); i++) {
-            for (int j = 0; j < a.width(); j++) {
-                r[i][j] = a[i][j] + b[i][j];
+            auto operator[](int j) const {
+                return Op()(a[j], b[j]);
             }
+        };
+
+        template<class Op, class L, class R>
+        struct binary_node {
+            static constexpr bool is_scalar = false;
+
+            L l;
+            R r;
+
+            matrix_dimensions dimensions() const {
+                if constexpr (L::is_scalar)
+                    return r.dimensions();
+                else
+                    return l.dimensions();
+            }
+
+            auto row(int i) const {
+                return binary_row<Op, decltype(l.row(i)), decltype(r.row(i))>{ l.row(i), r.row(i) };
+            }
+        };
+
+        // Runs f(first, last) on bands of rows of about 64K elements in parallel, or on all rows at once if they are fewer
+        template<class F>
+        inline void parallel_rows(int height, int width, F f, thread_pool& tp) {
+            constexpr int band_elements = 1 << 16;
+
+            if (size_t(height) * width < band_elements || height < 2) {
+                f(0, height);
+                return;
+            }
+
+            const int grain = std::max(band_elements / std::max(width, 1), 1);
+
+            parallel_for(range(height), grain, [&](range rows) {
+                f(*rows.begin(), *rows.end());
+            }, tp);
+        }
+    };
+
+    template<class E>
+    class matrix_expr {
+        E e;
+
+    public:
+        typedef std::decay_t<decltype(std::declval<const E&>().row(0)[0])> value_type;
+
+        explicit matrix_expr(E e) : e(std::move(e)) {}
+
+        const E& node() const {
+            return e;
+        }
+
+        matrix_dimensions dimensions() const {
+            return e.dimensions();
+        }
+
+        int height() const {
+            return dimensions().height;
         }
 
-        return r;
+        int width() const {
+            return dimensions().width;
+        }
+    };
+
+    template<class T>
+    inline matrix_expr<detail::matrix_leaf<T>> lazy(const matrix_ref<T>& m) {
+        return matrix_expr<detail::matrix_leaf<T>>({ m.data(), m.stride(), m.dimensions() });
     }
 
-    template<class T1, class T2>
-    inline matrix_ref<T1>& operator-=(matrix<T1>& a, const matrix<T2>& b) {
-        assert(a.dimensions() == b.dimensions());
+    namespace detail {
+        template<class T>
+        inline matrix_leaf<T> as_node(const matrix_ref<T>& m) {
+            return lazy(m).node();
+        }
+
+        template<class E>
+        inline const E& as_node(const matrix_expr<E>& x) {
+            return x.node();
+        }
+
+        template<class S, class = typename std::enable_if<std::is_arithmetic<S>::value>::type>
+        inline scalar_leaf<S> as_node(S s) {
+            return { s };
+        }
+
+        template<class X>
+        using node_of = std::decay_t<decltype(as_node(std::declval<const X&>()))>;
+
+        template<class X>
+        struct is_matrix_expr : std::false_type {};
+
+        template<class E>
+        struct is_matrix_expr<matrix_expr<E>> : std::true_type {};
+
+        template<class Op, class A, class B>
+        using binary_expr = matrix_expr<binary_node<Op, node_of<A>, node_of<B>>>;
+
+        template<bool enable, class Op, class A, class B>
+        struct binary_expr_if {};
+
+        template<class Op, class A, class B>
+        struct binary_expr_if<true, Op, A, B> {
+            typedef binary_expr<Op, A, B> type;
+        };
+
+        // At least one side has to be an expression, so that the eager operators on matrix_ref keep working
+        template<class Op, class A, class B>
+        using lazy_result = typename binary_expr_if<is_matrix_expr<A>::value || is_matrix_expr<B>::value, Op, A, B>::type;
+
+        // An expression and a scalar
+        template<class Op, class A, class B>
+        using lazy_scalar_result = typename binary_expr_if<(is_matrix_expr<A>::value && std::is_arithmetic<B>::value) || (std::is_arithmetic<A>::value && is_matrix_expr<B>::value), Op, A, B>::type;
 
-        for (int i = 0; i < a.height(); i++) {
-            for (int j = 0; j < a.width(); j++) {
-                a[i][j] -= b[i][j];
+        template<class Op, class A, class B>
+        inline binary_expr<Op, A, B> make_binary(const A& a, const B& b) {
+            binary_node<Op, node_of<A>, node_of<B>> n{ as_node(a), as_node(b) };
+
+            if constexpr (!node_of<A>::is_scalar && !node_of<B>::is_scalar)
+                assert(n.l.dimensions() == n.r.dimensions());
+
+            return binary_expr<Op, A, B>(n);
+        }
+
+        template<class T, class E>
+        inline void eval_rows(matrix_ref<T>& dst, const E& e, int first, int last) {
+            const int width = dst.width();
+
+            for (int i = first; i < last; i++) {
+                T* d = dst[i].data();
+                const auto src = e.row(i);
+
+                for (int j = 0; j < width; j++)
+                    d[j] = src[j];
             }
         }
+    };
+
+    template<class A, class B>
+    inline detail::lazy_result<std::plus<>, A, B> operator+(const A& a, const B& b) {
+        return detail::make_binary<std::plus<>>(a, b);
+    }
+
+    template<class A, class B>
+    inline detail::lazy_result<std::minus<>, A, B> operator-(const A& a, const B& b) {
+        return detail::make_binary<std::minus<>>(a, b);
+    }
+
+    template<class A, class B>
+    inline detail::lazy_scalar_result<std::multiplies<>, A, B> operator*(const A& a, const B& b) {
+        return detail::make_binary<std::multiplies<>>(a, b);
+    }
+
+    template<class A, class B>
+    inline detail::lazy_scalar_result<std::divides<>, A, B> operator/(const A& a, const B& b) {
+        return detail::make_binary<std::divides<>>(a, b);
+    }
+
+    // Product and quotient of two matrices are entrywise_mul and entrywise_divl, as * is not element-wise for matrices
+    template<class A, class B>
+    inline detail::lazy_result<std::multiplies<>, A, B> entrywise_mul(const A& a, const B& b) {
+        return detail::make_binary<std::multiplies<>>(a, b);
+    }
+
+    template<class A, class B>
+    inline detail::lazy_result<std::divides<>, A, B> entrywise_divl(const A& a, const B& b) {
+        return detail::make_binary<std::divides<>>(a, b);
+    }
 
+    // Writes e to dst, which must have the same dimensions
+    template<class T, class E>
+    inline void assign(matrix_ref<T>& dst, const matrix_expr<E>& e, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(dst.dimensions() == e.dimensions());
+
+        detail::parallel_rows(dst.height(), dst.width(), [&](int first, int last) {
+            detail::eval_rows(dst, e.node(), first, last);
+        }, tp);
+    }
+
+    template<class T, class E>
+    inline matrix_ref<T>& operator+=(matrix_ref<T>& a, const matrix_expr<E>& b) {
+        assign(a, lazy(a) + b);
+        return a;
+    }
+
+    template<class T, class E>
+    inline matrix_ref<T>& operator-=(matrix_ref<T>& a, const matrix_expr<E>& b) {
+        assign(a, lazy(a) - b);
         return a;
     }
 
     template<class T1, class T2>
-    inline matrix<decltype(T1() - T2())> operator-(const matrix_ref<T1>& a, const matrix_ref<T2>& b) {
-        assert(a.dimensions() == b.dimensions());
+    inline matrix_ref<T1>& operator+=(matrix_ref<T1>& a, const matrix_ref<T2>& b) {
+        return a += lazy(b);
+    }
 
-        matrix<decltype(T1() - T2())> r(a.dimensions());
+    template<class T1, class T2>
+    inline matrix<decltype(T1() + T2())> operator+(const matrix_ref<T1>& a, const matrix_ref<T2>& b) {
+        return lazy(a) + b;
+    }
 
-        for (int i = 0; i < a.height(); i++) {
-            for (int j = 0; j < a.width(); j++) {
-                r[i][j] = a[i][j] - b[i][j];
-            }
-        }
+    template<class T1, class T2>
+    inline matrix_ref<T1>& operator-=(matrix<T1>& a, const matrix<T2>& b) {
+        return a -= lazy(b);
+    }
 
-        return r;
+    template<class T1, class T2>
+    inline matrix<decltype(T1() - T2())> operator-(const matrix_ref<T1>& a, const matrix_ref<T2>& b) {
+        return lazy(a) - b;
     }
 
     template<class T1, class T2>
     inline matrix<decltype(T1() * T2())> entrywise_mul(const matrix_ref<T1>& a, const matrix_ref<T2>& b) {
-        assert(a.dimensions() == b.dimensions());
+        return entrywise_mul(lazy(a), b);
+    }
+
+    template<class T1, class T2>
+    inline matrix<decltype(T1() / T2())> entrywise_divl(const matrix_ref<T1>& a, const matrix_ref<T2>& b) {
+        return entrywise_divl(lazy(a), b);
+    }
+
+    template<class T1, class T2, class T3>
+    inline c4::matrix<decltype(T1() * T2() + T3())> entrywise_madd(const c4::matrix_ref<T1>& img, T2 alpha, T3 beta) {
+        return lazy(img) * alpha + beta;
+    }
 
-        matrix<decltype(T1() * T2())> r(a.dimensions());
+    namespace detail {
+#ifdef __C4_SIMD__
+        // Transposes n x n lanes in log2(n) rounds of interleaving row i with row i + n / 2
+        template<class V, int n>
+        inline void transpose_registers(V (&r)[n]) {
+            for (int round = 1; round < n; round *= 2) {
+                V t[n];
+
+                for (int i = 0; i < n / 2; i++) {
+                    const simd::tuple<V, 2> z = simd::interleave(simd::tuple<V, 2>{ { r[i], r[i + n / 2] } });
+                    t[2 * i] = z.val[0];
+                    t[2 * i + 1] = z.val[1];
+                }
 
-        for (int i = 0; i < a.height(); i++) {
-            for (int j = 0; j < a.width(); j++) {
-                r[i][j] = a[i][j] * b[i][j];
+                std::copy(t, t + n, r);
             }
         }
+#endif
 
-        return r;
-    }
+        template<class T>
+        using transpose_lane = typename std::conditional<sizeof(T) == 1, uint8_t,
+            typename std::conditional<sizeof(T) == 2, uint16_t,
+            typename std::conditional<sizeof(T) == 4, uint32_t, void>::type>::type>::type;
+
+        // Writes src[r][c] to dst[reverse_rows ? w - 1 - c : c][reverse_cols ? h - 1 - r : r].
+        // The matrix goes in blocks that fit in L1, each of which goes in register tiles of 16 bytes square
+        // when T is 1, 2 or 4 bytes, so both src and dst are read and written a row at a time.
+        template<bool reverse_rows, bool reverse_cols, class T>
+        inline void transpose_rows(const matrix_ref<T>& src, matrix_ref<T>& dst, int first, int last) {
+            constexpr int block = 64;
+
+            const int h = src.height();
+            const int w = src.width();
+
+            auto dst_row = [&](int c) { return reverse_rows ? w - 1 - c : c; };
+            auto dst_col = [&](int r) { return reverse_cols ? h - 1 - r : r; };
+
+            for (int r0 = first; r0 < last; r0 += block) {
+                const int r1 = std::min(r0 + block, last);
+
+                for (int c0 = 0; c0 < w; c0 += block) {
+                    const int c1 = std::min(c0 + block, w);
+
+                    int r = r0;
+#ifdef __C4_SIMD__
+                    typedef transpose_lane<T> lane_t;
+
+                    if constexpr (!std::is_void<lane_t>::value && std::is_trivially_copyable<T>::value) {
+                        constexpr int n = 16 / sizeof(T);
+                        typedef decltype(simd::load((const lane_t*)nullptr)) V;
+
+                        for (; r + n <= r1; r += n) {
+                            int c = c0;
+                            for (; c + n <= c1; c += n) {
+                                V v[n];
+                                for (int k = 0; k < n; k++)
+                                    v[k] = simd::load((const lane_t*)(src[reverse_cols ? r + n - 1 - k : r + k].data() + c));
+
+                                transpose_registers(v);
+
+                                for (int k = 0; k < n; k++)
+                                    simd::store((lane_t*)(dst[dst_row(c + k)].data() + (reverse_cols ? h - r - n : r)), v[k]);
+                            }
+
+                            for (; c < c1; c++)
+                                for (int k = r; k < r + n; k++)
+                                    dst[dst_row(c)][dst_col(k)] = src[k][c];
+                        }
+                    }
+#endif
+                    for (; r < r1; r++)
+                        for (int c = c0; c < c1; c++)
+                            dst[dst_row(c)][dst_col(r)] = src[r][c];
+                }
+            }
+        }
 
-    template<class T1, class T2>
-    inline matrix<decltype(T1() / T2())> entrywise_divl(const matrix_ref<T1>& a, const matrix_ref<T2>& b) {
-        assert(a.dimensions() == b.dimensions());
+        template<bool reverse_rows, bool reverse_cols, class T>
+        inline void transpose(const matrix_ref<T>& src, matrix_ref<T>& dst, thread_pool& tp) {
+            assert(dst.height() == src.width() && dst.width() == src.height());
+            assert(src.data() != dst.data());
 
-        matrix<decltype(T1() / T2())> r(a.dimensions());
+            constexpr int band = 64;
 
-        for (int i = 0; i < a.height(); i++) {
-            for (int j = 0; j < a.width(); j++) {
-                r[i][j] = a[i][j] / b[i][j];
-            }
+            parallel_rows((src.height() + band - 1) / band, band * src.width(), [&](int first, int last) {
+                transpose_rows<reverse_rows, reverse_cols>(src, dst, first * band, std::min(last * band, src.height()));
+            }, tp);
         }
+    };
 
-        return r;
+    // The out-of-place versions below take dst of the resulting dimensions, which must not overlap src,
+    // and run over bands of rows in parallel on tp for large images.
+    template<typename T>
+    inline void transpose(const matrix_ref<T>& src, matrix_ref<T>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        detail::transpose<false, false>(src, dst, tp);
     }
 
+    template<typename T>
+    inline void rotate90cw(const matrix_ref<T>& src, matrix_ref<T>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        detail::transpose<false, true>(src, dst, tp);
+    }
 
-    template<class T1, class T2, class T3>
-    inline c4::matrix<decltype(T1() * T2() + T3())> entrywise_madd(const c4::matrix_ref<T1>& img, T2 alpha, T3 beta) {
-        c4::matrix<decltype(T1() * T2() + T3())> res(img.height(), img.width());
+    template<typename T>
+    inline void rotate270cw(const matrix_ref<T>& src, matrix_ref<T>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        detail::transpose<true, false>(src, dst, tp);
+    }
 
-        for (int i = 0; i < img.height(); i++) {
-            for (int j = 0; j < img.width(); j++) {
-                res[i][j] = img[i][j] * alpha + beta;
-            }
-        }
+    template<typename T>
+    inline void rotate180(const matrix_ref<T>& src, matrix_ref<T>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(src.dimensions() == dst.dimensions());
 
-        return res;
+        detail::parallel_rows(src.height(), src.width(), [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                std::reverse_copy(src[i].begin(), src[i].end(), dst[src.height() - 1 - i].begin());
+        }, tp);
     }
 
     template<typename T>
-    inline void rotate90cw(matrix<T>& mat) {
-        matrix<T> src = mat;
+    inline void flip_horizontal(const matrix_ref<T>& src, matrix_ref<T>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(src.dimensions() == dst.dimensions());
 
-        mat.resize(src.width(), src.height());
+        detail::parallel_rows(src.height(), src.width(), [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                std::reverse_copy(src[i].begin(), src[i].end(), dst[i].begin());
+        }, tp);
+    }
 
-        for (int i = 0; i < mat.height(); i++) {
-            for (int j = 0; j < mat.width(); j++) {
-                mat[i][j] = src[src.height() - j - 1][i];
-            }
-        }
+    template<typename T>
+    inline void flip_vertical(const matrix_ref<T>& src, matrix_ref<T>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(src.dimensions() == dst.dimensions());
+
+        detail::parallel_rows(src.height(), src.width(), [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                std::copy(src[i].begin(), src[i].end(), dst[src.height() - 1 - i].begin());
+        }, tp);
     }
 
     template<typename T>
-    inline void rotate180(matrix<T>& mat) {
-        for (int i = 0; i < mat.height() / 2; i++) {
-            for (int j = 0; j < mat.width(); j++) {
-                std::swap(mat[i][j], mat[mat.height() - i - 1][mat.width() - j - 1]);
-            }
-        }
+    inline matrix<T> transpose(const matrix_ref<T>& src) {
+        matrix<T> dst;
+        dst.resize_for_overwrite(src.width(), src.height());
+        transpose(src, dst);
+        return dst;
+    }
 
-        if (mat.height() % 2) {
-            for (int j = 0; j < mat.width() / 2; j++) {
-                std::swap(mat[mat.height() / 2][j], mat[mat.height() / 2][mat.width() - j - 1]);
-            }
+    template<typename T>
+    inline void rotate90cw(matrix<T>& mat) {
+        // Take the buffer instead of copying it, then rebuild mat with the same pool and padding
+        const matrix<T> src = std::move(mat);
+        mat = src.is_padded() ? matrix<T>(src.width(), src.height(), matrix_padding{src.border()}, src.pool()) : matrix<T>(src.width(), src.height(), src.pool());
+
+        rotate90cw(src, mat);
+    }
+
+    template<typename T>
+    inline void rotate180(matrix_ref<T>& mat) {
+        const int h = mat.height();
+
+        for (int i = 0; i < h / 2; i++) {
+            std::reverse(mat[i].begin(), mat[i].end());
+            std::reverse(mat[h - i - 1].begin(), mat[h - i - 1].end());
+            std::swap_ranges(mat[i].begin(), mat[i].end(), mat[h - i - 1].begin());
         }
+
+        if (h % 2)
+            std::reverse(mat[h / 2].begin(), mat[h / 2].end());
     }
 
     template<typename T>
     inline void rotate270cw(matrix<T>& mat) {
-        matrix<T> src = mat;
+        // Take the buffer instead of copying it, then rebuild mat with the same pool and padding
+        const matrix<T> src = std::move(mat);
+        mat = src.is_padded() ? matrix<T>(src.width(), src.height(), matrix_padding{src.border()}, src.pool()) : matrix<T>(src.width(), src.height(), src.pool());
 
-        mat.resize(src.width(), src.height());
+        rotate270cw(src, mat);
+    }
 
-        for (int i = 0; i < mat.height(); i++) {
-            for (int j = 0; j < mat.width(); j++) {
-                mat[i][j] = src[j][src.width() - i - 1];
-            }
-        }
+    template<typename T>
+    inline void flip_horizontal(matrix_ref<T>& mat) {
+        for (int i = 0; i < mat.height(); i++)
+            std::reverse(mat[i].begin(), mat[i].end());
     }
 
     template<typename T>
     inline void flip_vertical(matrix_ref<T>& mat) {
-        for (int i = 0; i < mat.height() / 2; i++) {
-            for (int j = 0; j < mat.width(); j++) {
-                std::swap(mat[i][j], mat[mat.height() - i - 1][j]);
+        for (int i = 0; i < mat.height() / 2; i++)
+            std::swap_ranges(mat[i].begin(), mat[i].end(), mat[mat.height() - i - 1].begin());
+    }
+
+    namespace detail {
+#ifdef __C4_SIMD__
+        // The simd register that simd::load() fills from T elements
+        template<class T, class = void>
+        struct simd_register {};
+
+        template<class T>
+        struct simd_register<T, std::void_t<decltype(simd::load(std::declval<const T*>()))>> {
+            typedef decltype(simd::load(std::declval<const T*>())) type;
+        };
+
+        // F maps registers of T1 to registers of T2 with the same number of lanes, like [](simd::uint8x16 x) { ... }
+        template<class T1, class T2, class F, class = void>
+        struct is_simd_kernel : std::false_type {};
+
+        template<class T1, class T2, class F>
+        struct is_simd_kernel<T1, T2, F, std::void_t<typename simd_register<T1>::type, typename simd_register<T2>::type>>
+            : std::bool_constant<sizeof(T1) == sizeof(T2) && !std::is_invocable_v<F&, const T1&>
+                && std::is_invocable_r_v<typename simd_register<T2>::type, F&, typename simd_register<T1>::type>> {};
+
+        template<class T, class F, class = void>
+        struct transform_result {
+            typedef std::invoke_result_t<F, T> type;
+        };
+
+        template<class T, class F>
+        struct transform_result<T, F, typename std::enable_if<!std::is_invocable_v<F, T>, std::void_t<typename simd_register<T>::type>>::type> {
+            typedef typename std::decay_t<std::invoke_result_t<F, typename simd_register<T>::type>>::base_t type;
+        };
+#else
+        template<class T1, class T2, class F>
+        struct is_simd_kernel : std::false_type {};
+
+        template<class T, class F>
+        struct transform_result {
+            typedef std::invoke_result_t<F, T> type;
+        };
+#endif
+
+        template<class T1, class T2, class F>
+        inline void transform_row(const T1* src, F& f, T2* dst, int n) {
+#ifdef __C4_SIMD__
+            if constexpr (is_simd_kernel<T1, T2, F>::value) {
+                constexpr int lanes = 16 / sizeof(T1);
+
+                int j = 0;
+                for (; j + lanes <= n; j += lanes)
+                    simd::store(dst + j, f(simd::load(src + j)));
+
+                // the tail goes through the kernel on a zero-padded copy
+                if (j < n) {
+                    T1 a[lanes] = {};
+                    T2 b[lanes];
+
+                    std::copy(src + j, src + n, a);
+                    simd::store(b, f(simd::load(a)));
+                    std::copy(b, b + n - j, dst + j);
+                }
+            }
+            else
+#endif
+            {
+                for (int j = 0; j < n; j++)
+                    dst[j] = f(src[j]);
             }
         }
-    }
+    };
 
+    // f is either applied to every element, or, if it takes simd registers instead, like
+    //     transform(src, [](simd::uint8x16 x) { return simd::max(x, t); }, dst);
+    // to 16 bytes of src at a time, the part of a row that doesn't fill a register is zero-padded.
     template<class T1, class T2, class F>
     inline void transform(const vector_ref<T1>& src, F f, vector_ref<T2>& dst) {
         assert(src.size() == dst.size());
 
-        for (int i : range(src.size()))
-            dst[i] = f(src[i]);
+        detail::transform_row(src.data(), f, dst.data(), src.size());
     }
 
     template<class T1, class T2, class F>
@@ -627,10 +1245,21 @@ namespace c4 {
 
     template<class T1, class T2, class F>
     inline void transform(const matrix_ref<T1>& src, F f, matrix_ref<T2>& dst) {
-        assert(src.height() == dst.height());
+        assert(src.dimensions() == dst.dimensions());
 
         for (int i : range(src.height()))
-            transform(src[i], f, dst[i]);
+            detail::transform_row(src[i].data(), f, dst[i].data(), src.width());
+    }
+
+    // Same as transform(), but bands of rows run in parallel on tp when the matrix is large enough
+    template<class T1, class T2, class F>
+    inline void parallel_transform(const matrix_ref<T1>& src, F f, matrix_ref<T2>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(src.dimensions() == dst.dimensions());
+
+        detail::parallel_rows(src.height(), src.width(), [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                detail::transform_row(src[i].data(), f, dst[i].data(), src.width());
+        }, tp);
     }
 
     template<class T1, class T2, class F>
@@ -639,8 +1268,9 @@ namespace c4 {
     }
 
     template<class T, class F>
-    inline auto transform(const matrix_ref<T>& src, F f) -> matrix<typename std::invoke_result_t<F, T>> {
-        matrix<typename std::invoke_result_t<F, T>> dst(src.dimensions());
+    inline auto transform(const matrix_ref<T>& src, F f) -> matrix<typename detail::transform_result<T, F>::type> {
+        matrix<typename detail::transform_result<T, F>::type> dst;
+        dst.resize_for_overwrite(src.dimensions());
 
         transform(src, f, dst);
 
@@ -678,4 +1308,44 @@ namespace c4 {
 
         return dst;
     }
+
+    // Calls f(row, width) with a pointer to every row, so that kernels work on contiguous memory
+    template<class T, class F>
+    inline void for_each_row(matrix_ref<T>& m, F f) {
+        for (int i = 0; i < m.height(); i++)
+            f(m[i].data(), m.width());
+    }
+
+    template<class T, class F>
+    inline void for_each_row(const matrix_ref<T>& m, F f) {
+        for (int i = 0; i < m.height(); i++)
+            f(m[i].data(), m.width());
+    }
+
+    template<class T, class F>
+    inline void parallel_for_each_row(matrix_ref<T>& m, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        detail::parallel_rows(m.height(), m.width(), [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                f(m[i].data(), m.width());
+        }, tp);
+    }
+
+    // Calls f(src_row, dst_row, width) for every pair of rows
+    template<class T1, class T2, class F>
+    inline void transform_rows(const matrix_ref<T1>& src, F f, matrix_ref<T2>& dst) {
+        assert(src.dimensions() == dst.dimensions());
+
+        for (int i = 0; i < src.height(); i++)
+            f(src[i].data(), dst[i].data(), src.width());
+    }
+
+    template<class T1, class T2, class F>
+    inline void parallel_transform_rows(const matrix_ref<T1>& src, F f, matrix_ref<T2>& dst, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(src.dimensions() == dst.dimensions());
+
+        detail::parallel_rows(src.height(), src.width(), [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                f(src[i].data(), dst[i].data(), src.width());
+        }, tp);
+    }
 };
@@ -53,10 +53,10 @@ namespace c4 {
             return sum;
         }
 
-        matrix<float> predict_multi(const matrix_ref<uint8_t>& img, int row_step) const {
+        matrix<float> predict_multi(const matrix_ref<uint8_t>& img, int row_step, buffer_pool* pool = nullptr) const {
             ASSERT_TRUE(img.height() >= weights.height() && img.width() >= weights.width());
 
-            matrix<float> sum((img.height() - weights.height()) / row_step + 1, img.width() - weights.width() + 1);
+            matrix<float> sum((img.height() - weights.height()) / row_step + 1, img.width() - weights.width() + 1, pool);
 
             const int n = sum.width();
 
@@ -85,27 +85,34 @@ namespace c4 {
             return f;
         }
 
+        // Rows are summed in a fixed order, so the result doesn't depend on the number of threads.
+        // Every chunk of rows keeps a vector of n partial sums until it is combined, hence the few rows per chunk.
         void predict(const matrix<std::vector<uint8_t>>& rx, std::vector<double>& f) const {
-            enumerable_thread_specific<std::vector<double>> f_ts(std::vector<double>(rx[0][0].size()));
+            const size_t n = rx[0][0].size();
+            const int rows_per_chunk = 4;
 
-            parallel_for(range(weights.height()), [&](int i) {
-                auto& f = f_ts.local();
-                for (int j : range(weights.width())) {
-                    const auto& w = weights[i][j];
-                    const auto& rxv = rx[i][j];
+            auto add = [](std::vector<double>&& a, const std::vector<double>& b) {
+                for (size_t k = 0; k < a.size(); k++) {
+                    a[k] += b[k];
+                }
+                return std::move(a);
+            };
+
+            f = parallel_deterministic_reduce(range(weights.height()), rows_per_chunk, std::vector<double>(n), add, [&](range rows) {
+                std::vector<double> fr(n);
 
-                    for (int k : range(rxv)) {
-                        f[k] += w[rxv[k]];
+                for (int i : rows) {
+                    for (int j : range(weights.width())) {
+                        const auto& w = weights[i][j];
+                        const auto& rxv = rx[i][j];
+
+                        for (int k : range(rxv)) {
+                            fr[k] += w[rxv[k]];
+                        }
                     }
                 }
-            });
 
-            parallel_for(range(f), [&](int k) {
-                double s = 0.;
-                for (const auto& fi : f_ts) {
-                    s += fi[k];
-                }
-                f[k] = s;
+                return fr;
             });
         }
 
@@ -115,7 +122,8 @@ namespace c4 {
             return f;
         }
 
-        void train(const matrix<std::vector<uint8_t>>& rx, const std::vector<float>& y, const matrix<std::vector<uint8_t>>& test_rx, const std::vector<float>& test_y, const int itc) {
+        // Stops after the current iteration if ct gets cancelled, keeping the weights trained so far
+        void train(const matrix<std::vector<uint8_t>>& rx, const std::vector<float>& y, const matrix<std::vector<uint8_t>>& test_rx, const std::vector<float>& test_y, const int itc, const cancellation_token& ct = cancellation_token::none()) {
             c4::scoped_timer t("matrix_regression::train");
 
             if (weights.height() == 0) {
@@ -161,7 +169,7 @@ namespace c4 {
 
             progress_indicator progress(itc, "matrix_regression::train");
 
-            for (int it = 1; it <= itc; it++) {
+            for (int it = 1; it <= itc && !ct.cancelled(); it++) {
                 parallel_for(range(weights.height()), [&](int i) {
                     for (int j : range(weights.width())) {
                         std::vector<double> sf(dim, 0.);
@@ -23,6 +23,7 @@
 #pragma once
 
 #include "simd.hpp"
+#include "simd_avx2.hpp"
 #include "pixel.hpp"
 #include "range.hpp"
 #include "matrix.hpp"
@@ -37,6 +38,59 @@
 
 namespace c4 {
 	namespace motion_detail {
+#ifdef __C4_AVX2__
+		namespace avx2 {
+			// 32 pixels per register, a 48 wide block does its last 16 with the 128-bit registers
+			template<int dim>
+			C4_TARGET_AVX2 uint32_t inline accumulate(const matrix_ref<uint8_t>& src) {
+				const simd::avx2::uint8x32 zero = simd::avx2::set_zero<simd::avx2::uint8x32>();
+
+				simd::avx2::uint32x8 sum = simd::avx2::set_zero<simd::avx2::uint32x8>();
+				simd::uint32x4 tail = simd::set_zero<simd::uint32x4>();
+
+				for (int i = 0; i < dim; i++) {
+					const uint8_t* p = src[i].data();
+
+					for (int j = 0; j + 32 <= dim; j += 32)
+						sum = simd::avx2::add(sum, simd::avx2::sad(simd::avx2::load(p + j), zero));
+
+					if constexpr (dim % 32 != 0)
+						tail = simd::add(tail, simd::sad(simd::load(p + dim - 16), simd::set_zero<simd::uint8x16>()));
+				}
+
+				return simd::avx2::sum0246(sum) + simd::sum02(tail);
+			}
+
+			template<int dim>
+			C4_TARGET_AVX2 uint32_t inline calc_diff(const matrix_ref<uint8_t>& A, const matrix_ref<uint8_t>& B, const uint8_t da, const uint8_t db) {
+				const simd::avx2::uint8x32 dav(da);
+				const simd::avx2::uint8x32 dbv(db);
+
+				simd::avx2::uint32x8 sum = simd::avx2::set_zero<simd::avx2::uint32x8>();
+				simd::uint32x4 tail = simd::set_zero<simd::uint32x4>();
+
+				for (int i = 0; i < dim; i++) {
+					const uint8_t* pa = A[i].data();
+					const uint8_t* pb = B[i].data();
+
+					for (int j = 0; j + 32 <= dim; j += 32) {
+						simd::avx2::uint8x32 a = simd::avx2::add_saturate(simd::avx2::load(pa + j), dav);
+						simd::avx2::uint8x32 b = simd::avx2::add_saturate(simd::avx2::load(pb + j), dbv);
+						sum = simd::avx2::add(sum, simd::avx2::sad(a, b));
+					}
+
+					if constexpr (dim % 32 != 0) {
+						simd::uint8x16 a = simd::add_saturate(simd::load(pa + dim - 16), simd::avx2::get_low(dav));
+						simd::uint8x16 b = simd::add_saturate(simd::load(pb + dim - 16), simd::avx2::get_low(dbv));
+						tail = simd::add(tail, simd::sad(a, b));
+					}
+				}
+
+				return simd::avx2::sum0246(sum) + simd::sum02(tail);
+			}
+		};
+#endif
+
 		template<int dim>
 		uint32_t inline accumulate(const matrix_ref<uint8_t>& src) = delete;
 
@@ -60,6 +114,11 @@ namespace c4 {
 			assert(src.width() == 32);
 			assert(src.height() == 32);
 
+#ifdef __C4_AVX2__
+			if (simd::avx2::is_supported())
+				return avx2::accumulate<32>(src);
+#endif
+
 			simd::uint32x4 sum = simd::set_zero<simd::uint32x4>();
 
 			for (int i = 0; i < 32; i++) {
@@ -77,6 +136,11 @@ namespace c4 {
 			assert(src.width() == 48);
 			assert(src.height() == 48);
 
+#ifdef __C4_AVX2__
+			if (simd::avx2::is_supported())
+				return avx2::accumulate<48>(src);
+#endif
+
 			simd::uint32x4 sum = simd::set_zero<simd::uint32x4>();
 
 			for (int i = 0; i < 48; i++) {
@@ -96,6 +160,11 @@ namespace c4 {
 			assert(src.width() == 64);
 			assert(src.height() == 64);
 
+#ifdef __C4_AVX2__
+			if (simd::avx2::is_supported())
+				return avx2::accumulate<64>(src);
+#endif
+
 			simd::uint32x4 sum = simd::set_zero<simd::uint32x4>();
 
 			for (int i = 0; i < 64; i++) {
@@ -140,6 +209,11 @@ namespace c4 {
 		uint32_t inline calc_diff<32>(const matrix_ref<uint8_t>& A, const matrix_ref<uint8_t>& B, const uint8_t da, const uint8_t db) {
 			assert(A.width() == 32);
 
+#ifdef __C4_AVX2__
+			if (simd::avx2::is_supported())
+				return avx2::calc_diff<32>(A, B, da, db);
+#endif
+
 			const simd::uint8x16 dav(da);
 			const simd::uint8x16 dbv(db);
 
@@ -165,6 +239,11 @@ namespace c4 {
 		uint32_t inline calc_diff<48>(const matrix_ref<uint8_t>& A, const matrix_ref<uint8_t>& B, const uint8_t da, const uint8_t db) {
 			assert(A.width() == 48);
 
+#ifdef __C4_AVX2__
+			if (simd::avx2::is_supported())
+				return avx2::calc_diff<48>(A, B, da, db);
+#endif
+
 			const simd::uint8x16 dav(da);
 			const simd::uint8x16 dbv(db);
 
@@ -195,6 +274,11 @@ namespace c4 {
 		uint32_t inline calc_diff<64>(const matrix_ref<uint8_t>& A, const matrix_ref<uint8_t>& B, const uint8_t da, const uint8_t db) {
 			assert(A.width() == 64);
 
+#ifdef __C4_AVX2__
+			if (simd::avx2::is_supported())
+				return avx2::calc_diff<64>(A, B, da, db);
+#endif
+
 			const simd::uint8x16 dav(da);
 			const simd::uint8x16 dbv(db);
 
@@ -235,6 +319,9 @@ namespace c4 {
 		}
 
 		struct Motion {
+			// Rows per task in apply() and apply_nn()
+			static constexpr int band_height = 8;
+
 			point<double> shift;
 			double scale = 1.0;
 			double alpha = 0.0;
@@ -261,7 +348,8 @@ namespace c4 {
 				const point<float> C = center(src);
 				const point<float> Cps = C + point<float>(shift);
 
-				parallel_for(range(src.height()), [&src, &dst, C, css, sns, Cps](int y){
+				// Full-width bands: every row is stepped from column 0, so the pixels don't depend on the split
+				parallel_for_2d(dst, band_height, dst.width(), [&src, &dst, C, css, sns, Cps](range2d tile){
 					// Optimized code is much harder to understand, so we keep the original commented out
 					//for (int x : c4::range(src.width())) {
 					//	c4::point<float> p = c4::point<float>(x, y) - C;
@@ -270,18 +358,21 @@ namespace c4 {
 
 					//	dst[y][x] = src.get_interpolate(t);
 					//}
-					const float py = (float)y - C.y;
+					const float px = -C.x;
 
-					const c4::point<float> prs(-css * C.x - sns * py, -sns * C.x + css * py);
-					c4::point<float> t = prs + Cps;
+					for (int y : tile.rows) {
+						const float py = (float)y - C.y;
 
-					T* pdst = dst[y].data();
-					const int width = src.width();
-					for (int x = 0; x < width; x++) {
-						pdst[x] = src.get_interpolate(t);
+						const c4::point<float> prs(css * px - sns * py, sns * px + css * py);
+						c4::point<float> t = prs + Cps;
 
-						t.x += css;
-						t.y += sns;
+						T* pdst = dst[y].data();
+						for (int x = 0; x < dst.width(); x++) {
+							pdst[x] = src.get_interpolate(t);
+
+							t.x += css;
+							t.y += sns;
+						}
 					}
 				});
 			}
@@ -298,7 +389,8 @@ namespace c4 {
 				const point<float> C = center(src);
 				const point<float> Cps = C + point<float>(shift);
 
-				parallel_for(range(src.height()), [&src, &dst, C, css, sns, Cps](int y){
+				// Full-width bands: every row is stepped from column 0, so the pixels don't depend on the split
+				parallel_for_2d(dst, band_height, dst.width(), [&src, &dst, C, css, sns, Cps](range2d tile){
 					// Optimized code is much harder to understand, so we keep the original commented out
 					//for (int x : c4::range(src.width())) {
 					//	c4::point<float> p = c4::point<float>(x, y) - C;
@@ -307,18 +399,21 @@ namespace c4 {
 
 					//	dst[y][x] = src.clamp_get(t);
 					//}
-					const float py = (float)y - C.y;
+					const float px = -C.x;
 
-					const c4::point<float> prs(-css * C.x - sns * py, -sns * C.x + css * py);
-					c4::point<float> t = prs + Cps;
+					for (int y : tile.rows) {
+						const float py = (float)y - C.y;
 
-					T* pdst = dst[y].data();
-					const int width = src.width();
-					for (int x = 0; x < width; x++) {
-						pdst[x] = src.clamp_get(t);
+						const c4::point<float> prs(css * px - sns * py, sns * px + css * py);
+						c4::point<float> t = prs + Cps;
 
-						t.x += css;
-						t.y += sns;
+						T* pdst = dst[y].data();
+						for (int x = 0; x < dst.width(); x++) {
+							pdst[x] = src.clamp_get(t);
+
+							t.x += css;
+							t.y += sns;
+						}
 					}
 				});
 			}
@@ -371,18 +466,20 @@ namespace c4 {
 		MotionDetector() {
 		}
 		
-		static Motion detect(const matrix_ref<uint8_t>& prev, const matrix_ref<uint8_t>& frame, const Params& params, const std::vector<rectangle<int>> ignore = {}) {
+		// Throws operation_cancelled if ct gets cancelled while the blocks are being matched.
+		// Scratch matrices come from pool if one is given.
+		static Motion detect(const matrix_ref<uint8_t>& prev, const matrix_ref<uint8_t>& frame, const Params& params, const std::vector<rectangle<int>> ignore = {}, const cancellation_token& ct = cancellation_token::none(), buffer_pool* pool = nullptr) {
 			STATIC_SCOPED_TIMER("MotionDetector::detect");
 
 			ASSERT_EQUAL(prev.height(), frame.height());
 			ASSERT_EQUAL(prev.width(), frame.width());
 
-			matrix<point<int>> shifts;
-			matrix<double> weights;
+			matrix<point<int>> shifts(pool);
+			matrix<double> weights(pool);
 
-			detect_local(prev, frame, shifts, weights, params.blockSize, params.maxShift);
+			detect_local(prev, frame, shifts, weights, params.blockSize, params.maxShift, ct);
 
-			matrix<point<double>> src(shifts.dimensions());
+			matrix<point<double>> src(shifts.dimensions(), pool);
 
 			for (int i : range(shifts.height())) {
 				for (int j : range(shifts.width())) {
@@ -412,10 +509,10 @@ namespace c4 {
 				dump_image(image4dump, "local");
 			}
 
-			return motion_from_local_mat(frame, src, shifts, weights, params);
+			return motion_from_local_mat(frame, src, shifts, weights, params, pool);
 		}
 
-		static Motion motion_from_local_mat(const matrix_ref<uint8_t>& frame, const matrix<point<double>>& src, const matrix<point<int>>& shifts, const matrix<double>& weights, const Params& params) {
+		static Motion motion_from_local_mat(const matrix_ref<uint8_t>& frame, const matrix<point<double>>& src, const matrix<point<int>>& shifts, const matrix<double>& weights, const Params& params, buffer_pool* pool = nullptr) {
 			point<double> sumShift(0, 0);
 			double sumWeight = 0;
 
@@ -435,7 +532,7 @@ namespace c4 {
 
 			const point<double> rshift = sumShift * (1. / sumWeight);
 
-			matrix<point<double>> dst(shifts.dimensions());
+			matrix<point<double>> dst(shifts.dimensions(), pool);
 			transform(src, shifts, [rshift](const point<double>& s, const point<int>& shift) { return s + point<double>(shift) - rshift; }, dst);
 
 			const point<double> C = center(frame);
@@ -492,23 +589,23 @@ namespace c4 {
 			return { rshift, rscale, alpha, confidence };
 		}
 
-		static void detect_local(const matrix_ref<uint8_t>& prev, const matrix_ref<uint8_t>& frame, matrix<point<int>>& shifts, matrix<double>& weights, int blockSize, int maxShift) {
+		static void detect_local(const matrix_ref<uint8_t>& prev, const matrix_ref<uint8_t>& frame, matrix<point<int>>& shifts, matrix<double>& weights, int blockSize, int maxShift, const cancellation_token& ct = cancellation_token::none()) {
 			switch (blockSize) {
 			case 16:
-				return detect_local_impl<16>(prev, frame, shifts, weights, maxShift);
+				return detect_local_impl<16>(prev, frame, shifts, weights, maxShift, ct);
 			case 32:
-				return detect_local_impl<32>(prev, frame, shifts, weights, maxShift);
+				return detect_local_impl<32>(prev, frame, shifts, weights, maxShift, ct);
 			case 48:
-				return detect_local_impl<48>(prev, frame, shifts, weights, maxShift);
+				return detect_local_impl<48>(prev, frame, shifts, weights, maxShift, ct);
 			case 64:
-				return detect_local_impl<64>(prev, frame, shifts, weights, maxShift);
+				return detect_local_impl<64>(prev, frame, shifts, weights, maxShift, ct);
 			default:
 				INVALID_VALUE(blockSize);
 			}
 		}
 		
 		template<int block>
-		static void detect_local_impl(const matrix_ref<uint8_t>& prev, const matrix_ref<uint8_t>& frame, matrix<point<int>>& shifts, matrix<double>& weights, const int maxShift) {
+		static void detect_local_impl(const matrix_ref<uint8_t>& prev, const matrix_ref<uint8_t>& frame, matrix<point<int>>& shifts, matrix<double>& weights, const int maxShift, const cancellation_token& ct) {
 			using namespace motion_detail;
 			STATIC_SCOPED_TIMER("MotionDetector::detect_local_impl");
 
@@ -535,12 +632,9 @@ namespace c4 {
 
 			constexpr int block2 = block * block;
 
-			enumerable_thread_specific<matrix<int>> diffs_v;
-			for (auto& diffs : diffs_v){
-				diffs.resize(2 * maxShift + 1, 2 * maxShift + 1);
-			}
+			enumerable_thread_specific<matrix<int>> diffs_v(matrix<int>(2 * maxShift + 1, 2 * maxShift + 1));
 
-			parallel_for(range(shifts.height()), [maxShift, &diffs_v, &shifts, &prev, &frame, &weights](int i){
+			parallel_for(range(shifts.height()), 1, [maxShift, &diffs_v, &shifts, &prev, &frame, &weights](int i){
 				auto& diffs = diffs_v.local();
 
 				for (int j : range(shifts.width())) {
@@ -597,7 +691,7 @@ namespace c4 {
 					shifts[i][j] = shift;
 					weights[i][j] = w;
 				}
-			});
+			}, ct);
 		}
 
 	private:
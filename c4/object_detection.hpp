@@ -121,10 +121,11 @@ namespace c4 {
         window_detector() = default;
         window_detector(const matrix_regression<dim>& mr, float threshold) : mr(mr), threshold(threshold) {}
 
-        std::vector<detection> detect(const matrix_ref<uint8_t>& img) const {
-            c4::matrix<uint8_t> timg = TForm::transform(img);
+        // Scratch images come from pool if one is given, so detecting on frames of the same size doesn't allocate them again
+        std::vector<detection> detect(const matrix_ref<uint8_t>& img, buffer_pool* pool = nullptr) const {
+            c4::matrix<uint8_t> timg = TForm::transform(img, pool);
 
-            auto m = mr.predict_multi(timg, TForm::row_step);
+            auto m = mr.predict_multi(timg, TForm::row_step, pool);
 
             std::vector<detection> dets;
 
@@ -169,7 +170,8 @@ namespace c4 {
         scaling_detector() = default;
         scaling_detector(const window_detector<TForm, dim>& wd, float start_scale, float scale_step) : wd(wd), start_scale(start_scale), scale_step(scale_step) {}
 
-        std::vector<detection> detect(const matrix_ref<uint8_t>& img, std::vector<detection>& candidates) const {
+        // Throws operation_cancelled if ct gets cancelled, checked before every scale
+        std::vector<detection> detect(const matrix_ref<uint8_t>& img, std::vector<detection>& candidates, const cancellation_token& ct = cancellation_token::none(), buffer_pool* pool = nullptr) const {
             std::vector<detection> dets;
 
             float scale = start_scale;
@@ -177,7 +179,7 @@ namespace c4 {
             auto scaleWeight = [](float scale) { return 1.f / sqr(scale); };
 
             if (scale == 1.f) {
-                dets = wd.detect(img);
+                dets = wd.detect(img, pool);
                 for (auto& d : dets) {
                     d.conf *= scaleWeight(scale);
                 }
@@ -186,14 +188,16 @@ namespace c4 {
 
             const matrix_dimensions min_dims = wd.dimensions();
 
-            matrix<uint8_t> scaled;
+            matrix<uint8_t> scaled(pool);
 
             for (; int(img.height() * scale) >= min_dims.height && int(img.width() * scale) >= min_dims.width; scale *= scale_step) {
-                scaled.resize(int(img.height() * scale), int(img.width() * scale));
+                ct.throw_if_cancelled();
+
+                scaled.resize_for_overwrite(int(img.height() * scale), int(img.width() * scale));
 
                 scale_image_hq(img, scaled);
 
-                std::vector<detection> scale_dets = wd.detect(scaled);
+                std::vector<detection> scale_dets = wd.detect(scaled, pool);
 
                 for (detection& d : scale_dets) {
                     d.rect = d.rect.scale_around_origin(1.f / scale);
@@ -212,9 +216,9 @@ namespace c4 {
             return dets;
         }
 
-        std::vector<detection> detect(const matrix_ref<uint8_t>& img) const {
+        std::vector<detection> detect(const matrix_ref<uint8_t>& img, const cancellation_token& ct = cancellation_token::none(), buffer_pool* pool = nullptr) const {
             std::vector<detection> candidates;
-            return detect(img, candidates);
+            return detect(img, candidates, ct, pool);
         }
 
         float min_width() const {
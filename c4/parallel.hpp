@@ -23,19 +23,44 @@
 #pragma once
 
 #include <mutex>
+#include <atomic>
 #include <thread>
+#include <coroutine>
+#include <chrono>
 #include <future>
+#include <new>
+#include <memory>
 #include <cstdlib>
-#include <queue>
+#include <string>
+#include <fstream>
+#include <cassert>
+#include <cstddef>
+#include <exception>
 #include <array>
+#include <deque>
 #include <vector>
+#include <optional>
 #include <algorithm>
 #include <functional>
 #include <type_traits>
+#include <condition_variable>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
 
 #include "range.hpp"
 
 namespace c4 {
+    template<class T>
+    class matrix_ref;
+
     static uint32_t env_num_threads() {
         uint32_t threads = 0;
 #pragma warning(push)
@@ -52,260 +77,2006 @@ namespace c4 {
         return threads;
     }
 
-    class thread_pool {
-        struct PriorityFunction {
-			int priority;
-			int timestamp;
-			std::function<void()> f;
+    // Where thread_pool workers are pinned
+    enum class Affinity {
+        None,       // leave it to the OS
+        Compact,    // fill one NUMA node before moving on to the next
+        Scatter     // round-robin over NUMA nodes
+    };
 
-            PriorityFunction(std::function<void()>&& f, int priority) : f(f), priority(priority) {
-				static std::atomic<int> counter(0);
-				timestamp = counter++;
-            }
-			
-            bool operator<(const PriorityFunction& other) const {
-				return priority < other.priority || priority == other.priority && timestamp > other.timestamp;
-			}
-		};
+    namespace detail {
+        // "0-3,8,10-11" -> { 0, 1, 2, 3, 8, 10, 11 }
+        inline std::vector<int> parse_cpu_list(const char* s) {
+            std::vector<int> cpus;
 
-        std::mutex mu;
-        std::vector<std::thread> workers;
-        std::priority_queue<PriorityFunction> tasks;
-        std::condition_variable condition;
-        bool stop;
+            while (*s) {
+                char* end;
+                const int first = std::strtol(s, &end, 10);
+                if (end == s)
+                    break;
 
-    public:
-        thread_pool(unsigned int threads = env_num_threads()) : stop(false) {
-            for (unsigned int i = 0; i < threads; i++) {
-                workers.emplace_back([this] {
-                    for (;;) {
-                        std::function<void()> task;
-                        {
-                            std::unique_lock<std::mutex> lock(this->mu);
-                            condition.wait(lock, [this] { return stop || !tasks.empty(); });
-                            if (stop && tasks.empty())
-                                return;
-
-                            task = tasks.top().f;
-                            tasks.pop();
-                        }
+                int last = first;
+                s = end;
 
-                        task();
-                    }
-                });
+                if (*s == '-') {
+                    last = std::strtol(s + 1, &end, 10);
+                    s = end;
+                }
+
+                for (int cpu = first; cpu <= last; cpu++)
+                    cpus.push_back(cpu);
+
+                while (*s == ',' || *s == ' ')
+                    s++;
             }
+
+            return cpus;
         }
 
-        int get_num_threads() const {
-            return (int)workers.size();
+        // CPUs this process may run on, honouring the affinity mask and cgroup cpuset
+        inline std::vector<int> allowed_cpus() {
+            std::vector<int> cpus;
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                    if (CPU_ISSET(cpu, &set))
+                        cpus.push_back(cpu);
+            }
+#endif
+            if (cpus.empty()) {
+                for (int cpu = 0; cpu < (int)std::thread::hardware_concurrency(); cpu++)
+                    cpus.push_back(cpu);
+            }
+
+            return cpus;
         }
 
-        int get_thread_index() const {
-            std::thread::id caller_id = std::this_thread::get_id();
+        // NUMA node of every logical CPU, indexed by CPU; empty where the topology is unknown
+        inline std::vector<int> cpu_nodes() {
+            std::vector<int> nodes;
+#if defined(__linux__)
+            std::string online;
+            std::getline(std::ifstream("/sys/devices/system/node/online"), online);
+
+            for (int node : parse_cpu_list(online.c_str())) {
+                std::string cpulist;
+                std::getline(std::ifstream("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"), cpulist);
 
-            for (int i : range(workers))
-                if (workers[i].get_id() == caller_id)
-                    return i;
+                for (int cpu : parse_cpu_list(cpulist.c_str())) {
+                    if (cpu >= (int)nodes.size())
+                        nodes.resize(cpu + 1, 0);
 
-            return -1;
+                    nodes[cpu] = node;
+                }
+            }
+#endif
+            return nodes;
         }
 
-        template<class F>
-        auto enqueue(F&& f, int priority = 0) -> std::future<typename std::invoke_result_t<F>> {
-            using return_type = typename std::invoke_result_t<F>;
+        inline bool pin_current_thread(int cpu) {
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+            return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+            return false;
+#endif
+        }
+    };
 
-            auto task = std::make_shared<std::packaged_task<return_type()>>((f));
+    // CPUs in the order workers are pinned to them (worker i gets cpus[i % size]), empty for Affinity::None.
+    // Only CPUs in the affinity mask are listed, grouped by NUMA node.
+    inline std::vector<int> affinity_cpu_list(Affinity affinity) {
+        std::vector<int> cpus;
 
-            std::lock_guard<std::mutex> lock(mu);
+        if (affinity == Affinity::None)
+            return cpus;
+
+        const std::vector<int> allowed = detail::allowed_cpus();
+        const std::vector<int> cpu_nodes = detail::cpu_nodes();
 
-            tasks.emplace([task]() { (*task)(); }, priority);
-            condition.notify_one();
+        std::vector<std::vector<int>> nodes;
 
-            return task->get_future();
+        for (int cpu : allowed) {
+            const int node = cpu < (int)cpu_nodes.size() ? cpu_nodes[cpu] : 0;
+            if (node >= (int)nodes.size())
+                nodes.resize(node + 1);
+
+            nodes[node].push_back(cpu);
         }
 
-        void clear_queue() {
-            std::lock_guard<std::mutex> lock(mu);
-            while (!tasks.empty())
-                tasks.pop();
+        if (affinity == Affinity::Compact) {
+            for (const auto& n : nodes)
+                cpus.insert(cpus.end(), n.begin(), n.end());
+        } else {
+            for (size_t i = 0; cpus.size() < allowed.size(); i++)
+                for (const auto& n : nodes)
+                    if (i < n.size())
+                        cpus.push_back(n[i]);
         }
 
-        ~thread_pool() {
-            {
-                std::unique_lock<std::mutex> lock(mu);
-                stop = true;
+        return cpus;
+    }
+
+    // C4_CPU_LIST="0-7,16-23" pins workers to the listed CPUs, otherwise C4_AFFINITY=compact|scatter picks a policy.
+    static std::vector<int> env_cpu_list() {
+#pragma warning(push)
+#pragma warning(disable: 4996)
+        const char* c4_cpu_list = std::getenv("C4_CPU_LIST");
+        const char* c4_affinity = std::getenv("C4_AFFINITY");
+#pragma warning(pop)
+
+        if (c4_cpu_list)
+            return detail::parse_cpu_list(c4_cpu_list);
+
+        if (c4_affinity && std::string(c4_affinity) == "compact")
+            return affinity_cpu_list(Affinity::Compact);
+
+        if (c4_affinity && std::string(c4_affinity) == "scatter")
+            return affinity_cpu_list(Affinity::Scatter);
+
+        return {};
+    }
+
+    namespace detail {
+        // Move-only void() callable. Callables up to buffer_size bytes are stored inline,
+        // so submitting a typical lambda doesn't touch the heap.
+        class task_function {
+            static constexpr size_t buffer_size = 48;
+
+            struct vtable {
+                void (*invoke)(void*);
+                void (*move)(void* dst, void* src);
+                void (*destroy)(void*);
+            };
+
+            template<class F>
+            static constexpr bool is_inline = sizeof(F) <= buffer_size && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F>;
+
+            template<class F>
+            static const vtable* get_vtable() {
+                if constexpr (is_inline<F>) {
+                    static const vtable vt = {
+                        [](void* p) { (*static_cast<F*>(p))(); },
+                        [](void* dst, void* src) { ::new(dst) F(std::move(*static_cast<F*>(src))); static_cast<F*>(src)->~F(); },
+                        [](void* p) { static_cast<F*>(p)->~F(); }
+                    };
+                    return &vt;
+                } else {
+                    static const vtable vt = {
+                        [](void* p) { (**static_cast<F**>(p))(); },
+                        [](void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); },
+                        [](void* p) { delete *static_cast<F**>(p); }
+                    };
+                    return &vt;
+                }
             }
 
-            condition.notify_all();
+            alignas(std::max_align_t) unsigned char buffer[buffer_size];
+            const vtable* vt = nullptr;
 
-            for (std::thread& worker : workers)
-                worker.join();
-        }
+            void reset() {
+                if (vt) {
+                    vt->destroy(buffer);
+                    vt = nullptr;
+                }
+            }
 
-        template<class F0, class... F>
-        void parallel_invoke(F0&& f0, F&&... f) {
-            std::future<void> future = enqueue(f0);
+        public:
+            task_function() = default;
 
-            parallel_invoke(f...);
+            template<class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, task_function>>>
+            task_function(F&& f) {
+                typedef std::decay_t<F> Fn;
+                if constexpr (is_inline<Fn>)
+                    ::new(buffer) Fn(std::forward<F>(f));
+                else
+                    *reinterpret_cast<Fn**>(buffer) = new Fn(std::forward<F>(f));
 
-            future.get();
-        }
+                vt = get_vtable<Fn>();
+            }
 
-        static thread_pool& get_default_pool() {
-            static thread_pool tp;
-            return tp;
-        }
+            task_function(task_function&& o) noexcept : vt(o.vt) {
+                if (vt) {
+                    vt->move(buffer, o.buffer);
+                    o.vt = nullptr;
+                }
+            }
+
+            task_function& operator=(task_function&& o) noexcept {
+                if (this != &o) {
+                    reset();
+                    vt = o.vt;
+                    if (vt) {
+                        vt->move(buffer, o.buffer);
+                        o.vt = nullptr;
+                    }
+                }
+                return *this;
+            }
+
+            task_function& operator=(std::nullptr_t) {
+                reset();
+                return *this;
+            }
+
+            task_function(const task_function&) = delete;
+            task_function& operator=(const task_function&) = delete;
+
+            ~task_function() {
+                reset();
+            }
+
+            explicit operator bool() const {
+                return vt != nullptr;
+            }
+
+            void operator()() {
+                assert(vt);
+                vt->invoke(buffer);
+            }
+        };
+
+        // Task deque of a single worker: the owner pushes and pops at the back (LIFO),
+        // other workers steal from the front (FIFO). Ring buffer storage only grows.
+        template<class T>
+        class work_stealing_deque {
+            std::mutex mu;
+            std::vector<T> buffer;
+            size_t head = 0;
+            size_t tail = 0;
+            std::atomic<size_t> size_ = 0;
+
+            size_t mask(size_t i) const {
+                return i & (buffer.size() - 1);
+            }
+
+            void grow() {
+                std::vector<T> b(std::max<size_t>(2 * buffer.size(), 64));
+
+                for (size_t i = head; i != tail; i++)
+                    b[i - head] = std::move(buffer[mask(i)]);
+
+                tail -= head;
+                head = 0;
+                buffer.swap(b);
+            }
+
+            T take(size_t i) {
+                T t = std::move(buffer[mask(i)]);
+                buffer[mask(i)] = T();
+                size_.store(tail - head, std::memory_order_relaxed);
+                return t;
+            }
+
+        public:
+            bool empty() const {
+                return size_.load(std::memory_order_relaxed) == 0;
+            }
+
+            void push_back(T&& t) {
+                std::lock_guard<std::mutex> lock(mu);
+
+                if (tail - head == buffer.size())
+                    grow();
+
+                buffer[mask(tail++)] = std::move(t);
+                size_.store(tail - head, std::memory_order_relaxed);
+            }
+
+            bool pop_back(T& t) {
+                if (empty())
+                    return false;
+
+                std::lock_guard<std::mutex> lock(mu);
+                if (head == tail)
+                    return false;
+
+                --tail;
+                t = take(tail);
+                return true;
+            }
+
+            bool pop_front(T& t) {
+                if (empty())
+                    return false;
+
+                std::lock_guard<std::mutex> lock(mu);
+                if (head == tail)
+                    return false;
+
+                ++head;
+                t = take(head - 1);
+                return true;
+            }
+
+            size_t clear() {
+                std::lock_guard<std::mutex> lock(mu);
+                const size_t n = tail - head;
+
+                while (head != tail)
+                    take(head++);
+
+                return n;
+            }
+        };
+
+        // Counts outstanding tasks down to zero. The final count_down() signals under the mutex,
+        // so the latch may live on the waiter's stack and be destroyed as soon as wait() returns.
+        class completion_latch {
+            std::atomic<ptrdiff_t> count;
+            std::mutex mu;
+            std::condition_variable cv;
+            bool done;
+            std::exception_ptr error;
+
+        public:
+            explicit completion_latch(ptrdiff_t n = 0) : count(n), done(n == 0) {}
+
+            // Must not be called while anyone is waiting on the latch.
+            void reset(ptrdiff_t n) {
+                std::lock_guard<std::mutex> lock(mu);
+                count = n;
+                done = n == 0;
+                error = nullptr;
+            }
+
+            // Runs f and counts down by n; the first exception is kept for rethrow_if_failed().
+            template<class F>
+            void run(F& f, ptrdiff_t n = 1) {
+                try {
+                    f();
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mu);
+                    if (!error)
+                        error = std::current_exception();
+                }
+
+                count_down(n);
+            }
+
+            void rethrow_if_failed() {
+                std::lock_guard<std::mutex> lock(mu);
+                if (error)
+                    std::rethrow_exception(error);
+            }
+
+            void count_down(ptrdiff_t n = 1) {
+                if (count.fetch_sub(n, std::memory_order_acq_rel) == n) {
+                    std::lock_guard<std::mutex> lock(mu);
+                    done = true;
+                    cv.notify_all();
+                }
+            }
+
+            bool try_wait() const {
+                return count.load(std::memory_order_acquire) == 0;
+            }
 
-    private:
-        void parallel_invoke() {}
+            void wait() {
+                std::unique_lock<std::mutex> lock(mu);
+                cv.wait(lock, [this] { return done; });
+            }
+        };
     };
 
-    template<class T>
-    class enumerable_thread_specific : public std::vector<T> {
-        thread_pool& tp;
+    // Thrown by cancellable operations that were stopped by their cancellation_token.
+    class operation_cancelled : public std::exception {
     public:
-        enumerable_thread_specific(thread_pool& tp = thread_pool::get_default_pool()) : std::vector<T>(tp.get_num_threads()), tp(tp) {}
-        enumerable_thread_specific(const T& init, thread_pool& tp = thread_pool::get_default_pool()) : std::vector<T>(tp.get_num_threads(), init), tp(tp) {}
-
-        T& local() {
-            return (*this)[tp.get_thread_index()];
+        const char* what() const noexcept override {
+            return "operation cancelled";
         }
     };
 
-    namespace detail {
-        inline std::vector<size_t> init_groups(ptrdiff_t size, size_t grain_size) {
-            assert(size >= 0);
-            assert(grain_size > 0);
+    // Cooperative cancellation: whoever owns the work calls cancel() or sets a deadline,
+    // long-running code polls cancelled() at convenient points. Copies share the same state.
+    class cancellation_token {
+        typedef std::chrono::steady_clock clock;
 
-            const size_t groups_n = std::max<size_t>(size / grain_size, 1);
-            grain_size = size / groups_n;
+        struct state {
+            std::atomic<bool> cancelled = false;
+            std::atomic<clock::rep> deadline = clock::time_point::max().time_since_epoch().count();
+        };
 
-            std::vector<size_t> groups(groups_n, grain_size);
-            size -= groups_n * grain_size; // < groups_n
+        std::shared_ptr<state> s = std::make_shared<state>();
 
-            while (size > 0) {
-                groups[--size]++;
-            }
+    public:
+        cancellation_token() = default;
 
-            return groups;
+        explicit cancellation_token(clock::time_point deadline) {
+            set_deadline(deadline);
         }
 
-        template<class iterator, class F>
-        typename std::enable_if<std::is_convertible<F, std::function<void(typename std::iterator_traits<iterator>::value_type)> >::value>::type
-        static inline run_group(iterator group_first, iterator group_last, F f) {
-            std::for_each(group_first, group_last, f);
+        explicit cancellation_token(clock::duration timeout) : cancellation_token(clock::now() + timeout) {}
+
+        // Never cancelled, the default for algorithms taking an optional token
+        static const cancellation_token& none() {
+            static const cancellation_token token;
+            return token;
         }
 
-        template<class iterator, class F>
-        typename std::enable_if<std::is_convertible<F, std::function<void(iterator, iterator)> >::value>::type
-        static inline run_group(iterator group_first, iterator group_last, F f) {
-            f(group_first, group_last);
+        void cancel() {
+            s->cancelled.store(true, std::memory_order_relaxed);
         }
 
-        template<class iterator, class F>
-        typename std::enable_if<std::is_convertible<F, std::function<void(range)> >::value>::type
-            static inline run_group(iterator group_first, iterator group_last, F f) {
-            f(range(group_first, group_last));
+        void set_deadline(clock::time_point deadline) {
+            s->deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        bool cancelled() const {
+            if (s->cancelled.load(std::memory_order_relaxed))
+                return true;
+
+            const clock::rep deadline = s->deadline.load(std::memory_order_relaxed);
+            return deadline != clock::time_point::max().time_since_epoch().count() && clock::now().time_since_epoch().count() >= deadline;
+        }
+
+        void throw_if_cancelled() const {
+            if (cancelled())
+                throw operation_cancelled();
         }
     };
 
-    template<class iterator, class F>
-    inline void parallel_for(iterator first, iterator last, size_t grain_size, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        if (first >= last)
-            return;
+    // Statistics cost a couple of relaxed atomic adds per task; define C4_POOL_STATS_DISABLED to compile them out.
+    // Busy, idle and latency times take clock reads around every task, so they are only measured with C4_POOL_TIMING.
+    class thread_pool {
+#if !defined(C4_POOL_STATS_DISABLED) && defined(C4_POOL_TIMING)
+        static int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+#endif
 
-        if (tp.get_thread_index() != -1) { // we are called from the very same pool!
-            detail::run_group(first, last, f);
-            return;
+        // What the queues hold: the task and, for the latency statistics, when it was queued
+        struct queued_task {
+            detail::task_function f;
+#if !defined(C4_POOL_STATS_DISABLED) && defined(C4_POOL_TIMING)
+            int64_t queued_at = 0;
+#endif
+
+            queued_task() = default;
+
+            queued_task(detail::task_function&& f) : f(std::move(f)) {
+#if !defined(C4_POOL_STATS_DISABLED) && defined(C4_POOL_TIMING)
+                queued_at = now_ns();
+#endif
+            }
+        };
+
+        struct PriorityFunction {
+			int priority;
+			int timestamp;
+			queued_task f;
+
+            PriorityFunction(queued_task&& f, int priority) : priority(priority), f(std::move(f)) {
+				static std::atomic<int> counter(0);
+				timestamp = counter++;
+            }
+			
+            bool operator<(const PriorityFunction& other) const {
+				return priority < other.priority || priority == other.priority && timestamp > other.timestamp;
+			}
+		};
+
+        // Shared heap for tasks enqueued with non-zero priority, kept apart from the worker deques.
+        class priority_lane {
+            std::mutex mu;
+            std::vector<PriorityFunction> tasks;
+            std::atomic<size_t> size_ = 0;
+
+        public:
+            bool empty() const {
+                return size_.load(std::memory_order_relaxed) == 0;
+            }
+
+            void push(queued_task&& f, int priority) {
+                std::lock_guard<std::mutex> lock(mu);
+                tasks.emplace_back(std::move(f), priority);
+                std::push_heap(tasks.begin(), tasks.end());
+                size_.store(tasks.size(), std::memory_order_relaxed);
+            }
+
+            bool pop(queued_task& f) {
+                if (empty())
+                    return false;
+
+                std::lock_guard<std::mutex> lock(mu);
+                if (tasks.empty())
+                    return false;
+
+                std::pop_heap(tasks.begin(), tasks.end());
+                f = std::move(tasks.back().f);
+                tasks.pop_back();
+                size_.store(tasks.size(), std::memory_order_relaxed);
+                return true;
+            }
+
+            size_t clear() {
+                std::lock_guard<std::mutex> lock(mu);
+                const size_t n = tasks.size();
+                tasks.clear();
+                size_.store(0, std::memory_order_relaxed);
+                return n;
+            }
+        };
+
+        struct worker_stats {
+            std::atomic<uint64_t> executed = 0;
+            std::atomic<uint64_t> stolen = 0;
+            std::atomic<int64_t> busy_ns = 0;
+            std::atomic<int64_t> idle_ns = 0;
+            std::atomic<int64_t> latency_ns = 0;
+        };
+
+        struct alignas(64) worker_queue {
+            detail::work_stealing_deque<queued_task> tasks;
+
+            // submit_to() tasks: run by this worker first, taken by others only when there is nothing else
+            detail::work_stealing_deque<queued_task> affine;
+
+#ifndef C4_POOL_STATS_DISABLED
+            worker_stats stats;
+#endif
+        };
+
+        const int num_threads;
+        std::vector<std::thread> workers;
+        std::unique_ptr<worker_queue[]> queues;
+        priority_lane high_priority;
+        priority_lane low_priority;
+        std::atomic<uint32_t> next_queue = 0;
+
+        std::atomic<ptrdiff_t> num_pending = 0;
+        std::atomic<int> num_sleeping = 0;
+
+#ifndef C4_POOL_STATS_DISABLED
+        // Tasks run by threads outside the pool through run_pending_task()
+        worker_stats external_stats;
+        std::atomic<ptrdiff_t> max_pending = 0;
+        std::atomic<uint64_t> dropped = 0;
+
+        worker_stats& stats_of(int index) {
+            return index == -1 ? external_stats : queues[index].stats;
         }
+#endif
 
-        std::vector<size_t> groups = detail::init_groups(last - first, grain_size);
-        std::vector<std::future<void>> futures;
+        std::mutex mu;
+        std::condition_variable condition;
+        bool stop;
 
-        for (size_t g : groups) {
-            iterator group_first = first;
-            iterator group_last = first + g;
-            first = group_last;
+        struct worker_id {
+            const thread_pool* pool = nullptr;
+            int index = -1;
+        };
 
-            futures.emplace_back(tp.enqueue([group_first, group_last, f] {
-                detail::run_group(group_first, group_last, f);
-            }));
+        // Set once when a worker starts, so get_thread_index() is a thread_local read
+        static worker_id& this_worker() {
+            static thread_local worker_id id;
+            return id;
         }
 
-        for (auto& f : futures)
-            f.get();
-    }
+        // Order matters: positive priorities first, then own affine tasks (FIFO) and own deque (LIFO),
+        // then stealing (FIFO), then other workers' affine tasks, then negative priorities
+        bool pop_task(int index, queued_task& task) {
+            bool found = high_priority.pop(task);
 
-    template<class iterator, class T, class Reduction, class F>
-    inline T parallel_reduce(iterator first, iterator last, size_t grain_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        if (first >= last)
-            return init;
+            if (!found && index != -1)
+                found = queues[index].affine.pop_front(task) || queues[index].tasks.pop_back(task);
 
-        if (tp.get_thread_index() != -1) { // we are called from the very same pool!
-            init = reduction(init, f(first, last));
-            return init;
+            bool stolen = false;
+
+            for (int k = 1; !found && k <= num_threads; k++) {
+                const int victim = (index + k) % num_threads;
+                if (victim != index)
+                    found = stolen = queues[victim].tasks.pop_front(task);
+            }
+
+            for (int k = 1; !found && k <= num_threads; k++) {
+                const int victim = (index + k) % num_threads;
+                if (victim != index)
+                    found = stolen = queues[victim].affine.pop_back(task);
+            }
+
+            if (!found)
+                found = low_priority.pop(task);
+
+#ifndef C4_POOL_STATS_DISABLED
+            if (stolen)
+                stats_of(index).stolen.fetch_add(1, std::memory_order_relaxed);
+#endif
+
+            if (found)
+                num_pending--;
+
+            return found;
+        }
+
+        void on_queued() {
+            const ptrdiff_t pending = ++num_pending;
+
+#ifndef C4_POOL_STATS_DISABLED
+            ptrdiff_t m = max_pending.load(std::memory_order_relaxed);
+            while (pending > m && !max_pending.compare_exchange_weak(m, pending, std::memory_order_relaxed));
+#else
+            (void)pending;
+#endif
         }
 
-        std::vector<size_t> groups = detail::init_groups(last - first, grain_size);
-        std::vector<std::future<T>> futures;
+        void run_task(int index, queued_task& task) {
+#ifndef C4_POOL_STATS_DISABLED
+            worker_stats& stats = stats_of(index);
+
+#ifdef C4_POOL_TIMING
+            // Tasks run while waiting inside another task are part of its busy time already
+            static thread_local int depth = 0;
+
+            struct depth_guard {
+                depth_guard() { depth++; }
+                ~depth_guard() { depth--; }
+            };
+
+            const int64_t start = now_ns();
+            stats.latency_ns.fetch_add(start - task.queued_at, std::memory_order_relaxed);
+
+            {
+                depth_guard guard;
+                task.f();
+            }
 
-        for (size_t g : groups) {
-            iterator group_first = first;
-            iterator group_last = first + g;
-            first = group_last;
+            if (depth == 0)
+                stats.busy_ns.fetch_add(now_ns() - start, std::memory_order_relaxed);
+#else
+            task.f();
+#endif
 
-            futures.emplace_back(tp.enqueue([group_first, group_last, f] {
-                return f(group_first, group_last);
-            }));
+            stats.executed.fetch_add(1, std::memory_order_relaxed);
+#else
+            task.f();
+#endif
+            task.f = nullptr;
         }
 
-        for (auto& f : futures)
-            init = reduction(init, f.get());
+        void push_task(queued_task&& task, int priority) {
+            if (priority > 0) {
+                high_priority.push(std::move(task), priority);
+            } else if (priority < 0) {
+                low_priority.push(std::move(task), priority);
+            } else {
+                const int index = get_thread_index();
+                const int q = index != -1 ? index : int(next_queue++ % num_threads);
+                queues[q].tasks.push_back(std::move(task));
+            }
 
-        return init;
-    }
+            on_queued();
 
-    template<class iterator, class F>
-    inline void parallel_for(iterator first, iterator last, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        assert(first <= last);
-        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
-        parallel_for(first, last, grain_size, f, tp);
-    }
+            if (num_sleeping > 0) {
+                std::lock_guard<std::mutex> lock(mu);
+                condition.notify_one();
+            }
+        }
 
-    template<class iterator, class T, class Reduction, class F>
-    inline T parallel_reduce(iterator first, iterator last, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        assert(first <= last);
-        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
-        return parallel_reduce(first, last, grain_size, init, reduction, f, tp);
-    }
+        void worker_loop(int index) {
+            queued_task task;
 
-    template<class iterable, class F>
-    inline void parallel_for(iterable c, size_t grain_size, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        parallel_for(c.begin(), c.end(), grain_size, f, tp);
-    }
+            for (;;) {
+                if (pop_task(index, task)) {
+                    run_task(index, task);
+                    continue;
+                }
 
-    template<class iterable, class T, class Reduction, class F>
-    inline void parallel_reduce(iterable c, size_t grain_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        parallel_reduce(c.begin(), c.end(), grain_size, init, reduction, f, tp);
-    }
+#if !defined(C4_POOL_STATS_DISABLED) && defined(C4_POOL_TIMING)
+                const int64_t idle_start = now_ns();
+#endif
 
-    template<class iterable, class F>
-    inline void parallel_for(iterable c, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        parallel_for(c.begin(), c.end(), f, tp);
-    }
+                std::unique_lock<std::mutex> lock(mu);
+                num_sleeping++;
+                condition.wait(lock, [this] { return stop || num_pending > 0; });
+                num_sleeping--;
 
-    template<class iterable, class T, class Reduction, class F>
-    inline void parallel_reduce(iterable c, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
-        parallel_reduce(c.begin(), c.end(), init, reduction, f, tp);
-    }
+#if !defined(C4_POOL_STATS_DISABLED) && defined(C4_POOL_TIMING)
+                queues[index].stats.idle_ns.fetch_add(now_ns() - idle_start, std::memory_order_relaxed);
+#endif
 
-    template<class T, class Reduction, class F>
-    inline T parallel_reduce(range r, int grain_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+                if (stop && num_pending <= 0)
+                    return;
+            }
+        }
+
+    public:
+        // Worker i is pinned to cpus[i % cpus.size()], if any
+        thread_pool(unsigned int threads = env_num_threads(), const std::vector<int>& cpus = env_cpu_list())
+            : num_threads(std::max<int>(threads, 1)), queues(new worker_queue[num_threads]), stop(false) {
+            for (int i = 0; i < num_threads; i++) {
+                const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+
+                workers.emplace_back([this, i, cpu] {
+                    if (cpu != -1)
+                        detail::pin_current_thread(cpu);
+
+                    this_worker() = { this, i };
+                    worker_loop(i);
+                });
+            }
+        }
+
+        thread_pool(unsigned int threads, Affinity affinity) : thread_pool(threads, affinity_cpu_list(affinity)) {}
+
+        int get_num_threads() const {
+            return num_threads;
+        }
+
+        // Index of the calling worker of this pool, -1 for any other thread.
+        int get_thread_index() const {
+            const worker_id& id = this_worker();
+            return id.pool == this ? id.index : -1;
+        }
+
+        template<class F>
+        auto enqueue(F&& f, int priority = 0) -> std::future<typename std::invoke_result_t<F>> {
+            using return_type = typename std::invoke_result_t<F>;
+
+            std::packaged_task<return_type()> task(std::forward<F>(f));
+            std::future<return_type> future = task.get_future();
+
+            push_task(detail::task_function(std::move(task)), priority);
+
+            return future;
+        }
+
+        // The task is skipped, and the future throws operation_cancelled, if ct is cancelled before it starts
+        template<class F>
+        auto enqueue(F&& f, const cancellation_token& ct, int priority = 0) -> std::future<typename std::invoke_result_t<F>> {
+            return enqueue([f = std::forward<F>(f), ct]() mutable {
+                ct.throw_if_cancelled();
+                return f();
+            }, priority);
+        }
+
+        // Fire-and-forget: no future, no shared state. f must not throw.
+        template<class F>
+        void submit(F&& f, int priority = 0) {
+            push_task(detail::task_function(std::forward<F>(f)), priority);
+        }
+
+        // Queues f for the given worker. Other workers only take it when they run out of everything else,
+        // so repeated calls tend to run on the same core and find their data in its caches / NUMA node.
+        template<class F>
+        void submit_to(int worker, F&& f) {
+            queues[worker % num_threads].affine.push_back(detail::task_function(std::forward<F>(f)));
+            on_queued();
+
+            // notify_one() could wake up somebody else, who would then steal it
+            if (num_sleeping > 0) {
+                std::lock_guard<std::mutex> lock(mu);
+                condition.notify_all();
+            }
+        }
+
+        struct schedule_awaiter {
+            thread_pool& tp;
+            int priority;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) {
+                tp.submit([h] { h.resume(); }, priority);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        // co_await tp.schedule() continues the coroutine on a worker of this pool
+        schedule_awaiter schedule(int priority = 0) {
+            return { *this, priority };
+        }
+
+        // True if the calling thread is not a worker of this pool or its own deque is empty.
+        bool local_queue_empty() const {
+            const int index = get_thread_index();
+            return index == -1 || queues[index].tasks.empty();
+        }
+
+        // Runs one pending task on the calling thread. Returns false if there was nothing to run.
+        bool run_pending_task() {
+            const int index = get_thread_index();
+
+            queued_task task;
+            if (!pop_task(index, task))
+                return false;
+
+            run_task(index, task);
+            return true;
+        }
+
+        // Pool workers don't block here: they keep running pending tasks until the future is ready,
+        // so nested parallel calls can't starve the pool.
+        template<class T>
+        T wait(std::future<T>& future) {
+            if (get_thread_index() != -1) {
+                while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    if (!run_pending_task())
+                        std::this_thread::yield();
+                }
+            }
+
+            return future.get();
+        }
+
+        // Same as above for a latch; rethrows the first exception of the tasks run through latch.run().
+        void wait(detail::completion_latch& latch) {
+            if (get_thread_index() != -1) {
+                while (!latch.try_wait()) {
+                    if (!run_pending_task())
+                        std::this_thread::yield();
+                }
+            }
+
+            latch.wait();
+            latch.rethrow_if_failed();
+        }
+
+        void clear_queue() {
+            size_t n = high_priority.clear() + low_priority.clear();
+
+            for (int i = 0; i < num_threads; i++)
+                n += queues[i].tasks.clear() + queues[i].affine.clear();
+
+            num_pending -= n;
+
+#ifndef C4_POOL_STATS_DISABLED
+            dropped.fetch_add(n, std::memory_order_relaxed);
+#endif
+        }
+
+        struct stats_snapshot {
+            struct worker {
+                uint64_t executed = 0;
+                uint64_t stolen = 0;
+                std::chrono::nanoseconds busy{ 0 };
+                std::chrono::nanoseconds idle{ 0 };
+            };
+
+            uint64_t submitted = 0;             // executed + pending + dropped
+            uint64_t executed = 0;
+            uint64_t stolen = 0;
+            uint64_t dropped = 0;               // by clear_queue()
+            ptrdiff_t pending = 0;
+            ptrdiff_t max_pending = 0;          // queue depth high-water mark
+            std::chrono::nanoseconds avg_latency{ 0 };  // from queueing to start
+            std::vector<worker> workers;
+        };
+
+        // Relaxed reads of the counters: consistent enough for monitoring, not an atomic snapshot.
+        // Everything but pending is zero with C4_POOL_STATS_DISABLED, the times are zero without C4_POOL_TIMING.
+        stats_snapshot get_stats() const {
+            stats_snapshot s;
+            s.pending = std::max<ptrdiff_t>(num_pending.load(std::memory_order_relaxed), 0);
+
+#ifndef C4_POOL_STATS_DISABLED
+            int64_t latency_ns = 0;
+
+            auto add = [&](const worker_stats& ws) {
+                const uint64_t executed = ws.executed.load(std::memory_order_relaxed);
+                const uint64_t stolen = ws.stolen.load(std::memory_order_relaxed);
+
+                s.executed += executed;
+                s.stolen += stolen;
+                latency_ns += ws.latency_ns.load(std::memory_order_relaxed);
+
+                return stats_snapshot::worker{ executed, stolen,
+                    std::chrono::nanoseconds(ws.busy_ns.load(std::memory_order_relaxed)),
+                    std::chrono::nanoseconds(ws.idle_ns.load(std::memory_order_relaxed)) };
+            };
+
+            for (int i = 0; i < num_threads; i++)
+                s.workers.push_back(add(queues[i].stats));
+
+            add(external_stats);
+
+            s.dropped = dropped.load(std::memory_order_relaxed);
+            s.submitted = s.executed + s.pending + s.dropped;
+            s.max_pending = max_pending.load(std::memory_order_relaxed);
+            s.avg_latency = std::chrono::nanoseconds(s.executed ? latency_ns / int64_t(s.executed) : 0);
+#endif
+
+            return s;
+        }
+
+        void reset_stats() {
+#ifndef C4_POOL_STATS_DISABLED
+            auto reset = [](worker_stats& ws) {
+                ws.executed = 0;
+                ws.stolen = 0;
+                ws.busy_ns = 0;
+                ws.idle_ns = 0;
+                ws.latency_ns = 0;
+            };
+
+            for (int i = 0; i < num_threads; i++)
+                reset(queues[i].stats);
+
+            reset(external_stats);
+
+            dropped = 0;
+            max_pending = num_pending.load();
+#endif
+        }
+
+        ~thread_pool() {
+            {
+                std::unique_lock<std::mutex> lock(mu);
+                stop = true;
+            }
+
+            condition.notify_all();
+
+            for (std::thread& worker : workers)
+                worker.join();
+        }
+
+        template<class... F>
+        void parallel_invoke(F&&... f) {
+            detail::completion_latch latch(sizeof...(F));
+
+            // when nested, the last function is our share
+            const bool nested = get_thread_index() != -1;
+            size_t k = 0;
+
+            auto spawn = [&](auto& g) {
+                if (nested && ++k == sizeof...(F))
+                    latch.run(g);
+                else
+                    submit([&latch, &g] { latch.run(g); });
+            };
+
+            (spawn(f), ...);
+
+            wait(latch);
+        }
+
+        static thread_pool& get_default_pool() {
+            static thread_pool tp;
+            return tp;
+        }
+    };
+
+    // Per-thread copies of T, e.g. accumulators for parallel_for. Pool workers find their slot by index,
+    // other threads (like the caller running an inline part of a loop) get a slot on first use.
+    // Slots are padded to cache lines, so neighbouring threads don't false-share.
+    // Iteration, combine() and combine_each() must not run concurrently with local().
+    template<class T>
+    class enumerable_thread_specific {
+        struct alignas(64) slot {
+            T value;
+
+            slot(const T& value) : value(value) {}
+        };
+
+        thread_pool& tp;
+        T init;
+        std::vector<slot> workers;
+
+        std::mutex mu;
+        std::deque<slot> others;
+        std::vector<std::thread::id> others_ids;
+
+        T& other_local() {
+            const std::thread::id id = std::this_thread::get_id();
+            std::lock_guard<std::mutex> lock(mu);
+
+            for (int i : range(others_ids))
+                if (others_ids[i] == id)
+                    return others[i].value;
+
+            others_ids.push_back(id);
+            return others.emplace_back(init).value;
+        }
+
+    public:
+        template<class E>
+        class slot_iterator {
+            E* ets;
+            int i;
+
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = T;
+            using difference_type = ptrdiff_t;
+            using pointer = std::conditional_t<std::is_const_v<E>, const T*, T*>;
+            using reference = std::conditional_t<std::is_const_v<E>, const T&, T&>;
+
+            slot_iterator(E* ets, int i) : ets(ets), i(i) {}
+
+            reference operator*() const {
+                return (*ets)[i];
+            }
+
+            pointer operator->() const {
+                return &(*ets)[i];
+            }
+
+            slot_iterator& operator++() {
+                ++i;
+                return *this;
+            }
+
+            slot_iterator operator++(int) {
+                slot_iterator r = *this;
+                ++i;
+                return r;
+            }
+
+            bool operator==(const slot_iterator& other) const {
+                return i == other.i;
+            }
+
+            bool operator!=(const slot_iterator& other) const {
+                return i != other.i;
+            }
+        };
+
+        typedef slot_iterator<enumerable_thread_specific> iterator;
+        typedef slot_iterator<const enumerable_thread_specific> const_iterator;
+
+        enumerable_thread_specific(thread_pool& tp = thread_pool::get_default_pool()) : enumerable_thread_specific(T(), tp) {}
+        enumerable_thread_specific(const T& init, thread_pool& tp = thread_pool::get_default_pool()) : tp(tp), init(init), workers(tp.get_num_threads(), slot(init)) {}
+
+        T& local() {
+            const int index = tp.get_thread_index();
+            return index != -1 ? workers[index].value : other_local();
+        }
+
+        int size() const {
+            return isize(workers) + isize(others);
+        }
+
+        T& operator[](int i) {
+            return i < isize(workers) ? workers[i].value : others[i - isize(workers)].value;
+        }
+
+        const T& operator[](int i) const {
+            return i < isize(workers) ? workers[i].value : others[i - isize(workers)].value;
+        }
+
+        iterator begin() {
+            return iterator(this, 0);
+        }
+
+        iterator end() {
+            return iterator(this, size());
+        }
+
+        const_iterator begin() const {
+            return const_iterator(this, 0);
+        }
+
+        const_iterator end() const {
+            return const_iterator(this, size());
+        }
+
+        // op(op(op(slot0, slot1), slot2), ...)
+        template<class Op>
+        T combine(Op op) const {
+            T r = (*this)[0];
+            for (int i : range(1, size()))
+                r = op(r, (*this)[i]);
+
+            return r;
+        }
+
+        template<class F>
+        void combine_each(F f) {
+            for (T& t : *this)
+                f(t);
+        }
+
+        template<class F>
+        void combine_each(F f) const {
+            for (const T& t : *this)
+                f(t);
+        }
+    };
+
+    namespace detail {
+        // Splits size elements into n = size / grain_size groups of equal size, the last size % n groups get one extra element.
+        // Group bounds are computed on the fly, so no storage is needed.
+        class group_split {
+            size_t n;
+            size_t base;
+            size_t rem;
+
+        public:
+            group_split(ptrdiff_t size, size_t grain_size) {
+                assert(size >= 0);
+                assert(grain_size > 0);
+
+                n = std::max<size_t>(size / grain_size, 1);
+                base = size / n;
+                rem = size - n * base;
+            }
+
+            size_t size() const {
+                return n;
+            }
+
+            size_t begin(size_t g) const {
+                return g * base + (g > n - rem ? g - (n - rem) : 0);
+            }
+
+            size_t end(size_t g) const {
+                return begin(g + 1);
+            }
+        };
+
+        // One result slot per group, kept on the stack for the usual group count of about one per thread
+        // and on the heap only beyond that, or when T is too big to keep many of them on the stack
+        template<class T>
+        class group_results {
+            static constexpr size_t inline_size = std::min<size_t>(64, 4096 / sizeof(std::optional<T>));
+
+            std::array<std::optional<T>, inline_size> inline_results;
+            std::vector<std::optional<T>> heap_results;
+            std::optional<T>* results;
+            size_t n;
+
+        public:
+            explicit group_results(size_t n) : n(n) {
+                if (n > inline_size) {
+                    heap_results.resize(n);
+                    results = heap_results.data();
+                } else {
+                    results = inline_results.data();
+                }
+            }
+
+            group_results(const group_results&) = delete;
+            group_results& operator=(const group_results&) = delete;
+
+            std::optional<T>& operator[](size_t g) {
+                return results[g];
+            }
+
+            std::optional<T>* begin() {
+                return results;
+            }
+
+            std::optional<T>* end() {
+                return results + n;
+            }
+        };
+
+        template<class iterator, class F>
+        typename std::enable_if<std::is_convertible<F, std::function<void(typename std::iterator_traits<iterator>::value_type)> >::value>::type
+        static inline run_group(iterator group_first, iterator group_last, F f) {
+            std::for_each(group_first, group_last, f);
+        }
+
+        template<class iterator, class F>
+        typename std::enable_if<std::is_convertible<F, std::function<void(iterator, iterator)> >::value>::type
+        static inline run_group(iterator group_first, iterator group_last, F f) {
+            f(group_first, group_last);
+        }
+
+        template<class iterator, class F>
+        typename std::enable_if<std::is_convertible<F, std::function<void(range)> >::value>::type
+            static inline run_group(iterator group_first, iterator group_last, F f) {
+            f(range(group_first, group_last));
+        }
+    };
+
+    template<class iterator, class F>
+    inline void parallel_for(iterator first, iterator last, size_t grain_size, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (first >= last)
+            return;
+
+        // When called from a worker of the very same pool, the last group is run inline and
+        // the rest is left for other workers to steal, while we help in tp.wait()
+        const bool nested = tp.get_thread_index() != -1;
+
+        // Tasks only capture references to this frame: no futures, no heap allocations
+        const detail::group_split groups(last - first, grain_size);
+        detail::completion_latch latch(groups.size());
+
+        for (size_t g : range(groups.size() - nested)) {
+            tp.submit([&f, &latch, group_first = first + groups.begin(g), group_last = first + groups.end(g)] {
+                auto run = [&] { detail::run_group(group_first, group_last, f); };
+                latch.run(run);
+            });
+        }
+
+        if (nested) {
+            auto run = [&] { detail::run_group(first + groups.begin(groups.size() - 1), last, f); };
+            latch.run(run);
+        }
+
+        tp.wait(latch);
+    }
+
+    template<class iterator, class T, class Reduction, class F>
+    inline T parallel_reduce(iterator first, iterator last, size_t grain_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (first >= last)
+            return init;
+
+        const bool nested = tp.get_thread_index() != -1;
+
+        const detail::group_split groups(last - first, grain_size);
+        detail::completion_latch latch(groups.size());
+
+        // Results are combined in group order after all of them are ready
+        detail::group_results<T> results(groups.size());
+
+        for (size_t g : range(groups.size() - nested)) {
+            tp.submit([&f, &latch, &results, g, group_first = first + groups.begin(g), group_last = first + groups.end(g)] {
+                auto run = [&] { results[g].emplace(f(group_first, group_last)); };
+                latch.run(run);
+            });
+        }
+
+        if (nested) {
+            auto run = [&] { results[groups.size() - 1].emplace(f(first + groups.begin(groups.size() - 1), last)); };
+            latch.run(run);
+        }
+
+        tp.wait(latch);
+
+        for (auto& r : results)
+            init = reduction(std::move(init), std::move(*r));
+
+        return init;
+    }
+
+    template<class iterator, class F>
+    inline void parallel_for(iterator first, iterator last, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        parallel_for(first, last, grain_size, f, tp);
+    }
+
+    template<class iterator, class T, class Reduction, class F>
+    inline T parallel_reduce(iterator first, iterator last, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        return parallel_reduce(first, last, grain_size, init, reduction, f, tp);
+    }
+
+    template<class iterable, class F>
+    inline void parallel_for(iterable c, size_t grain_size, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        parallel_for(c.begin(), c.end(), grain_size, f, tp);
+    }
+
+    template<class iterable, class T, class Reduction, class F>
+    inline T parallel_reduce(iterable c, size_t grain_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        return parallel_reduce(c.begin(), c.end(), grain_size, init, reduction, f, tp);
+    }
+
+    template<class iterable, class F>
+    inline void parallel_for(iterable c, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        parallel_for(c.begin(), c.end(), f, tp);
+    }
+
+    template<class iterable, class T, class Reduction, class F>
+    inline T parallel_reduce(iterable c, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        return parallel_reduce(c.begin(), c.end(), init, reduction, f, tp);
+    }
+
+    template<class T, class Reduction, class F>
+    inline T parallel_reduce(range r, int grain_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        return parallel_reduce(r.begin(), r.end(), grain_size, init, reduction, [&](range::iterator first, range::iterator last) {
+            return f(range(first, last));
+        }, tp);
+    }
+
+    // How parallel_for and parallel_reduce hand out work.
+    enum class Schedule {
+        Static,     // size / grain_size equal groups, one task each
+        Dynamic,    // one task per thread takes grain_size chunks from a shared counter
+        Guided,     // like Dynamic, but chunks shrink with the remaining work, down to grain_size
+        Auto,       // a range splits in halves whenever the worker running it has nothing left for thieves
+        Affine      // like Static, but group g always goes to worker g % threads, so data stays in the same cache across calls
+    };
+
+    namespace detail {
+        // Calls body(b, e) on disjoint chunks covering [0, size) as the schedule says.
+        // The latch counts elements, so chunks may be created on the fly, plus one per
+        // Dynamic/Guided task, which still reads the shared counter after its last chunk.
+        template<class Body>
+        class scheduled_loop {
+            const size_t size;
+            const size_t grain_size;
+            const Schedule schedule;
+            Body& body;
+            thread_pool& tp;
+
+            completion_latch latch;
+            std::atomic<size_t> next = 0;
+
+            void run_chunk(size_t b, size_t e) {
+                auto f = [&] { body(b, e); };
+                latch.run(f, e - b);
+            }
+
+            void run_dynamic() {
+                const size_t guided_div = 2 * tp.get_num_threads();
+
+                for (;;) {
+                    size_t b = next.load(std::memory_order_relaxed);
+                    size_t chunk;
+
+                    do {
+                        if (b >= size) {
+                            latch.count_down();
+                            return;
+                        }
+
+                        chunk = schedule == Schedule::Guided ? std::max(grain_size, (size - b) / guided_div) : grain_size;
+                    } while (!next.compare_exchange_weak(b, b + chunk, std::memory_order_relaxed));
+
+                    run_chunk(b, std::min(b + chunk, size));
+                }
+            }
+
+            struct splitter {
+                scheduled_loop* loop;
+                size_t b;
+                size_t e;
+
+                void operator()() {
+                    loop->run_auto(b, e);
+                }
+            };
+
+            // Lazy binary splitting: only split when our deque is empty, i.e. there is nothing else to steal
+            void run_auto(size_t b, size_t e) {
+                while (b < e) {
+                    if (e - b >= 2 * grain_size && tp.local_queue_empty()) {
+                        const size_t mid = b + (e - b) / 2;
+                        tp.submit(splitter{ this, mid, e });
+                        e = mid;
+                    } else {
+                        const size_t c = std::min(b + grain_size, e);
+                        run_chunk(b, c);
+                        b = c;
+                    }
+                }
+            }
+
+        public:
+            scheduled_loop(size_t size, size_t grain_size, Schedule schedule, Body& body, thread_pool& tp)
+                : size(size), grain_size(std::max<size_t>(grain_size, 1)), schedule(schedule), body(body), tp(tp), latch(size) {
+                assert(schedule != Schedule::Static);
+            }
+
+            void run() {
+                if (size == 0)
+                    return;
+
+                const bool nested = tp.get_thread_index() != -1;
+
+                if (schedule == Schedule::Auto) {
+                    if (nested)
+                        run_auto(0, size);
+                    else
+                        tp.submit(splitter{ this, 0, size });
+                } else {
+                    const size_t tasks = std::min<size_t>(tp.get_num_threads(), (size + grain_size - 1) / grain_size);
+                    latch.reset(size + tasks);
+
+                    for (size_t k = nested; k < tasks; k++)
+                        tp.submit([this] { run_dynamic(); });
+
+                    if (nested)
+                        run_dynamic();
+                }
+
+                tp.wait(latch);
+            }
+        };
+
+        template<class Body>
+        inline void run_affine(size_t size, size_t grain_size, Body& body, thread_pool& tp) {
+            const group_split groups(size, std::max<size_t>(grain_size, 1));
+            completion_latch latch(groups.size());
+
+            for (size_t g : range(groups.size())) {
+                tp.submit_to(int(g % tp.get_num_threads()), [&body, &latch, b = groups.begin(g), e = groups.end(g)] {
+                    auto run = [&] { body(b, e); };
+                    latch.run(run);
+                });
+            }
+
+            tp.wait(latch);
+        }
+    };
+
+    template<class iterator, class F>
+    inline void parallel_for(iterator first, iterator last, size_t grain_size, Schedule schedule, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (schedule == Schedule::Static) {
+            parallel_for(first, last, grain_size, f, tp);
+            return;
+        }
+
+        if (first >= last)
+            return;
+
+        auto body = [&](size_t b, size_t e) {
+            detail::run_group(first + b, first + e, f);
+        };
+
+        if (schedule == Schedule::Affine) {
+            detail::run_affine(last - first, grain_size, body, tp);
+            return;
+        }
+
+        detail::scheduled_loop<decltype(body)> loop(last - first, grain_size, schedule, body, tp);
+        loop.run();
+    }
+
+    // Chunk results are combined in the order of chunks, whichever thread computed them
+    template<class iterator, class T, class Reduction, class F>
+    inline T parallel_reduce(iterator first, iterator last, size_t grain_size, Schedule schedule, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (schedule == Schedule::Static)
+            return parallel_reduce(first, last, grain_size, init, reduction, f, tp);
+
+        if (first >= last)
+            return init;
+
+        std::mutex mu;
+        std::vector<std::pair<size_t, T>> results;
+
+        auto body = [&](size_t b, size_t e) {
+            T r = f(first + b, first + e);
+
+            std::lock_guard<std::mutex> lock(mu);
+            results.emplace_back(b, std::move(r));
+        };
+
+        if (schedule == Schedule::Affine) {
+            detail::run_affine(last - first, grain_size, body, tp);
+        } else {
+            detail::scheduled_loop<decltype(body)> loop(last - first, grain_size, schedule, body, tp);
+            loop.run();
+        }
+
+        std::sort(results.begin(), results.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        for (auto& r : results)
+            init = reduction(std::move(init), std::move(r.second));
+
+        return init;
+    }
+
+    template<class iterable, class F>
+    inline void parallel_for(iterable c, size_t grain_size, Schedule schedule, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        parallel_for(c.begin(), c.end(), grain_size, schedule, f, tp);
+    }
+
+    template<class T, class Reduction, class F>
+    inline T parallel_reduce(range r, int grain_size, Schedule schedule, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        return parallel_reduce(r.begin(), r.end(), grain_size, schedule, init, reduction, [&](range::iterator first, range::iterator last) {
+            return f(range(first, last));
+        }, tp);
+    }
+
+    // Bit-identical results for any number of threads: [first, last) is cut into chunk_size pieces whatever the pool,
+    // and their results are combined in a fixed pairwise tree, ((c0 c1) (c2 c3)) ..., which is then added to init.
+    // The tree also loses less precision on floating point sums than a running total.
+    template<class iterator, class T, class Reduction, class F>
+    inline T parallel_deterministic_reduce(iterator first, iterator last, size_t chunk_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (first >= last)
+            return init;
+
+        chunk_size = std::max<size_t>(chunk_size, 1);
+
+        const size_t size = last - first;
+        const int n = int((size + chunk_size - 1) / chunk_size);
+
+        std::vector<std::optional<T>> results(n);
+
+        parallel_for(range(n), 1, Schedule::Dynamic, [&](int c) {
+            results[c].emplace(f(first + c * chunk_size, first + std::min((c + 1) * chunk_size, size)));
+        }, tp);
+
+        // One level of the tree at a time; pairs within a level are independent
+        for (int step = 1; step < n; step *= 2) {
+            const int pairs = (n - step + 2 * step - 1) / (2 * step);
+
+            parallel_for(range(pairs), [&](int k) {
+                const int i = 2 * step * k;
+                results[i] = reduction(std::move(*results[i]), std::move(*results[i + step]));
+                results[i + step].reset();
+            }, tp);
+        }
+
+        return reduction(std::move(init), std::move(*results[0]));
+    }
+
+    template<class T, class Reduction, class F>
+    inline T parallel_deterministic_reduce(range r, int chunk_size, T init, Reduction reduction, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        return parallel_deterministic_reduce(r.begin(), r.end(), chunk_size, init, reduction, [&](range::iterator first, range::iterator last) {
+            return f(range(first, last));
+        }, tp);
+    }
+
+    // Cancellable loops hand out grain_size chunks dynamically and check ct before each one.
+    // Once it is cancelled the remaining chunks are skipped and operation_cancelled is thrown.
+    template<class iterator, class F>
+    inline void parallel_for(iterator first, iterator last, size_t grain_size, F f, const cancellation_token& ct, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (first >= last)
+            return;
+
+        std::atomic<bool> skipped = false;
+
+        auto body = [&](size_t b, size_t e) {
+            if (ct.cancelled()) {
+                skipped.store(true, std::memory_order_relaxed);
+                return;
+            }
+
+            detail::run_group(first + b, first + e, f);
+        };
+
+        detail::scheduled_loop<decltype(body)> loop(last - first, grain_size, Schedule::Dynamic, body, tp);
+        loop.run();
+
+        if (skipped)
+            throw operation_cancelled();
+    }
+
+    template<class iterator, class T, class Reduction, class F>
+    inline T parallel_reduce(iterator first, iterator last, size_t grain_size, T init, Reduction reduction, F f, const cancellation_token& ct, thread_pool& tp = thread_pool::get_default_pool()) {
+        std::atomic<bool> skipped = false;
+
+        // A skipped chunk contributes nothing
+        std::optional<T> r = parallel_reduce(first, last, grain_size, Schedule::Dynamic, std::optional<T>(std::move(init)), [&](std::optional<T>&& a, std::optional<T>&& b) {
+            if (b)
+                a = reduction(std::move(*a), std::move(*b));
+
+            return std::move(a);
+        }, [&](iterator b, iterator e) -> std::optional<T> {
+            if (ct.cancelled()) {
+                skipped.store(true, std::memory_order_relaxed);
+                return std::nullopt;
+            }
+
+            return f(b, e);
+        }, tp);
+
+        if (skipped)
+            throw operation_cancelled();
+
+        return std::move(*r);
+    }
+
+    template<class iterable, class F>
+    inline void parallel_for(iterable c, size_t grain_size, F f, const cancellation_token& ct, thread_pool& tp = thread_pool::get_default_pool()) {
+        parallel_for(c.begin(), c.end(), grain_size, f, ct, tp);
+    }
+
+    template<class T, class Reduction, class F>
+    inline T parallel_reduce(range r, int grain_size, T init, Reduction reduction, F f, const cancellation_token& ct, thread_pool& tp = thread_pool::get_default_pool()) {
         return parallel_reduce(r.begin(), r.end(), grain_size, init, reduction, [&](range::iterator first, range::iterator last) {
             return f(range(first, last));
+        }, ct, tp);
+    }
+
+    // Feedback-driven grain size for one call site, keep it static next to the loop:
+    //     static grain_tuner tuner;
+    //     parallel_for(range(n), tuner, f);
+    // Chunks are timed and the grain follows the measured cost per element towards target_chunk_duration.
+    class grain_tuner {
+        const double target_ns;
+        const size_t initial_grain;
+        std::atomic<double> ns_per_element = 0.;
+
+    public:
+        explicit grain_tuner(std::chrono::nanoseconds target_chunk_duration = std::chrono::microseconds(100), size_t initial_grain = 1)
+            : target_ns((double)target_chunk_duration.count()), initial_grain(initial_grain) {}
+
+        size_t grain_size(size_t size, int num_threads) const {
+            const double npe = ns_per_element.load(std::memory_order_relaxed);
+            const size_t grain = npe > 0. ? size_t(target_ns / npe) : initial_grain;
+
+            return std::clamp<size_t>(grain, 1, std::max<size_t>(size / num_threads, 1));
+        }
+
+        void update(size_t elements, std::chrono::nanoseconds busy) {
+            if (elements == 0)
+                return;
+
+            const double measured = double(busy.count()) / elements;
+            const double npe = ns_per_element.load(std::memory_order_relaxed);
+
+            ns_per_element.store(npe > 0. ? 0.75 * npe + 0.25 * measured : measured, std::memory_order_relaxed);
+        }
+    };
+
+    template<class iterator, class F>
+    inline void parallel_for(iterator first, iterator last, grain_tuner& tuner, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (first >= last)
+            return;
+
+        std::atomic<int64_t> busy_ns = 0;
+
+        auto body = [&](size_t b, size_t e) {
+            const auto start = std::chrono::steady_clock::now();
+            detail::run_group(first + b, first + e, f);
+            busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        const size_t size = last - first;
+        detail::scheduled_loop<decltype(body)> loop(size, tuner.grain_size(size, tp.get_num_threads()), Schedule::Dynamic, body, tp);
+        loop.run();
+
+        tuner.update(size, std::chrono::nanoseconds(busy_ns.load()));
+    }
+
+    template<class iterable, class F>
+    inline void parallel_for(iterable c, grain_tuner& tuner, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        parallel_for(c.begin(), c.end(), tuner, f, tp);
+    }
+
+    namespace detail {
+        template<class iterator, class out_iterator, class T, class Op>
+        inline out_iterator parallel_scan(iterator first, iterator last, out_iterator d_first, size_t grain_size, T init, Op op, bool inclusive, thread_pool& tp) {
+            if (first >= last)
+                return d_first;
+
+            const detail::group_split groups(last - first, grain_size);
+
+            // 1st pass: reduce every group, groups are never empty
+            std::vector<T> offsets(groups.size() + 1, init);
+            parallel_for(range(groups.size()), 1, [&](int g) {
+                iterator it = first + groups.begin(g);
+                iterator group_last = first + groups.end(g);
+
+                T s = *it;
+                while (++it != group_last)
+                    s = op(s, *it);
+
+                offsets[g + 1] = s;
+            }, tp);
+
+            for (int g : range(groups.size()))
+                offsets[g + 1] = op(offsets[g], offsets[g + 1]);
+
+            // 2nd pass: scan every group starting from its offset, in-place is fine
+            parallel_for(range(groups.size()), 1, [&](int g) {
+                T acc = offsets[g];
+                out_iterator out = d_first + groups.begin(g);
+
+                for (iterator it = first + groups.begin(g), group_last = first + groups.end(g); it != group_last; ++it, ++out) {
+                    T x = *it;
+                    if (inclusive) {
+                        acc = op(acc, x);
+                        *out = acc;
+                    } else {
+                        *out = acc;
+                        acc = op(acc, x);
+                    }
+                }
+            }, tp);
+
+            return d_first + (last - first);
+        }
+    };
+
+    // d_first[i] = init op first[0] op ... op first[i], op must be associative
+    template<class iterator, class out_iterator, class T, class Op>
+    inline out_iterator parallel_inclusive_scan(iterator first, iterator last, out_iterator d_first, size_t grain_size, T init, Op op, thread_pool& tp = thread_pool::get_default_pool()) {
+        return detail::parallel_scan(first, last, d_first, grain_size, init, op, true, tp);
+    }
+
+    template<class iterator, class out_iterator, class T, class Op>
+    inline out_iterator parallel_inclusive_scan(iterator first, iterator last, out_iterator d_first, T init, Op op, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        return parallel_inclusive_scan(first, last, d_first, grain_size, init, op, tp);
+    }
+
+    // d_first[i] = init op first[0] op ... op first[i-1], op must be associative
+    template<class iterator, class out_iterator, class T, class Op>
+    inline out_iterator parallel_exclusive_scan(iterator first, iterator last, out_iterator d_first, size_t grain_size, T init, Op op, thread_pool& tp = thread_pool::get_default_pool()) {
+        return detail::parallel_scan(first, last, d_first, grain_size, init, op, false, tp);
+    }
+
+    template<class iterator, class out_iterator, class T, class Op>
+    inline out_iterator parallel_exclusive_scan(iterator first, iterator last, out_iterator d_first, T init, Op op, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        return parallel_exclusive_scan(first, last, d_first, grain_size, init, op, tp);
+    }
+
+    namespace detail {
+        // Number of elements of a that come before output position k when a and b are merged, a first on ties
+        template<class iterator_a, class iterator_b, class Compare>
+        inline ptrdiff_t merge_co_rank(iterator_a a, ptrdiff_t na, iterator_b b, ptrdiff_t nb, ptrdiff_t k, Compare comp) {
+            ptrdiff_t lo = std::max<ptrdiff_t>(0, k - nb);
+            ptrdiff_t hi = std::min(k, na);
+
+            while (lo < hi) {
+                const ptrdiff_t mid = (lo + hi) / 2;
+                if (!comp(b[k - mid - 1], a[mid]))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            return lo;
+        }
+
+        // Moves the merge of a and b to out, a first on ties
+        template<class iterator_a, class iterator_b, class out_iterator, class Compare>
+        inline void move_merge(iterator_a a, iterator_a a_last, iterator_b b, iterator_b b_last, out_iterator out, Compare comp) {
+            while (a != a_last && b != b_last)
+                *out++ = comp(*b, *a) ? std::move(*b++) : std::move(*a++);
+
+            out = std::move(a, a_last, out);
+            std::move(b, b_last, out);
+        }
+    };
+
+    // Groups are sorted in parallel, then sorted runs are merged pairwise through a scratch buffer.
+    // Every level, the last one included, is cut at co-ranks into about as many pieces as there are groups,
+    // so all of them run in parallel. Types that can't be default constructed into the buffer are merged in place,
+    // with one std::inplace_merge per pair. Not stable.
+    template<class iterator, class Compare>
+    inline void parallel_sort(iterator first, iterator last, size_t grain_size, Compare comp, thread_pool& tp = thread_pool::get_default_pool()) {
+        typedef typename std::iterator_traits<iterator>::value_type value_type;
+
+        if (last - first < 2)
+            return;
+
+        const detail::group_split groups(last - first, grain_size);
+        const int n = (int)groups.size();
+
+        parallel_for(range(n), 1, [&](int g) {
+            std::sort(first + groups.begin(g), first + groups.end(g), comp);
+        }, tp);
+
+        if constexpr (!std::is_default_constructible<value_type>::value) {
+            for (int width = 1; width < n; width *= 2) {
+                parallel_for(range((n + 2 * width - 1) / (2 * width)), 1, [&](int k) {
+                    const int g = 2 * width * k;
+                    if (g + width < n)
+                        std::inplace_merge(first + groups.begin(g), first + groups.begin(g + width), first + groups.begin(std::min(g + 2 * width, n)), comp);
+                }, tp);
+            }
+        } else {
+            if (n < 2)
+                return;
+
+            std::vector<value_type> scratch(last - first);
+
+            // Runs of width groups in src become runs of 2 * width groups in dst
+            auto merge_level = [&](auto src, auto dst, int width) {
+                const int pairs = (n + 2 * width - 1) / (2 * width);
+                const int pieces = std::max(n / pairs, 1);
+
+                parallel_for(range(pairs * pieces), 1, [&](int t) {
+                    const int g = 2 * width * (t / pieces);
+                    const int piece = t % pieces;
+
+                    const ptrdiff_t a = groups.begin(g);
+                    const ptrdiff_t b = groups.begin(std::min(g + width, n));
+                    const ptrdiff_t e = groups.begin(std::min(g + 2 * width, n));
+
+                    const ptrdiff_t k0 = (e - a) * piece / pieces;
+                    const ptrdiff_t k1 = (e - a) * (piece + 1) / pieces;
+
+                    const ptrdiff_t i0 = detail::merge_co_rank(src + a, b - a, src + b, e - b, k0, comp);
+                    const ptrdiff_t i1 = detail::merge_co_rank(src + a, b - a, src + b, e - b, k1, comp);
+
+                    detail::move_merge(src + a + i0, src + a + i1, src + b + (k0 - i0), src + b + (k1 - i1), dst + a + k0, comp);
+                }, tp);
+            };
+
+            bool in_scratch = false;
+
+            for (int width = 1; width < n; width *= 2) {
+                if (in_scratch)
+                    merge_level(scratch.begin(), first, width);
+                else
+                    merge_level(first, scratch.begin(), width);
+
+                in_scratch = !in_scratch;
+            }
+
+            if (in_scratch) {
+                parallel_for(range(n), 1, [&](int g) {
+                    std::move(scratch.begin() + groups.begin(g), scratch.begin() + groups.end(g), first + groups.begin(g));
+                }, tp);
+            }
+        }
+    }
+
+    template<class iterator, class Compare>
+    inline void parallel_sort(iterator first, iterator last, Compare comp, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        parallel_sort(first, last, grain_size, comp, tp);
+    }
+
+    template<class iterator>
+    inline void parallel_sort(iterator first, iterator last, thread_pool& tp = thread_pool::get_default_pool()) {
+        parallel_sort(first, last, std::less<>(), tp);
+    }
+
+    // Moves elements satisfying pred before the rest and returns the partition point.
+    // The predicate is evaluated in parallel, the result is stable.
+    // The elements are moved through scratch, which callers partitioning over and over can keep to reuse its memory.
+    template<class iterator, class Predicate>
+    inline iterator parallel_partition(iterator first, iterator last, size_t grain_size, Predicate pred, std::vector<typename std::iterator_traits<iterator>::value_type>& scratch, thread_pool& tp = thread_pool::get_default_pool()) {
+        if (first >= last)
+            return first;
+
+        const ptrdiff_t size = last - first;
+        const detail::group_split groups(size, grain_size);
+        const int n = (int)groups.size();
+
+        std::vector<uint8_t> flags(size);
+        std::vector<ptrdiff_t> trues(n + 1, 0);
+
+        parallel_for(range(n), 1, [&](int g) {
+            ptrdiff_t c = 0;
+            for (size_t i = groups.begin(g); i < groups.end(g); i++)
+                c += flags[i] = pred(first[i]) ? 1 : 0;
+
+            trues[g + 1] = c;
+        }, tp);
+
+        for (int g : range(n))
+            trues[g + 1] += trues[g];
+
+        scratch.assign(std::make_move_iterator(first), std::make_move_iterator(last));
+
+        parallel_for(range(n), 1, [&](int g) {
+            ptrdiff_t t = trues[g];
+            ptrdiff_t f = trues[n] + groups.begin(g) - trues[g];
+
+            for (size_t i = groups.begin(g); i < groups.end(g); i++)
+                first[flags[i] ? t++ : f++] = std::move(scratch[i]);
+        }, tp);
+
+        // Moved-from elements go, the capacity stays
+        scratch.clear();
+
+        return first + trues[n];
+    }
+
+    template<class iterator, class Predicate>
+    inline iterator parallel_partition(iterator first, iterator last, size_t grain_size, Predicate pred, thread_pool& tp = thread_pool::get_default_pool()) {
+        std::vector<typename std::iterator_traits<iterator>::value_type> scratch;
+        return parallel_partition(first, last, grain_size, pred, scratch, tp);
+    }
+
+    template<class iterator, class Predicate>
+    inline iterator parallel_partition(iterator first, iterator last, Predicate pred, std::vector<typename std::iterator_traits<iterator>::value_type>& scratch, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        return parallel_partition(first, last, grain_size, pred, scratch, tp);
+    }
+
+    template<class iterator, class Predicate>
+    inline iterator parallel_partition(iterator first, iterator last, Predicate pred, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        return parallel_partition(first, last, grain_size, pred, tp);
+    }
+
+    // Rows x cols block of a 2D index space, e.g. a tile of an image.
+    struct range2d {
+        range rows;
+        range cols;
+
+        range2d(range rows, range cols) : rows(rows), cols(cols) {}
+
+        int height() const {
+            return rows.size();
+        }
+
+        int width() const {
+            return cols.size();
+        }
+
+        // Grows the block by a halo on each side, clamped to bounds. Stencil kernels read
+        // from tile.inflate(radius, radius, whole) while writing only to tile.
+        range2d inflate(int halo_y, int halo_x, const range2d& bounds) const {
+            return range2d(range(std::max(rows.begin_ - halo_y, bounds.rows.begin_), std::min(rows.end_ + halo_y, bounds.rows.end_)),
+                range(std::max(cols.begin_ - halo_x, bounds.cols.begin_), std::min(cols.end_ + halo_x, bounds.cols.end_)));
+        }
+    };
+
+    namespace detail {
+        // About half of a typical per-core L2, the rest is left for the output and the halo
+        constexpr size_t tile_cache_bytes = 128 * 1024;
+        constexpr size_t min_tile_bytes = 16 * 1024;
+
+        inline void auto_tile_size(int height, int width, size_t element_size, int num_threads, int& tile_h, int& tile_w) {
+            const int line = std::max<int>(int(64 / element_size), 1);
+            const int area = std::max<int>(int(tile_cache_bytes / element_size), line);
+            const int min_area = std::max<int>(int(min_tile_bytes / element_size), 1);
+
+            // Wide tiles keep rows contiguous for the prefetcher, at least 8 rows amortise the halo
+            tile_w = std::max(std::min(width, area / 8 / line * line), 1);
+            tile_h = std::clamp(area / tile_w, 1, std::max(height, 1));
+
+            auto tiles = [&] { return int64_t(height + tile_h - 1) / tile_h * ((width + tile_w - 1) / tile_w); };
+
+            // A few tiles per thread for load balancing, unless they get too small to pay for scheduling
+            while (tiles() < 4 * num_threads && tile_h * tile_w / 2 >= min_area) {
+                // One row of at most a cache line can't be cut any further
+                if (tile_h == 1 && tile_w <= line)
+                    break;
+
+                if (tile_h > 8 || tile_w <= line)
+                    tile_h = (tile_h + 1) / 2;
+                else
+                    tile_w = (tile_w / 2 + line - 1) / line * line;
+            }
+        }
+    };
+
+    // Cuts r into tile_h x tile_w tiles and calls f(range2d tile) for each in parallel.
+    // Tiles are numbered row-major, so a task gets neighbouring tiles of the same tile rows.
+    template<class F>
+    inline void parallel_for_2d(range2d r, int tile_h, int tile_w, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(tile_h > 0 && tile_w > 0);
+
+        if (r.height() == 0 || r.width() == 0)
+            return;
+
+        const int tiles_y = (r.height() + tile_h - 1) / tile_h;
+        const int tiles_x = (r.width() + tile_w - 1) / tile_w;
+
+        auto tile = [&](int k) {
+            const int y = r.rows.begin_ + k / tiles_x * tile_h;
+            const int x = r.cols.begin_ + k % tiles_x * tile_w;
+            return range2d(range(y, std::min(y + tile_h, r.rows.end_)), range(x, std::min(x + tile_w, r.cols.end_)));
+        };
+
+        // Not worth a trip through the pool
+        if (tiles_y * tiles_x == 1) {
+            f(tile(0));
+            return;
+        }
+
+        parallel_for(range(tiles_y * tiles_x), [&](range ks) {
+            for (int k : ks)
+                f(tile(k));
         }, tp);
     }
 
+    // Tile shape picked from the element size: about tile_cache_bytes per tile, as wide as possible.
+    template<class F>
+    inline void parallel_for_2d(range2d r, size_t element_size, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        int tile_h, tile_w;
+        detail::auto_tile_size(r.height(), r.width(), element_size, tp.get_num_threads(), tile_h, tile_w);
+        parallel_for_2d(r, tile_h, tile_w, f, tp);
+    }
+
+    // Zero tile_h or tile_w means picking the tile shape automatically from sizeof(T).
+    template<class T, class F>
+    inline void parallel_for_2d(const matrix_ref<T>& m, int tile_h, int tile_w, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        const range2d r(range(m.height()), range(m.width()));
+
+        if (tile_h > 0 && tile_w > 0)
+            parallel_for_2d(r, tile_h, tile_w, f, tp);
+        else
+            parallel_for_2d(r, sizeof(T), f, tp);
+    }
+
+    template<class T, class F>
+    inline void parallel_for_2d(const matrix_ref<T>& m, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        parallel_for_2d(m, 0, 0, f, tp);
+    }
+
     template<class... F>
     inline void parallel_invoke(F&&... f) {
         thread_pool::get_default_pool().parallel_invoke(f...);
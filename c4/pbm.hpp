@@ -60,9 +60,11 @@ namespace c4 {
         ss >> w >> h >> maxval;
         ASSERT_EQUAL(maxval, 255);
 
-        out.resize(h, w);
+        out.resize_for_overwrite(h, w);
+        // resize_for_overwrite leaves the pixels uninitialized, so a short read is an error
         for(int i : range(h)) {
-            in.read((char*)out[i], w * 3);
+            if (!in.read((char*)out[i], w * 3))
+                THROW_EXCEPTION("PbmReader truncated pixel data");
         }
     }
 
@@ -81,9 +83,11 @@ namespace c4 {
         ss >> w >> h >> maxval;
         ASSERT_EQUAL(maxval, 255);
 
-        out.resize(h, w);
+        out.resize_for_overwrite(h, w);
+        // resize_for_overwrite leaves the pixels uninitialized, so a short read is an error
         for (int i : range(h)) {
-            in.read((char*)out[i], w);
+            if (!in.read((char*)out[i], w))
+                THROW_EXCEPTION("PbmReader truncated pixel data");
         }
     }
 
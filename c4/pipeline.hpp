@@ -0,0 +1,333 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#pragma once
+
+#include <mutex>
+#include <tuple>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <variant>
+#include <utility>
+#include <exception>
+#include <type_traits>
+
+#include "parallel.hpp"
+
+namespace c4 {
+    enum class StageMode {
+        SerialInOrder,  // one item at a time, in the order the input stage produced them
+        Parallel        // any number of items at once
+    };
+
+    template<class F>
+    struct pipeline_stage {
+        StageMode mode;
+        F f;
+    };
+
+    template<class F>
+    pipeline_stage<F> serial_stage(F f) {
+        return { StageMode::SerialInOrder, std::move(f) };
+    }
+
+    template<class F>
+    pipeline_stage<F> parallel_stage(F f) {
+        return { StageMode::Parallel, std::move(f) };
+    }
+
+    // Passed to the input stage, which calls stop() instead of producing an item once it runs out.
+    class flow_control {
+        bool stopped = false;
+
+    public:
+        void stop() {
+            stopped = true;
+        }
+
+        bool is_stopped() const {
+            return stopped;
+        }
+    };
+
+    namespace detail {
+        // Output types of stages Fs... when the first of them takes In, except for the last one, which is dropped
+        template<class In, class... Fs>
+        struct stage_outputs;
+
+        template<class In, class F>
+        struct stage_outputs<In, F> {
+            typedef std::tuple<> type;
+        };
+
+        template<class In, class F, class... Fs>
+        struct stage_outputs<In, F, Fs...> {
+            typedef std::decay_t<std::invoke_result_t<F&, In>> out;
+            typedef decltype(std::tuple_cat(std::declval<std::tuple<out>>(), std::declval<typename stage_outputs<out&&, Fs...>::type>())) type;
+        };
+
+        template<class Tuple>
+        struct pipeline_item;
+
+        // Index i + 1 holds the output of stage i
+        template<class... Ts>
+        struct pipeline_item<std::tuple<Ts...>> {
+            typedef std::variant<std::monostate, Ts...> type;
+        };
+
+        template<class F0, class... Fs>
+        class pipeline_runner {
+            static constexpr size_t num_stages = sizeof...(Fs) + 1;
+
+            typedef typename stage_outputs<flow_control&, F0, Fs...>::type outputs;
+
+            struct token {
+                size_t seq = 0;
+                int slot = 0;
+                typename pipeline_item<outputs>::type data;
+            };
+
+            // Tokens waiting for their turn at a serial stage. At most max_tokens are in flight
+            // and the ones behind a serial stage can't overtake it, so seq % max_tokens never collides.
+            struct serial_state {
+                std::mutex mu;
+                size_t next = 0;
+                std::vector<token*> parked;
+            };
+
+            thread_pool& tp;
+            const size_t max_tokens;
+            std::tuple<pipeline_stage<F0>, pipeline_stage<Fs>...> stages;
+
+            std::vector<token> tokens;
+            std::unique_ptr<serial_state[]> serial;
+
+            std::mutex mu;
+            std::vector<int> free_slots;
+            size_t in_flight = 0;
+            size_t next_seq = 0;
+            bool input_running = false;
+            bool stopped = false;
+
+            std::atomic<bool> failed = false;
+            std::mutex error_mu;
+            std::exception_ptr error;
+
+            completion_latch latch{ 1 };
+
+            void set_error() {
+                std::lock_guard<std::mutex> lock(error_mu);
+                if (!error)
+                    error = std::current_exception();
+
+                failed = true;
+            }
+
+            // Takes a free token for the next input, if the input stage is idle and the limit allows. Called under mu.
+            int acquire_input_slot() {
+                if (stopped || input_running || in_flight == max_tokens || failed)
+                    return -1;
+
+                input_running = true;
+                in_flight++;
+
+                const int slot = free_slots.back();
+                free_slots.pop_back();
+                return slot;
+            }
+
+            void spawn_input(int slot) {
+                if (slot != -1)
+                    tp.submit([this, slot] { run_input(tokens[slot]); });
+            }
+
+            // Returns true if that was the last token and the pipeline is done. Called under mu.
+            bool release(token& t) {
+                t.data.template emplace<0>();
+                free_slots.push_back(t.slot);
+                in_flight--;
+
+                return (stopped || failed) && in_flight == 0 && !input_running;
+            }
+
+            void run_input(token& t) {
+                flow_control fc;
+                bool produced = false;
+
+                if (!failed) {
+                    try {
+                        t.data.template emplace<1>(std::get<0>(stages).f(fc));
+                        produced = !fc.is_stopped();
+                    }
+                    catch (...) {
+                        set_error();
+                    }
+                }
+
+                int slot = -1;
+                bool done = false;
+                {
+                    std::lock_guard<std::mutex> lock(mu);
+                    input_running = false;
+
+                    if (produced) {
+                        t.seq = next_seq++;
+                        slot = acquire_input_slot();
+                    }
+                    else {
+                        stopped = true;
+                        done = release(t);
+                    }
+                }
+
+                // the latch may be gone as soon as it's counted down, so that's the last thing to touch this
+                if (done) {
+                    latch.count_down();
+                    return;
+                }
+
+                if (produced) {
+                    spawn_input(slot);
+                    run_from<1>(t);
+                }
+            }
+
+            template<size_t I>
+            void invoke(token& t) {
+                if (failed)
+                    return;
+
+                try {
+                    auto& f = std::get<I>(stages).f;
+                    auto&& in = std::get<I>(t.data);
+
+                    if constexpr (I + 1 == num_stages)
+                        f(std::move(in));
+                    else
+                        t.data.template emplace<I + 1>(f(std::move(in)));
+                }
+                catch (...) {
+                    set_error();
+                }
+            }
+
+            // Runs t through stages I, I + 1, ... on the calling thread until it's done or has to wait at a serial stage.
+            template<size_t I>
+            void run_from(token& t) {
+                if constexpr (I == num_stages) {
+                    int slot = -1;
+                    bool done = false;
+                    {
+                        std::lock_guard<std::mutex> lock(mu);
+                        done = release(t);
+                        slot = acquire_input_slot();
+                    }
+
+                    if (done)
+                        latch.count_down();
+                    else
+                        spawn_input(slot);
+                }
+                else {
+                    if (std::get<I>(stages).mode == StageMode::SerialInOrder) {
+                        serial_state& s = serial[I];
+                        {
+                            std::lock_guard<std::mutex> lock(s.mu);
+                            if (t.seq != s.next) {
+                                s.parked[t.seq % max_tokens] = &t;
+                                return;
+                            }
+                        }
+
+                        invoke<I>(t);
+
+                        token* n = nullptr;
+                        {
+                            std::lock_guard<std::mutex> lock(s.mu);
+                            token*& p = s.parked[++s.next % max_tokens];
+                            if (p != nullptr && p->seq == s.next)
+                                std::swap(n, p);
+                        }
+
+                        if (n != nullptr)
+                            tp.submit([this, n] { run_from<I>(*n); });
+                    }
+                    else {
+                        invoke<I>(t);
+                    }
+
+                    run_from<I + 1>(t);
+                }
+            }
+
+        public:
+            pipeline_runner(thread_pool& tp, size_t max_tokens, pipeline_stage<F0>&& input, pipeline_stage<Fs>&&... stages)
+                : tp(tp), max_tokens(std::max<size_t>(max_tokens, 1)), stages(std::move(input), std::move(stages)...)
+                , tokens(this->max_tokens), serial(new serial_state[num_stages]) {
+                for (size_t i = 0; i < this->max_tokens; i++) {
+                    tokens[i].slot = int(i);
+                    free_slots.push_back(int(this->max_tokens - 1 - i));
+                }
+
+                for (size_t i = 0; i < num_stages; i++)
+                    serial[i].parked.resize(this->max_tokens);
+            }
+
+            void run() {
+                int slot;
+                {
+                    std::lock_guard<std::mutex> lock(mu);
+                    slot = acquire_input_slot();
+                }
+
+                spawn_input(slot);
+
+                tp.wait(latch);
+
+                if (error)
+                    std::rethrow_exception(error);
+            }
+        };
+    };
+
+    // Streams items through the stages on tp, with at most max_tokens of them in flight at a time:
+    //     parallel_pipeline(tp, 8,
+    //         serial_stage([&](flow_control& fc) -> T0 { ... fc.stop(); ... }),
+    //         parallel_stage([](T0 x) -> T1 { ... }),
+    //         serial_stage([&](T1 y) { ... }));
+    // The first stage produces the items and always runs serially. Each next stage takes the output of the previous one,
+    // whatever the last one returns is dropped. Serial stages see the items in the input order, so they may keep state.
+    // After an exception no new items are read, the rest are drained and the first exception is rethrown.
+    template<class F0, class... Fs>
+    inline void parallel_pipeline(thread_pool& tp, size_t max_tokens, pipeline_stage<F0> input, pipeline_stage<Fs>... stages) {
+        static_assert(sizeof...(Fs) > 0, "parallel_pipeline needs at least one stage after the input");
+
+        detail::pipeline_runner<F0, Fs...> runner(tp, max_tokens, std::move(input), std::move(stages)...);
+        runner.run();
+    }
+
+    template<class F0, class... Fs>
+    inline void parallel_pipeline(size_t max_tokens, pipeline_stage<F0> input, pipeline_stage<Fs>... stages) {
+        parallel_pipeline(thread_pool::get_default_pool(), max_tokens, std::move(input), std::move(stages)...);
+    }
+};
@@ -23,6 +23,7 @@
 #pragma once
 
 #include <c4/matrix.hpp>
+#include <c4/parallel.hpp>
 
 namespace c4 {
 	template<typename PixelT>
@@ -36,23 +37,25 @@ namespace c4 {
 		const float rw2 = abs(w2 * cs) + abs(h2 * sn);
 		const float rh2 = abs(h2 * cs) + abs(w2 * sn);
 
-        for (int i : c4::range(dst.height())) {
-            for (int j : c4::range(dst.width())) {
-				int i0 = top + i;
-				int j0 = left + j;
+		c4::parallel_for_2d(dst, [&](c4::range2d tile) {
+			for (int i : tile.rows) {
+				for (int j : tile.cols) {
+					int i0 = top + i;
+					int j0 = left + j;
 
-				float di0 = i0 - rh2;
-				float dj0 = j0 - rw2;
+					float di0 = i0 - rh2;
+					float dj0 = j0 - rw2;
 
-				float dir0f = sn * dj0 + cs * di0;
-				float djr0f = cs * dj0 - sn * di0;
+					float dir0f = sn * dj0 + cs * di0;
+					float djr0f = cs * dj0 - sn * di0;
 
-				int ir0 = int(h2 + dir0f + 0.5f);
-				int jr0 = int(w2 + djr0f + 0.5f);
+					int ir0 = int(h2 + dir0f + 0.5f);
+					int jr0 = int(w2 + djr0f + 0.5f);
 
-				dst[i][j] = src.clamp_get(ir0, jr0);
+					dst[i][j] = src.clamp_get(ir0, jr0);
+				}
 			}
-		}
+		});
 	}
 
 	template<typename PixelT>
@@ -66,29 +69,31 @@ namespace c4 {
 		const float rw2 = abs(w2 * cs) + abs(h2 * sn);
 		const float rh2 = abs(h2 * cs) + abs(w2 * sn);
 
-        for (int i : c4::range(dst.height())) {
-            for (int j : c4::range(dst.width())) {
-				int i0 = top + i;
-				int j0 = left + j;
+		c4::parallel_for_2d(dst, [&](c4::range2d tile) {
+			for (int i : tile.rows) {
+				for (int j : tile.cols) {
+					int i0 = top + i;
+					int j0 = left + j;
 
-				float di0 = i0 - rh2;
-				float dj0 = j0 - rw2;
+					float di0 = i0 - rh2;
+					float dj0 = j0 - rw2;
 
-				float dir0f = sn * dj0 + cs * di0;
-				float djr0f = cs * dj0 - sn * di0;
+					float dir0f = sn * dj0 + cs * di0;
+					float djr0f = cs * dj0 - sn * di0;
 
-				float ir0f = h2 + dir0f;
-				float jr0f = w2 + djr0f;
+					float ir0f = h2 + dir0f;
+					float jr0f = w2 + djr0f;
 
-				int ir0 = int(ir0f);
-				int jr0 = int(jr0f);
+					int ir0 = int(ir0f);
+					int jr0 = int(jr0f);
 
-				float mir0 = ir0f - ir0;
-				float mjr0 = jr0f - jr0;
+					float mir0 = ir0f - ir0;
+					float mjr0 = jr0f - jr0;
 
-				dst[i][j] = PixelT((src.clamp_get(ir0, jr0) * (1 - mir0) + src.clamp_get(ir0 + 1, jr0) * mir0) * (1 - mjr0)
-								+ (src.clamp_get(ir0, jr0 + 1) * (1 - mir0) + src.clamp_get(ir0 + 1, jr0 + 1) * mir0) * mjr0);
+					dst[i][j] = PixelT((src.clamp_get(ir0, jr0) * (1 - mir0) + src.clamp_get(ir0 + 1, jr0) * mir0) * (1 - mjr0)
+									+ (src.clamp_get(ir0, jr0 + 1) * (1 - mir0) + src.clamp_get(ir0 + 1, jr0 + 1) * mir0) * mjr0);
+				}
 			}
-		}
+		});
 	}
 };
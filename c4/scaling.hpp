@@ -25,6 +25,7 @@
 #include "simd.hpp"
 #include "range.hpp"
 #include "matrix.hpp"
+#include "parallel.hpp"
 #include "pixel.hpp"
 #include "logger.hpp"
 #include "exception.hpp"
@@ -80,31 +81,33 @@ namespace c4 {
             std::vector<float> dj0v;
             calc_bilinear_scaling_indexes(dst.width(), src.width(), qw, j0v, j1v, dj0v);
 
-            for (int i : range(dst.height())) {
-                int i0 = i0v[i];
-                int i1 = i1v[i];
-                float di0 = di0v[i];
+            parallel_for_2d(dst, [&](range2d tile) {
+                for (int i : tile.rows) {
+                    int i0 = i0v[i];
+                    int i1 = i1v[i];
+                    float di0 = di0v[i];
 
-                const src_pixel_t* psrc0 = src[i0];
-                const src_pixel_t* psrc1 = src[i1];
+                    const src_pixel_t* psrc0 = src[i0];
+                    const src_pixel_t* psrc1 = src[i1];
 
-                dst_pixel_t* pdst = dst[i];
+                    dst_pixel_t* pdst = dst[i];
 
-                for (int j : range(dst.width())) {
-                    int j0 = j0v[j];
-                    int j1 = j1v[j];
-                    float dj0 = dj0v[j];
+                    for (int j : tile.cols) {
+                        int j0 = j0v[j];
+                        int j1 = j1v[j];
+                        float dj0 = dj0v[j];
 
-                    decltype(src_pixel_t() * 1.f) p(0);
+                        decltype(src_pixel_t() * 1.f) p(0);
 
-                    p += psrc0[j0] * ((1.f - di0) * (1.f - dj0));
-                    p += psrc0[j1] * ((1.f - di0) * dj0);
-                    p += psrc1[j0] * (di0 * (1.f - dj0));
-                    p += psrc1[j1] * (di0 * dj0);
+                        p += psrc0[j0] * ((1.f - di0) * (1.f - dj0));
+                        p += psrc0[j1] * ((1.f - di0) * dj0);
+                        p += psrc1[j0] * (di0 * (1.f - dj0));
+                        p += psrc1[j1] * (di0 * dj0);
 
-                    pdst[j] = dst_pixel_t(p);
+                        pdst[j] = dst_pixel_t(p);
+                    }
                 }
-            }
+            });
         }
 
         template<typename src_pixel_t, typename dst_pixel_t>
@@ -123,31 +126,33 @@ namespace c4 {
             std::vector<c4::fixed_point<int, shift> > dj0v;
             calc_bilinear_scaling_indexes(dst.width(), src.width(), qw, j0v, j1v, dj0v);
 
-            for (int i : range(dst.height())) {
-                int i0 = i0v[i];
-                int i1 = i1v[i];
-                int di0 = di0v[i].base;
+            parallel_for_2d(dst, [&](range2d tile) {
+                for (int i : tile.rows) {
+                    int i0 = i0v[i];
+                    int i1 = i1v[i];
+                    int di0 = di0v[i].base;
 
-                const auto* psrc0 = src[i0].data();
-                const auto* psrc1 = src[i1].data();
+                    const auto* psrc0 = src[i0].data();
+                    const auto* psrc1 = src[i1].data();
 
-                auto* pdst = dst[i].data();
+                    auto* pdst = dst[i].data();
 
-                for (int j : range(dst.width())) {
-                    int j0 = j0v[j];
-                    int j1 = j1v[j];
-                    int dj0 = dj0v[j].base;
+                    for (int j : tile.cols) {
+                        int j0 = j0v[j];
+                        int j1 = j1v[j];
+                        int dj0 = dj0v[j].base;
 
-                    decltype(src_pixel_t() + src_pixel_t()) p(0);
+                        decltype(src_pixel_t() + src_pixel_t()) p(0);
 
-                    p = p + psrc0[j0] * ((one - di0) * (one - dj0));
-                    p = p + psrc0[j1] * ((one - di0) * dj0);
-                    p = p + psrc1[j0] * (di0 * (one - dj0));
-                    p = p + psrc1[j1] * (di0 * dj0);
+                        p = p + psrc0[j0] * ((one - di0) * (one - dj0));
+                        p = p + psrc0[j1] * ((one - di0) * dj0);
+                        p = p + psrc1[j0] * (di0 * (one - dj0));
+                        p = p + psrc1[j1] * (di0 * dj0);
 
-                    pdst[j] = dst_pixel_t(p >> 2 * shift);
+                        pdst[j] = dst_pixel_t(p >> 2 * shift);
+                    }
                 }
-            }
+            });
         }
     };
 
@@ -168,7 +173,7 @@ namespace c4 {
 
     template<typename src_pixel_t, typename dst_pixel_t>
     inline void downscale_nx(const c4::matrix_ref<src_pixel_t>& src, c4::matrix<dst_pixel_t>& dst, int n){
-        dst.resize(src.height() / n, src.width() / n);
+        dst.resize_for_overwrite(src.height() / n, src.width() / n);
 
         float normalizer = 1.f / (n * n);
 
@@ -194,7 +199,7 @@ namespace c4 {
         int height2 = src.height() / 2;
         int width2 = src.width() / 2;
 
-        dst.resize(height2, width2);
+        dst.resize_for_overwrite(height2, width2);
 
         for(int i : range(height2)) {
             const uint8_t* psrc0 = src[2 * i + 0];
@@ -227,7 +232,7 @@ namespace c4 {
         int height2 = src.height() / 3;
         int width2 = src.width() / 3;
 
-        dst.resize(height2, width2);
+        dst.resize_for_overwrite(height2, width2);
 
         for(int i : range(height2)) {
             const uint8_t* psrc0 = src[3 * i + 0];
@@ -274,7 +279,7 @@ namespace c4 {
         int height2 = src.height() / 4;
         int width2 = src.width() / 4;
 
-        dst.resize(height2, width2);
+        dst.resize_for_overwrite(height2, width2);
 
         for(int i : range(height2)) {
             const uint8_t* psrc0 = src[4 * i + 0];
@@ -340,7 +345,7 @@ namespace c4 {
         int height2 = src.height() / 2;
         int width2 = src.width() / 2;
 
-        dst.resize(height2, width2);
+        dst.resize_for_overwrite(height2, width2);
 
         for(int i : range(height2)) {
             const uint8_t* psrc = src[2 * i + 0];
@@ -367,7 +372,7 @@ namespace c4 {
         int height2 = src.height() / 2;
         int width2 = src.width() / 2;
 
-        dst.resize(height2, width2);
+        dst.resize_for_overwrite(height2, width2);
 
         for(int i : range(height2)) {
             const uint8_t* psrc0 = (const uint8_t*)src[2 * i + 0];
@@ -405,7 +410,7 @@ namespace c4 {
         int height2 = src.height() / 2;
         int width2 = src.width() / 2;
 
-        dst.resize(height2, width2);
+        dst.resize_for_overwrite(height2, width2);
 
         for(int i : range(height2)) {
             const uint8_t* psrc = (const uint8_t*)src[2 * i];
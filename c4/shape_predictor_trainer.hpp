@@ -80,7 +80,8 @@ namespace c4 {
             std::vector<c4::point<float>> sum;
         };
 
-        void train(const std::vector<c4::matrix<uint8_t>>& images, const std::vector<c4::image_file_metadata>& objects, const std::vector<c4::matrix<uint8_t>>& testImages, const std::vector<c4::image_file_metadata>& testObjects) {
+        // Stops after the current tree if ct gets cancelled
+        void train(const std::vector<c4::matrix<uint8_t>>& images, const std::vector<c4::image_file_metadata>& objects, const std::vector<c4::matrix<uint8_t>>& testImages, const std::vector<c4::image_file_metadata>& testObjects, const c4::cancellation_token& ct = c4::cancellation_token::none()) {
             c4::scoped_timer timer("ShapePredictorTrainer::train");
 
             using namespace impl;
@@ -101,6 +102,9 @@ namespace c4 {
 
             std::vector<impl::regression_tree> forests;
 
+            // Every split of every tree moves its samples through this, so it is allocated once
+            std::vector<training_sample> partition_scratch;
+
             std::vector<std::string> stats;
 
             auto loss_str = [&](const shape_predictor& sp) {
@@ -113,7 +117,7 @@ namespace c4 {
             std::cout << loss_str(shape_predictor(initial_shape, forests)) << std::endl;
 
             float lambda = lambda0;
-            while(c4::isize(forests) < num_trees) {
+            while(c4::isize(forests) < num_trees && !ct.cancelled()) {
                 impl::regression_tree tree;
 
                 const int num_split_nodes = (1 << tree_depth) - 1;
@@ -132,9 +136,9 @@ namespace c4 {
 
                     for (int j : c4::range(begin, end)) {
                         const auto& rj = ranges_and_sums[j].r;
-                        int mid = int(std::partition(samples.begin() + rj.begin_, samples.begin() + rj.end_, [&](const training_sample& s) {
+                        int mid = int(c4::parallel_partition(samples.begin() + rj.begin_, samples.begin() + rj.end_, [&](const training_sample& s) {
                             return split.evaluate(images[s.image_idx], s.current_shape, s.tform_to_img);
-                        }) - samples.begin());
+                        }, partition_scratch) - samples.begin());
 
                         ranges_and_sums[left_child(j)].r.begin_ = rj.begin_;
                         ranges_and_sums[left_child(j)].r.end_ = mid;
@@ -255,7 +259,7 @@ namespace c4 {
                     }
                 }
 
-                std::sort(f.begin(), f.end(), [](std::tuple<float, int, int> a, std::tuple<float, int, int> b) {return std::get<0>(a) > std::get<0>(b); });
+                c4::parallel_sort(f.begin(), f.end(), [](std::tuple<float, int, int> a, std::tuple<float, int, int> b) {return std::get<0>(a) > std::get<0>(b); });
 
                 for (int l : c4::range(c4::isize(f) - 1)) {
                     const int k = std::get<1>(f[l]);
@@ -3722,6 +3722,40 @@ namespace c4 {
 #endif
         }
 
+        // Lane moves
+
+        // Moves lane i to lane i + n, lanes below n become zero
+        template<int n>
+        inline uint32x4 shift_lanes_up(uint32x4 a) {
+            static_assert(0 < n && n < 4, "");
+#ifdef USE_ARM_NEON
+            return vextq_u32(vdupq_n_u32(0), a.v, 4 - n);
+#else
+            return _mm_slli_si128(a.v, 4 * n);
+#endif
+        }
+
+        template<int n>
+        inline int32x4 shift_lanes_up(int32x4 a) {
+            return reinterpret_signed(shift_lanes_up<n>(reinterpret_unsigned(a)));
+        }
+
+        // Lane i in every lane
+        template<int i>
+        inline uint32x4 broadcast_lane(uint32x4 a) {
+            static_assert(0 <= i && i < 4, "");
+#ifdef USE_ARM_NEON
+            return vdupq_n_u32(vgetq_lane_u32(a.v, i));
+#else
+            return _mm_shuffle_epi32(a.v, i * 0x55);
+#endif
+        }
+
+        template<int i>
+        inline int32x4 broadcast_lane(int32x4 a) {
+            return reinterpret_signed(broadcast_lane<i>(reinterpret_unsigned(a)));
+        }
+
         // Shifts
 
         // Shift left by a constant
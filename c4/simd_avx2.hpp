@@ -0,0 +1,1027 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+
+#pragma once
+
+#include "simd.hpp"
+
+// 256-bit AVX2 registers with the operations of the 128-bit ones, in c4::simd::avx2.
+// They are compiled for AVX2 whatever the compiler flags are, so the same binary runs on any x86:
+// a kernel built on them must be a C4_TARGET_AVX2 function (not a lambda), and must only be called
+// when avx2::is_supported(), with the 128-bit code as the fallback. Define C4_NO_AVX2 to leave them out.
+
+#if defined(USE_SSE) && !defined(C4_NO_AVX2) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define __C4_AVX2__
+#endif
+
+#ifdef __C4_AVX2__
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define C4_TARGET_AVX2
+#else
+#define C4_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace c4 {
+    namespace simd {
+        namespace avx2 {
+            struct int8x32 {
+                typedef int8_t base_t;
+                int8x32() = default;
+                __m256i v;
+                C4_TARGET_AVX2 explicit int8x32(int8_t x) : v(_mm256_set1_epi8(x)) {}
+                C4_TARGET_AVX2 int8x32(__m256i v) : v(v) {}
+            };
+
+            struct uint8x32 {
+                typedef uint8_t base_t;
+                uint8x32() = default;
+                __m256i v;
+                C4_TARGET_AVX2 explicit uint8x32(uint8_t x) : v(_mm256_set1_epi8(x)) {}
+                C4_TARGET_AVX2 uint8x32(__m256i v) : v(v) {}
+            };
+
+            struct int16x16 {
+                typedef int16_t base_t;
+                int16x16() = default;
+                __m256i v;
+                C4_TARGET_AVX2 explicit int16x16(int16_t x) : v(_mm256_set1_epi16(x)) {}
+                C4_TARGET_AVX2 int16x16(__m256i v) : v(v) {}
+            };
+
+            struct uint16x16 {
+                typedef uint16_t base_t;
+                uint16x16() = default;
+                __m256i v;
+                C4_TARGET_AVX2 explicit uint16x16(uint16_t x) : v(_mm256_set1_epi16(x)) {}
+                C4_TARGET_AVX2 uint16x16(__m256i v) : v(v) {}
+            };
+
+            struct int32x8 {
+                typedef int32_t base_t;
+                int32x8() = default;
+                __m256i v;
+                C4_TARGET_AVX2 explicit int32x8(int32_t x) : v(_mm256_set1_epi32(x)) {}
+                C4_TARGET_AVX2 int32x8(__m256i v) : v(v) {}
+            };
+
+            struct uint32x8 {
+                typedef uint32_t base_t;
+                uint32x8() = default;
+                __m256i v;
+                C4_TARGET_AVX2 explicit uint32x8(uint32_t x) : v(_mm256_set1_epi32(x)) {}
+                C4_TARGET_AVX2 uint32x8(__m256i v) : v(v) {}
+            };
+
+            struct float32x8 {
+                typedef float base_t;
+                float32x8() = default;
+                __m256 v;
+                C4_TARGET_AVX2 explicit float32x8(float x) : v(_mm256_set1_ps(x)) {}
+                C4_TARGET_AVX2 float32x8(__m256 v) : v(v) {}
+            };
+        };
+
+        namespace traits {
+            template<>
+            struct is_simd<avx2::int8x32> : std::true_type {};
+            template<>
+            struct is_simd<avx2::uint8x32> : std::true_type {};
+            template<>
+            struct is_simd<avx2::int16x16> : std::true_type {};
+            template<>
+            struct is_simd<avx2::uint16x16> : std::true_type {};
+            template<>
+            struct is_simd<avx2::int32x8> : std::true_type {};
+            template<>
+            struct is_simd<avx2::uint32x8> : std::true_type {};
+            template<>
+            struct is_simd<avx2::float32x8> : std::true_type {};
+
+            template<>
+            struct is_integral<avx2::int8x32> : std::true_type {};
+            template<>
+            struct is_integral<avx2::uint8x32> : std::true_type {};
+            template<>
+            struct is_integral<avx2::int16x16> : std::true_type {};
+            template<>
+            struct is_integral<avx2::uint16x16> : std::true_type {};
+            template<>
+            struct is_integral<avx2::int32x8> : std::true_type {};
+            template<>
+            struct is_integral<avx2::uint32x8> : std::true_type {};
+
+            template<>
+            struct is_signed<avx2::int8x32> : std::true_type {};
+            template<>
+            struct is_signed<avx2::int16x16> : std::true_type {};
+            template<>
+            struct is_signed<avx2::int32x8> : std::true_type {};
+            template<>
+            struct is_signed<avx2::float32x8> : std::true_type {};
+        };
+
+        namespace avx2 {
+            typedef tuple<int8x32, 2> int8x32x2;
+            typedef tuple<uint8x32, 2> uint8x32x2;
+            typedef tuple<int16x16, 2> int16x16x2;
+            typedef tuple<uint16x16, 2> uint16x16x2;
+            typedef tuple<int32x8, 2> int32x8x2;
+            typedef tuple<uint32x8, 2> uint32x8x2;
+            typedef tuple<float32x8, 2> float32x8x2;
+
+            namespace detail {
+                inline bool cpu_has_avx2() {
+#ifdef _MSC_VER
+                    int info[4];
+                    __cpuid(info, 0);
+                    if (info[0] < 7)
+                        return false;
+
+                    // the OS must save the ymm registers too
+                    __cpuid(info, 1);
+                    const bool osxsave = (info[2] & (1 << 27)) != 0;
+                    if (!osxsave || (_xgetbv(0) & 6) != 6)
+                        return false;
+
+                    __cpuidex(info, 7, 0);
+                    return (info[1] & (1 << 5)) != 0;
+#else
+                    __builtin_cpu_init();
+                    return __builtin_cpu_supports("avx2");
+#endif
+                }
+
+                template<class T>
+                using is_256 = std::integral_constant<bool, traits::is_simd<T>::value && sizeof(T) == 32>;
+            };
+
+            // Checked once, cheap enough to call per block
+            inline bool is_supported() {
+#ifdef __AVX2__
+                return true;
+#else
+                static const bool supported = detail::cpu_has_avx2();
+                return supported;
+#endif
+            }
+
+            // Reinterpret
+            C4_TARGET_AVX2 inline int8x32 reinterpret_signed(uint8x32 a) {
+                return a.v;
+            }
+
+            C4_TARGET_AVX2 inline int16x16 reinterpret_signed(uint16x16 a) {
+                return a.v;
+            }
+
+            C4_TARGET_AVX2 inline int32x8 reinterpret_signed(uint32x8 a) {
+                return a.v;
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 reinterpret_unsigned(int8x32 a) {
+                return a.v;
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 reinterpret_unsigned(int16x16 a) {
+                return a.v;
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 reinterpret_unsigned(int32x8 a) {
+                return a.v;
+            }
+
+            // The generic tuple functions of c4::simd are not compiled for AVX2, so pairs get their own overloads
+            C4_TARGET_AVX2 inline int8x32x2 reinterpret_signed(uint8x32x2 a) {
+                return { a.val[0].v, a.val[1].v };
+            }
+
+            C4_TARGET_AVX2 inline int16x16x2 reinterpret_signed(uint16x16x2 a) {
+                return { a.val[0].v, a.val[1].v };
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 reinterpret_signed(uint32x8x2 a) {
+                return { a.val[0].v, a.val[1].v };
+            }
+
+            C4_TARGET_AVX2 inline uint8x32x2 reinterpret_unsigned(int8x32x2 a) {
+                return { a.val[0].v, a.val[1].v };
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 reinterpret_unsigned(int16x16x2 a) {
+                return { a.val[0].v, a.val[1].v };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 reinterpret_unsigned(int32x8x2 a) {
+                return { a.val[0].v, a.val[1].v };
+            }
+
+            // Zero
+            template<class T, class = typename std::enable_if<traits::is_integral<T>::value && detail::is_256<T>::value>::type>
+            C4_TARGET_AVX2 inline T set_zero() {
+                return T(_mm256_setzero_si256());
+            }
+
+            C4_TARGET_AVX2 inline float32x8 set_zero_float() {
+                return _mm256_setzero_ps();
+            }
+
+            // Load
+            C4_TARGET_AVX2 inline int8x32 load(const int8_t* ptr) {
+                return _mm256_loadu_si256((const __m256i*)ptr);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 load(const uint8_t* ptr) {
+                return _mm256_loadu_si256((const __m256i*)ptr);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 load(const int16_t* ptr) {
+                return _mm256_loadu_si256((const __m256i*)ptr);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 load(const uint16_t* ptr) {
+                return _mm256_loadu_si256((const __m256i*)ptr);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 load(const int32_t* ptr) {
+                return _mm256_loadu_si256((const __m256i*)ptr);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 load(const uint32_t* ptr) {
+                return _mm256_loadu_si256((const __m256i*)ptr);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 load(const float* ptr) {
+                return _mm256_loadu_ps(ptr);
+            }
+
+            // Store
+            C4_TARGET_AVX2 inline void store(int8_t* ptr, int8x32 a) {
+                _mm256_storeu_si256((__m256i*)ptr, a.v);
+            }
+
+            C4_TARGET_AVX2 inline void store(uint8_t* ptr, uint8x32 a) {
+                _mm256_storeu_si256((__m256i*)ptr, a.v);
+            }
+
+            C4_TARGET_AVX2 inline void store(int16_t* ptr, int16x16 a) {
+                _mm256_storeu_si256((__m256i*)ptr, a.v);
+            }
+
+            C4_TARGET_AVX2 inline void store(uint16_t* ptr, uint16x16 a) {
+                _mm256_storeu_si256((__m256i*)ptr, a.v);
+            }
+
+            C4_TARGET_AVX2 inline void store(int32_t* ptr, int32x8 a) {
+                _mm256_storeu_si256((__m256i*)ptr, a.v);
+            }
+
+            C4_TARGET_AVX2 inline void store(uint32_t* ptr, uint32x8 a) {
+                _mm256_storeu_si256((__m256i*)ptr, a.v);
+            }
+
+            C4_TARGET_AVX2 inline void store(float* ptr, float32x8 a) {
+                _mm256_storeu_ps(ptr, a.v);
+            }
+
+            // Get low and get high 128-bit halves, combine two of them
+            C4_TARGET_AVX2 inline int8x16 get_low(int8x32 a) {
+                return _mm256_castsi256_si128(a.v);
+            }
+
+            C4_TARGET_AVX2 inline uint8x16 get_low(uint8x32 a) {
+                return _mm256_castsi256_si128(a.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x8 get_low(int16x16 a) {
+                return _mm256_castsi256_si128(a.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x8 get_low(uint16x16 a) {
+                return _mm256_castsi256_si128(a.v);
+            }
+
+            C4_TARGET_AVX2 inline int32x4 get_low(int32x8 a) {
+                return _mm256_castsi256_si128(a.v);
+            }
+
+            C4_TARGET_AVX2 inline uint32x4 get_low(uint32x8 a) {
+                return _mm256_castsi256_si128(a.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x4 get_low(float32x8 a) {
+                return _mm256_castps256_ps128(a.v);
+            }
+
+            C4_TARGET_AVX2 inline int8x16 get_high(int8x32 a) {
+                return _mm256_extracti128_si256(a.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline uint8x16 get_high(uint8x32 a) {
+                return _mm256_extracti128_si256(a.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline int16x8 get_high(int16x16 a) {
+                return _mm256_extracti128_si256(a.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline uint16x8 get_high(uint16x16 a) {
+                return _mm256_extracti128_si256(a.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline int32x4 get_high(int32x8 a) {
+                return _mm256_extracti128_si256(a.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline uint32x4 get_high(uint32x8 a) {
+                return _mm256_extracti128_si256(a.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline float32x4 get_high(float32x8 a) {
+                return _mm256_extractf128_ps(a.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline int8x32 combine(int8x16 lo, int8x16 hi) {
+                return _mm256_inserti128_si256(_mm256_castsi128_si256(lo.v), hi.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 combine(uint8x16 lo, uint8x16 hi) {
+                return _mm256_inserti128_si256(_mm256_castsi128_si256(lo.v), hi.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 combine(int16x8 lo, int16x8 hi) {
+                return _mm256_inserti128_si256(_mm256_castsi128_si256(lo.v), hi.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 combine(uint16x8 lo, uint16x8 hi) {
+                return _mm256_inserti128_si256(_mm256_castsi128_si256(lo.v), hi.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 combine(int32x4 lo, int32x4 hi) {
+                return _mm256_inserti128_si256(_mm256_castsi128_si256(lo.v), hi.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 combine(uint32x4 lo, uint32x4 hi) {
+                return _mm256_inserti128_si256(_mm256_castsi128_si256(lo.v), hi.v, 1);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 combine(float32x4 lo, float32x4 hi) {
+                return _mm256_insertf128_ps(_mm256_castps128_ps256(lo.v), hi.v, 1);
+            }
+
+            // Interleave
+            // Unpacks work within 128-bit lanes, so the lanes are put back in order afterwards
+            C4_TARGET_AVX2 inline int8x32x2 interleave(int8x32x2 p) {
+                __m256i lo = _mm256_unpacklo_epi8(p.val[0].v, p.val[1].v);
+                __m256i hi = _mm256_unpackhi_epi8(p.val[0].v, p.val[1].v);
+                return { _mm256_permute2x128_si256(lo, hi, 0x20), _mm256_permute2x128_si256(lo, hi, 0x31) };
+            }
+
+            C4_TARGET_AVX2 inline uint8x32x2 interleave(uint8x32x2 p) {
+                return reinterpret_unsigned(interleave(reinterpret_signed(p)));
+            }
+
+            C4_TARGET_AVX2 inline int16x16x2 interleave(int16x16x2 p) {
+                __m256i lo = _mm256_unpacklo_epi16(p.val[0].v, p.val[1].v);
+                __m256i hi = _mm256_unpackhi_epi16(p.val[0].v, p.val[1].v);
+                return { _mm256_permute2x128_si256(lo, hi, 0x20), _mm256_permute2x128_si256(lo, hi, 0x31) };
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 interleave(uint16x16x2 p) {
+                return reinterpret_unsigned(interleave(reinterpret_signed(p)));
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 interleave(int32x8x2 p) {
+                __m256i lo = _mm256_unpacklo_epi32(p.val[0].v, p.val[1].v);
+                __m256i hi = _mm256_unpackhi_epi32(p.val[0].v, p.val[1].v);
+                return { _mm256_permute2x128_si256(lo, hi, 0x20), _mm256_permute2x128_si256(lo, hi, 0x31) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 interleave(uint32x8x2 p) {
+                return reinterpret_unsigned(interleave(reinterpret_signed(p)));
+            }
+
+            C4_TARGET_AVX2 inline float32x8x2 interleave(float32x8x2 p) {
+                __m256 lo = _mm256_unpacklo_ps(p.val[0].v, p.val[1].v);
+                __m256 hi = _mm256_unpackhi_ps(p.val[0].v, p.val[1].v);
+                return { _mm256_permute2f128_ps(lo, hi, 0x20), _mm256_permute2f128_ps(lo, hi, 0x31) };
+            }
+
+            // Deinterleave
+            C4_TARGET_AVX2 inline int8x32x2 deinterleave(int8x32x2 p) {
+                const __m256i mask = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+                                                      0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+
+                __m256i x0 = _mm256_shuffle_epi8(p.val[0].v, mask);     // a0..a7, b0..b7 | a8..a15, b8..b15
+                __m256i x1 = _mm256_shuffle_epi8(p.val[1].v, mask);     // a16..a23, b16..b23 | a24..a31, b24..b31
+
+                x0 = _mm256_permute4x64_epi64(x0, 0xD8);                // a0..a15 | b0..b15
+                x1 = _mm256_permute4x64_epi64(x1, 0xD8);                // a16..a31 | b16..b31
+
+                return { _mm256_permute2x128_si256(x0, x1, 0x20), _mm256_permute2x128_si256(x0, x1, 0x31) };
+            }
+
+            C4_TARGET_AVX2 inline uint8x32x2 deinterleave(uint8x32x2 p) {
+                return reinterpret_unsigned(deinterleave(reinterpret_signed(p)));
+            }
+
+            C4_TARGET_AVX2 inline int16x16x2 deinterleave(int16x16x2 p) {
+                const __m256i mask = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15,
+                                                      0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+
+                __m256i x0 = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(p.val[0].v, mask), 0xD8);
+                __m256i x1 = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(p.val[1].v, mask), 0xD8);
+
+                return { _mm256_permute2x128_si256(x0, x1, 0x20), _mm256_permute2x128_si256(x0, x1, 0x31) };
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 deinterleave(uint16x16x2 p) {
+                return reinterpret_unsigned(deinterleave(reinterpret_signed(p)));
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 deinterleave(int32x8x2 p) {
+                const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+                __m256i x0 = _mm256_permutevar8x32_epi32(p.val[0].v, idx);
+                __m256i x1 = _mm256_permutevar8x32_epi32(p.val[1].v, idx);
+
+                return { _mm256_permute2x128_si256(x0, x1, 0x20), _mm256_permute2x128_si256(x0, x1, 0x31) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 deinterleave(uint32x8x2 p) {
+                return reinterpret_unsigned(deinterleave(reinterpret_signed(p)));
+            }
+
+            C4_TARGET_AVX2 inline float32x8x2 deinterleave(float32x8x2 p) {
+                const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+                __m256 x0 = _mm256_permutevar8x32_ps(p.val[0].v, idx);
+                __m256 x1 = _mm256_permutevar8x32_ps(p.val[1].v, idx);
+
+                return { _mm256_permute2f128_ps(x0, x1, 0x20), _mm256_permute2f128_ps(x0, x1, 0x31) };
+            }
+
+            // Load two elements that are interleaved
+            C4_TARGET_AVX2 inline int8x32x2 load_2_interleaved(const int8_t* ptr) {
+                return deinterleave(int8x32x2{ load(ptr), load(ptr + 32) });
+            }
+
+            C4_TARGET_AVX2 inline uint8x32x2 load_2_interleaved(const uint8_t* ptr) {
+                return deinterleave(uint8x32x2{ load(ptr), load(ptr + 32) });
+            }
+
+            C4_TARGET_AVX2 inline int16x16x2 load_2_interleaved(const int16_t* ptr) {
+                return deinterleave(int16x16x2{ load(ptr), load(ptr + 16) });
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 load_2_interleaved(const uint16_t* ptr) {
+                return deinterleave(uint16x16x2{ load(ptr), load(ptr + 16) });
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 load_2_interleaved(const int32_t* ptr) {
+                return deinterleave(int32x8x2{ load(ptr), load(ptr + 8) });
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 load_2_interleaved(const uint32_t* ptr) {
+                return deinterleave(uint32x8x2{ load(ptr), load(ptr + 8) });
+            }
+
+            C4_TARGET_AVX2 inline float32x8x2 load_2_interleaved(const float* ptr) {
+                return deinterleave(float32x8x2{ load(ptr), load(ptr + 8) });
+            }
+
+            // Long move, narrow
+            C4_TARGET_AVX2 inline int16x16x2 long_move(int8x32 a) {
+                return { _mm256_cvtepi8_epi16(_mm256_castsi256_si128(a.v)), _mm256_cvtepi8_epi16(_mm256_extracti128_si256(a.v, 1)) };
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 long_move(uint8x32 a) {
+                return { _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a.v)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a.v, 1)) };
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 long_move(int16x16 a) {
+                return { _mm256_cvtepi16_epi32(_mm256_castsi256_si128(a.v)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(a.v, 1)) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 long_move(uint16x16 a) {
+                return { _mm256_cvtepu16_epi32(_mm256_castsi256_si128(a.v)), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(a.v, 1)) };
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 narrow(uint16x16x2 p) {
+                const __m256i mask = _mm256_set1_epi16(0xFF);
+                __m256i r = _mm256_packus_epi16(_mm256_and_si256(p.val[0].v, mask), _mm256_and_si256(p.val[1].v, mask));
+                return _mm256_permute4x64_epi64(r, 0xD8);
+            }
+
+            C4_TARGET_AVX2 inline int8x32 narrow(int16x16x2 p) {
+                return reinterpret_signed(narrow(reinterpret_unsigned(p)));
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 narrow(uint32x8x2 p) {
+                const __m256i mask = _mm256_set1_epi32(0xFFFF);
+                __m256i r = _mm256_packus_epi32(_mm256_and_si256(p.val[0].v, mask), _mm256_and_si256(p.val[1].v, mask));
+                return _mm256_permute4x64_epi64(r, 0xD8);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 narrow(int32x8x2 p) {
+                return reinterpret_signed(narrow(reinterpret_unsigned(p)));
+            }
+
+            C4_TARGET_AVX2 inline int8x32 narrow_saturate(int16x16x2 p) {
+                return _mm256_permute4x64_epi64(_mm256_packs_epi16(p.val[0].v, p.val[1].v), 0xD8);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 narrow_unsigned_saturate(int16x16x2 p) {
+                return _mm256_permute4x64_epi64(_mm256_packus_epi16(p.val[0].v, p.val[1].v), 0xD8);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 narrow_saturate(int32x8x2 p) {
+                return _mm256_permute4x64_epi64(_mm256_packs_epi32(p.val[0].v, p.val[1].v), 0xD8);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 narrow_unsigned_saturate(int32x8x2 p) {
+                return _mm256_permute4x64_epi64(_mm256_packus_epi32(p.val[0].v, p.val[1].v), 0xD8);
+            }
+
+            // Addition
+            C4_TARGET_AVX2 inline int8x32 add(int8x32 a, int8x32 b) {
+                return _mm256_add_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 add(uint8x32 a, uint8x32 b) {
+                return _mm256_add_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 add(int16x16 a, int16x16 b) {
+                return _mm256_add_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 add(uint16x16 a, uint16x16 b) {
+                return _mm256_add_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 add(int32x8 a, int32x8 b) {
+                return _mm256_add_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 add(uint32x8 a, uint32x8 b) {
+                return _mm256_add_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 add(float32x8 a, float32x8 b) {
+                return _mm256_add_ps(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16x2 add(int16x16x2 a, int16x16x2 b) {
+                return { add(a.val[0], b.val[0]), add(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 add(uint16x16x2 a, uint16x16x2 b) {
+                return { add(a.val[0], b.val[0]), add(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 add(int32x8x2 a, int32x8x2 b) {
+                return { add(a.val[0], b.val[0]), add(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 add(uint32x8x2 a, uint32x8x2 b) {
+                return { add(a.val[0], b.val[0]), add(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline float32x8x2 add(float32x8x2 a, float32x8x2 b) {
+                return { add(a.val[0], b.val[0]), add(a.val[1], b.val[1]) };
+            }
+
+            // Add with saturation
+            C4_TARGET_AVX2 inline int8x32 add_saturate(int8x32 a, int8x32 b) {
+                return _mm256_adds_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 add_saturate(uint8x32 a, uint8x32 b) {
+                return _mm256_adds_epu8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 add_saturate(int16x16 a, int16x16 b) {
+                return _mm256_adds_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 add_saturate(uint16x16 a, uint16x16 b) {
+                return _mm256_adds_epu16(a.v, b.v);
+            }
+
+            // Subtraction
+            C4_TARGET_AVX2 inline int8x32 sub(int8x32 a, int8x32 b) {
+                return _mm256_sub_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 sub(uint8x32 a, uint8x32 b) {
+                return _mm256_sub_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 sub(int16x16 a, int16x16 b) {
+                return _mm256_sub_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 sub(uint16x16 a, uint16x16 b) {
+                return _mm256_sub_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 sub(int32x8 a, int32x8 b) {
+                return _mm256_sub_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 sub(uint32x8 a, uint32x8 b) {
+                return _mm256_sub_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 sub(float32x8 a, float32x8 b) {
+                return _mm256_sub_ps(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16x2 sub(int16x16x2 a, int16x16x2 b) {
+                return { sub(a.val[0], b.val[0]), sub(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 sub(uint16x16x2 a, uint16x16x2 b) {
+                return { sub(a.val[0], b.val[0]), sub(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 sub(int32x8x2 a, int32x8x2 b) {
+                return { sub(a.val[0], b.val[0]), sub(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 sub(uint32x8x2 a, uint32x8x2 b) {
+                return { sub(a.val[0], b.val[0]), sub(a.val[1], b.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline float32x8x2 sub(float32x8x2 a, float32x8x2 b) {
+                return { sub(a.val[0], b.val[0]), sub(a.val[1], b.val[1]) };
+            }
+
+            // Saturating subtraction
+            C4_TARGET_AVX2 inline int8x32 sub_saturate(int8x32 a, int8x32 b) {
+                return _mm256_subs_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 sub_saturate(uint8x32 a, uint8x32 b) {
+                return _mm256_subs_epu8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 sub_saturate(int16x16 a, int16x16 b) {
+                return _mm256_subs_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 sub_saturate(uint16x16 a, uint16x16 b) {
+                return _mm256_subs_epu16(a.v, b.v);
+            }
+
+            // Absolute difference
+            C4_TARGET_AVX2 inline uint8x32 abs_diff(uint8x32 a, uint8x32 b) {
+                return _mm256_or_si256(_mm256_subs_epu8(a.v, b.v), _mm256_subs_epu8(b.v, a.v));
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 abs_diff(uint16x16 a, uint16x16 b) {
+                return _mm256_or_si256(_mm256_subs_epu16(a.v, b.v), _mm256_subs_epu16(b.v, a.v));
+            }
+
+            // r[2k] = |a[8k] - b[8k]| + ... + |a[8k + 7] - b[8k + 7]|
+            // r[2k + 1] = 0
+            C4_TARGET_AVX2 inline uint32x8 sad(uint8x32 a, uint8x32 b) {
+                return _mm256_sad_epu8(a.v, b.v);
+            }
+
+            // useful after sad
+            C4_TARGET_AVX2 inline uint32_t sum0246(uint32x8 a) {
+                return sum02(add(get_low(a), get_high(a)));
+            }
+
+            // Minimum
+            C4_TARGET_AVX2 inline int8x32 min(int8x32 a, int8x32 b) {
+                return _mm256_min_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 min(uint8x32 a, uint8x32 b) {
+                return _mm256_min_epu8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 min(int16x16 a, int16x16 b) {
+                return _mm256_min_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 min(uint16x16 a, uint16x16 b) {
+                return _mm256_min_epu16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 min(int32x8 a, int32x8 b) {
+                return _mm256_min_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 min(uint32x8 a, uint32x8 b) {
+                return _mm256_min_epu32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 min(float32x8 a, float32x8 b) {
+                return _mm256_min_ps(a.v, b.v);
+            }
+
+            // Maximum
+            C4_TARGET_AVX2 inline int8x32 max(int8x32 a, int8x32 b) {
+                return _mm256_max_epi8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 max(uint8x32 a, uint8x32 b) {
+                return _mm256_max_epu8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 max(int16x16 a, int16x16 b) {
+                return _mm256_max_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 max(uint16x16 a, uint16x16 b) {
+                return _mm256_max_epu16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 max(int32x8 a, int32x8 b) {
+                return _mm256_max_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 max(uint32x8 a, uint32x8 b) {
+                return _mm256_max_epu32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 max(float32x8 a, float32x8 b) {
+                return _mm256_max_ps(a.v, b.v);
+            }
+
+            // Average, rounding up
+            C4_TARGET_AVX2 inline uint8x32 avg(uint8x32 a, uint8x32 b) {
+                return _mm256_avg_epu8(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 avg(uint16x16 a, uint16x16 b) {
+                return _mm256_avg_epu16(a.v, b.v);
+            }
+
+            // Shift by a constant
+            template<int n>
+            C4_TARGET_AVX2 inline int16x16 shift_left(int16x16 a) {
+                return _mm256_slli_epi16(a.v, n);
+            }
+
+            template<int n>
+            C4_TARGET_AVX2 inline uint16x16 shift_left(uint16x16 a) {
+                return _mm256_slli_epi16(a.v, n);
+            }
+
+            template<int n>
+            C4_TARGET_AVX2 inline int32x8 shift_left(int32x8 a) {
+                return _mm256_slli_epi32(a.v, n);
+            }
+
+            template<int n>
+            C4_TARGET_AVX2 inline uint32x8 shift_left(uint32x8 a) {
+                return _mm256_slli_epi32(a.v, n);
+            }
+
+            template<int n>
+            C4_TARGET_AVX2 inline int16x16 shift_right(int16x16 a) {
+                return _mm256_srai_epi16(a.v, n);
+            }
+
+            template<int n>
+            C4_TARGET_AVX2 inline uint16x16 shift_right(uint16x16 a) {
+                return _mm256_srli_epi16(a.v, n);
+            }
+
+            template<int n>
+            C4_TARGET_AVX2 inline int32x8 shift_right(int32x8 a) {
+                return _mm256_srai_epi32(a.v, n);
+            }
+
+            template<int n>
+            C4_TARGET_AVX2 inline uint32x8 shift_right(uint32x8 a) {
+                return _mm256_srli_epi32(a.v, n);
+            }
+
+            // Multiplication
+            C4_TARGET_AVX2 inline int16x16 mul_lo(int16x16 a, int16x16 b) {
+                return _mm256_mullo_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 mul_lo(uint16x16 a, uint16x16 b) {
+                return _mm256_mullo_epi16(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 mul_lo(int32x8 a, int32x8 b) {
+                return _mm256_mullo_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 mul_lo(uint32x8 a, uint32x8 b) {
+                return _mm256_mullo_epi32(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 mul(float32x8 a, float32x8 b) {
+                return _mm256_mul_ps(a.v, b.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x8x2 mul(float32x8x2 a, float32x8 b) {
+                return { mul(a.val[0], b), mul(a.val[1], b) };
+            }
+
+            C4_TARGET_AVX2 inline int16x16x2 mul_long(int8x32 a, int8x32 b) {
+                int16x16x2 ap = long_move(a);
+                int16x16x2 bp = long_move(b);
+
+                return { mul_lo(ap.val[0], bp.val[0]), mul_lo(ap.val[1], bp.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline uint16x16x2 mul_long(uint8x32 a, uint8x32 b) {
+                uint16x16x2 ap = long_move(a);
+                uint16x16x2 bp = long_move(b);
+
+                return { mul_lo(ap.val[0], bp.val[0]), mul_lo(ap.val[1], bp.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 mul_long(int16x16 a, int16x16 b) {
+                __m256i lo = _mm256_mullo_epi16(a.v, b.v);
+                __m256i hi = _mm256_mulhi_epi16(a.v, b.v);
+
+                __m256i r0 = _mm256_unpacklo_epi16(lo, hi);             // 0..3 | 8..11
+                __m256i r1 = _mm256_unpackhi_epi16(lo, hi);             // 4..7 | 12..15
+
+                return { _mm256_permute2x128_si256(r0, r1, 0x20), _mm256_permute2x128_si256(r0, r1, 0x31) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 mul_long(uint16x16 a, uint16x16 b) {
+                __m256i lo = _mm256_mullo_epi16(a.v, b.v);
+                __m256i hi = _mm256_mulhi_epu16(a.v, b.v);
+
+                __m256i r0 = _mm256_unpacklo_epi16(lo, hi);
+                __m256i r1 = _mm256_unpackhi_epi16(lo, hi);
+
+                return { _mm256_permute2x128_si256(r0, r1, 0x20), _mm256_permute2x128_si256(r0, r1, 0x31) };
+            }
+
+            // Widening that stays within the 128-bit lanes, which saves the permutes when the results are only summed up:
+            // val[0] holds elements 0..3 and 8..11, val[1] holds 4..7 and 12..15
+            C4_TARGET_AVX2 inline int32x8x2 long_move_in_lanes(int16x16 a) {
+                __m256i sign = _mm256_srai_epi16(a.v, 15);
+                return { _mm256_unpacklo_epi16(a.v, sign), _mm256_unpackhi_epi16(a.v, sign) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 long_move_in_lanes(uint16x16 a) {
+                return { _mm256_unpacklo_epi16(a.v, _mm256_setzero_si256()), _mm256_unpackhi_epi16(a.v, _mm256_setzero_si256()) };
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 mul_long_in_lanes(int16x16 a, int16x16 b) {
+                __m256i lo = _mm256_mullo_epi16(a.v, b.v);
+                __m256i hi = _mm256_mulhi_epi16(a.v, b.v);
+                return { _mm256_unpacklo_epi16(lo, hi), _mm256_unpackhi_epi16(lo, hi) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x8x2 mul_long_in_lanes(uint16x16 a, uint16x16 b) {
+                __m256i lo = _mm256_mullo_epi16(a.v, b.v);
+                __m256i hi = _mm256_mulhi_epu16(a.v, b.v);
+                return { _mm256_unpacklo_epi16(lo, hi), _mm256_unpackhi_epi16(lo, hi) };
+            }
+
+            // Elements 0..7 and 8..15 of a pair in that order
+            C4_TARGET_AVX2 inline int32x4x2 get_low_in_lanes(int32x8x2 p) {
+                return { get_low(p.val[0]), get_low(p.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x4x2 get_low_in_lanes(uint32x8x2 p) {
+                return { get_low(p.val[0]), get_low(p.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline int32x4x2 get_high_in_lanes(int32x8x2 p) {
+                return { get_high(p.val[0]), get_high(p.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline uint32x4x2 get_high_in_lanes(uint32x8x2 p) {
+                return { get_high(p.val[0]), get_high(p.val[1]) };
+            }
+
+            // Multiply accumulate: r = s + a * b
+            // Not fused, so the results are the same as with the 128-bit registers
+            C4_TARGET_AVX2 inline int16x16 mul_acc(int16x16 s, int16x16 a, int16x16 b) {
+                return add(s, mul_lo(a, b));
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 mul_acc(uint16x16 s, uint16x16 a, uint16x16 b) {
+                return add(s, mul_lo(a, b));
+            }
+
+            C4_TARGET_AVX2 inline int32x8 mul_acc(int32x8 s, int32x8 a, int32x8 b) {
+                return add(s, mul_lo(a, b));
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 mul_acc(uint32x8 s, uint32x8 a, uint32x8 b) {
+                return add(s, mul_lo(a, b));
+            }
+
+            C4_TARGET_AVX2 inline float32x8 mul_acc(float32x8 s, float32x8 a, float32x8 b) {
+                return add(s, mul(a, b));
+            }
+
+            // Int <-> Float conversions
+            C4_TARGET_AVX2 inline float32x8 to_float(int32x8 a) {
+                return _mm256_cvtepi32_ps(a.v);
+            }
+
+            C4_TARGET_AVX2 inline float32x8x2 to_float(int32x8x2 a) {
+                return { to_float(a.val[0]), to_float(a.val[1]) };
+            }
+
+            C4_TARGET_AVX2 inline int32x8 to_int(float32x8 a) {
+                return _mm256_cvttps_epi32(a.v);
+            }
+
+            C4_TARGET_AVX2 inline int32x8x2 to_int(float32x8x2 a) {
+                return { to_int(a.val[0]), to_int(a.val[1]) };
+            }
+
+            // Basic operators, not templates so that they are preferred to the ones of c4::simd
+            C4_TARGET_AVX2 inline int8x32 operator+(int8x32 a, int8x32 b) {
+                return add(a, b);
+            }
+
+            C4_TARGET_AVX2 inline int8x32 operator-(int8x32 a, int8x32 b) {
+                return sub(a, b);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 operator+(uint8x32 a, uint8x32 b) {
+                return add(a, b);
+            }
+
+            C4_TARGET_AVX2 inline uint8x32 operator-(uint8x32 a, uint8x32 b) {
+                return sub(a, b);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 operator+(int16x16 a, int16x16 b) {
+                return add(a, b);
+            }
+
+            C4_TARGET_AVX2 inline int16x16 operator-(int16x16 a, int16x16 b) {
+                return sub(a, b);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 operator+(uint16x16 a, uint16x16 b) {
+                return add(a, b);
+            }
+
+            C4_TARGET_AVX2 inline uint16x16 operator-(uint16x16 a, uint16x16 b) {
+                return sub(a, b);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 operator+(int32x8 a, int32x8 b) {
+                return add(a, b);
+            }
+
+            C4_TARGET_AVX2 inline int32x8 operator-(int32x8 a, int32x8 b) {
+                return sub(a, b);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 operator+(uint32x8 a, uint32x8 b) {
+                return add(a, b);
+            }
+
+            C4_TARGET_AVX2 inline uint32x8 operator-(uint32x8 a, uint32x8 b) {
+                return sub(a, b);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 operator+(float32x8 a, float32x8 b) {
+                return add(a, b);
+            }
+
+            C4_TARGET_AVX2 inline float32x8 operator-(float32x8 a, float32x8 b) {
+                return sub(a, b);
+            }
+        };
+    }; // namespace simd
+}; // namespace c4
+
+#endif // __C4_AVX2__
@@ -0,0 +1,480 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#pragma once
+
+#include <mutex>
+#include <tuple>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cassert>
+#include <utility>
+#include <variant>
+#include <optional>
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+
+#include "parallel.hpp"
+
+namespace c4 {
+    template<class T = void>
+    class task;
+
+    namespace detail {
+        struct task_promise_base {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            // Symmetric transfer to whoever awaits us, so chains of tasks don't grow the stack
+            struct final_awaiter {
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                template<class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+                    std::coroutine_handle<> c = h.promise().continuation;
+                    return c ? c : std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            std::suspend_always initial_suspend() const noexcept {
+                return {};
+            }
+
+            final_awaiter final_suspend() const noexcept {
+                return {};
+            }
+
+            void unhandled_exception() noexcept {
+                error = std::current_exception();
+            }
+        };
+
+        template<class T>
+        struct task_promise : task_promise_base {
+            std::optional<T> value;
+
+            task<T> get_return_object() noexcept;
+
+            template<class U>
+            void return_value(U&& v) {
+                value.emplace(std::forward<U>(v));
+            }
+
+            T result() {
+                if (error)
+                    std::rethrow_exception(error);
+
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct task_promise<void> : task_promise_base {
+            task<void> get_return_object() noexcept;
+
+            void return_void() noexcept {}
+
+            void result() {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+        };
+    };
+
+    // Lazily started coroutine. The body runs when the task is awaited (co_await, sync_wait, when_all, when_any),
+    // on the awaiting thread, until it suspends on something like co_await tp.schedule().
+    template<class T>
+    class task {
+    public:
+        typedef detail::task_promise<T> promise_type;
+        typedef std::coroutine_handle<promise_type> handle_type;
+
+    private:
+        handle_type h;
+
+        struct awaiter_base {
+            handle_type h;
+
+            bool await_ready() const noexcept {
+                return h.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+                h.promise().continuation = c;
+                return h;
+            }
+        };
+
+    public:
+        task() = default;
+
+        explicit task(handle_type h) : h(h) {}
+
+        task(task&& other) noexcept : h(std::exchange(other.h, {})) {}
+
+        task& operator=(task&& other) noexcept {
+            if (this != &other) {
+                if (h)
+                    h.destroy();
+
+                h = std::exchange(other.h, {});
+            }
+
+            return *this;
+        }
+
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+
+        ~task() {
+            if (h)
+                h.destroy();
+        }
+
+        bool valid() const {
+            return (bool)h;
+        }
+
+        bool done() const {
+            return h && h.done();
+        }
+
+        auto operator co_await() const noexcept {
+            assert(h);
+
+            struct awaiter : awaiter_base {
+                T await_resume() {
+                    return this->h.promise().result();
+                }
+            };
+
+            return awaiter{ { h } };
+        }
+
+        // Completes with the task but leaves the result (or exception) to result()
+        auto when_ready() const noexcept {
+            assert(h);
+
+            struct awaiter : awaiter_base {
+                void await_resume() const noexcept {}
+            };
+
+            return awaiter{ { h } };
+        }
+
+        // The result of a finished task, rethrows its exception
+        T result() const {
+            assert(done());
+            return h.promise().result();
+        }
+    };
+
+    namespace detail {
+        template<class T>
+        inline task<T> task_promise<T>::get_return_object() noexcept {
+            return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+        }
+
+        inline task<void> task_promise<void>::get_return_object() noexcept {
+            return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+        }
+
+        // Starts right away and destroys itself at the end; used to drive tasks from non-coroutine code
+        struct detached_task {
+            struct promise_type {
+                detached_task get_return_object() const noexcept {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() const noexcept {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() const noexcept {
+                    return {};
+                }
+
+                void return_void() const noexcept {}
+
+                void unhandled_exception() const noexcept {
+                    std::terminate();
+                }
+            };
+        };
+
+        // Resumes the awaiting coroutine after n arrivals. The awaiter holds one more arrival until it
+        // has started everything, so a child that finishes synchronously can't resume it too early.
+        class arrival_counter {
+            std::atomic<size_t> count;
+            std::coroutine_handle<> continuation;
+
+        public:
+            explicit arrival_counter(size_t n) : count(n + 1) {}
+
+            void arrive() {
+                if (count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    continuation.resume();
+            }
+
+            template<class Start>
+            auto start(Start start_children) {
+                struct awaiter {
+                    arrival_counter& counter;
+                    Start start_children;
+
+                    bool await_ready() const noexcept {
+                        return false;
+                    }
+
+                    bool await_suspend(std::coroutine_handle<> h) {
+                        counter.continuation = h;
+                        start_children();
+                        return counter.count.fetch_sub(1, std::memory_order_acq_rel) != 1;
+                    }
+
+                    void await_resume() const noexcept {}
+                };
+
+                return awaiter{ *this, start_children };
+            }
+        };
+
+        template<class T>
+        inline detached_task start_and_arrive(task<T>& t, arrival_counter& counter) {
+            co_await t.when_ready();
+            counter.arrive();
+        }
+
+        template<class T>
+        inline detached_task start_and_count_down(task<T>& t, completion_latch& latch) {
+            co_await t.when_ready();
+            latch.count_down();
+        }
+
+        template<class T>
+        using when_all_value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+        template<class T>
+        inline when_all_value_t<T> when_all_result(task<T>& t) {
+            if constexpr (std::is_void_v<T>) {
+                t.result();
+                return {};
+            } else {
+                return t.result();
+            }
+        }
+    };
+
+    // Blocks the calling thread until t is done. Meant for main() and tests, not for pool workers.
+    template<class T>
+    inline T sync_wait(task<T> t) {
+        detail::completion_latch latch(1);
+        detail::start_and_count_down(t, latch);
+        latch.wait();
+        return t.result();
+    }
+
+    // Runs all tasks and completes when all of them are done; void results become std::monostate.
+    // Tasks are started one by one on the awaiting thread, so each should begin with co_await tp.schedule()
+    // to actually run concurrently. The first exception in argument order is rethrown.
+    template<class... Ts>
+    inline task<std::tuple<detail::when_all_value_t<Ts>...>> when_all(task<Ts>... tasks) {
+        detail::arrival_counter counter(sizeof...(Ts));
+        co_await counter.start([&] { (detail::start_and_arrive(tasks, counter), ...); });
+        co_return std::tuple<detail::when_all_value_t<Ts>...>{ detail::when_all_result(tasks)... };
+    }
+
+    template<class T>
+    inline task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+        detail::arrival_counter counter(tasks.size());
+        co_await counter.start([&] {
+            for (auto& t : tasks)
+                detail::start_and_arrive(t, counter);
+        });
+
+        std::vector<T> results;
+        results.reserve(tasks.size());
+        for (auto& t : tasks)
+            results.push_back(t.result());
+
+        co_return results;
+    }
+
+    inline task<void> when_all(std::vector<task<void>> tasks) {
+        detail::arrival_counter counter(tasks.size());
+        co_await counter.start([&] {
+            for (auto& t : tasks)
+                detail::start_and_arrive(t, counter);
+        });
+
+        for (auto& t : tasks)
+            t.result();
+    }
+
+    template<class T>
+    struct when_any_result {
+        size_t index;
+        T value;
+    };
+
+    template<>
+    struct when_any_result<void> {
+        size_t index;
+    };
+
+    namespace detail {
+        template<class T>
+        struct when_any_state {
+            std::vector<task<T>> tasks;
+            std::atomic<bool> decided = false;
+            size_t index = 0;
+            arrival_counter counter{ 1 };
+
+            explicit when_any_state(std::vector<task<T>>&& tasks) : tasks(std::move(tasks)) {}
+        };
+
+        // Holds the shared state, since the losers keep running after when_any has returned
+        template<class T>
+        inline detached_task start_when_any(std::shared_ptr<when_any_state<T>> s, size_t i) {
+            co_await s->tasks[i].when_ready();
+
+            if (!s->decided.exchange(true, std::memory_order_acq_rel)) {
+                s->index = i;
+                s->counter.arrive();
+            }
+        }
+    };
+
+    // Completes with the first task to finish (successfully or not). The other tasks are not cancelled:
+    // they run to completion in the background and their results are dropped.
+    template<class T>
+    inline task<when_any_result<T>> when_any(std::vector<task<T>> tasks) {
+        assert(!tasks.empty());
+
+        auto s = std::make_shared<detail::when_any_state<T>>(std::move(tasks));
+        co_await s->counter.start([&] {
+            for (size_t i : range(s->tasks.size()))
+                detail::start_when_any(s, i);
+        });
+
+        if constexpr (std::is_void_v<T>) {
+            s->tasks[s->index].result();
+            co_return when_any_result<T>{ s->index };
+        } else {
+            co_return when_any_result<T>{ s->index, s->tasks[s->index].result() };
+        }
+    }
+
+    template<class T, class... Ts>
+    inline task<when_any_result<T>> when_any(task<T> first, task<Ts>... rest) {
+        static_assert((std::is_same_v<T, Ts> && ...), "when_any() needs tasks of the same type");
+
+        std::vector<task<T>> tasks;
+        tasks.reserve(1 + sizeof...(Ts));
+        tasks.push_back(std::move(first));
+        (tasks.push_back(std::move(rest)), ...);
+
+        return when_any(std::move(tasks));
+    }
+
+    namespace detail {
+        // Submits the groups and suspends; the worker finishing the last group resumes the coroutine.
+        template<class iterator, class F>
+        class parallel_for_awaiter {
+            iterator first;
+            iterator last;
+            size_t grain_size;
+            F& f;
+            thread_pool& tp;
+
+            std::optional<arrival_counter> counter;
+            std::mutex error_mu;
+            std::exception_ptr error;
+
+        public:
+            parallel_for_awaiter(iterator first, iterator last, size_t grain_size, F& f, thread_pool& tp)
+                : first(first), last(last), grain_size(grain_size), f(f), tp(tp) {}
+
+            bool await_ready() const noexcept {
+                return first >= last;
+            }
+
+            bool await_suspend(std::coroutine_handle<> h) {
+                const group_split groups(last - first, grain_size);
+                counter.emplace(groups.size());
+
+                auto awaiter = counter->start([&] {
+                    for (size_t g : range(groups.size())) {
+                        tp.submit([this, group_first = first + groups.begin(g), group_last = first + groups.end(g)] {
+                            try {
+                                run_group(group_first, group_last, f);
+                            }
+                            catch (...) {
+                                std::lock_guard<std::mutex> lock(error_mu);
+                                if (!error)
+                                    error = std::current_exception();
+                            }
+
+                            counter->arrive();
+                        });
+                    }
+                });
+
+                return awaiter.await_suspend(h);
+            }
+
+            void await_resume() {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+        };
+    };
+
+    // parallel_for that suspends the awaiting coroutine instead of blocking a thread
+    template<class iterator, class F>
+    inline task<void> async_parallel_for(iterator first, iterator last, size_t grain_size, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        co_await detail::parallel_for_awaiter<iterator, F>(first, last, grain_size, f, tp);
+    }
+
+    template<class iterator, class F>
+    inline task<void> async_parallel_for(iterator first, iterator last, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        assert(first <= last);
+        const size_t grain_size = std::max<size_t>((last - first) / tp.get_num_threads(), 1);
+        return async_parallel_for(first, last, grain_size, std::move(f), tp);
+    }
+
+    template<class iterable, class F>
+    inline task<void> async_parallel_for(iterable c, size_t grain_size, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        return async_parallel_for(c.begin(), c.end(), grain_size, std::move(f), tp);
+    }
+
+    template<class iterable, class F>
+    inline task<void> async_parallel_for(iterable c, F f, thread_pool& tp = thread_pool::get_default_pool()) {
+        return async_parallel_for(c.begin(), c.end(), std::move(f), tp);
+    }
+};
@@ -0,0 +1,148 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <cassert>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+
+#include "parallel.hpp"
+
+namespace c4 {
+    // Static DAG of tasks: build once with add(), then run() as many times as needed.
+    // A node is handed to the pool as soon as all its dependencies are done.
+    class task_graph {
+    public:
+        typedef int node_id;
+
+    private:
+        struct node {
+            std::function<void()> f;
+            std::vector<node_id> successors;
+            int num_dependencies = 0;
+            std::atomic<int> pending = 0;
+
+            node(std::function<void()>&& f) : f(std::move(f)) {}
+        };
+
+        thread_pool& tp;
+        std::deque<node> nodes;
+        std::vector<node_id> roots;
+        detail::completion_latch latch;
+
+        std::mutex error_mu;
+        std::exception_ptr error;
+
+        void schedule(node_id i) {
+            tp.submit([this, i] { execute(i); });
+        }
+
+        void execute(node_id i) {
+            // One ready successor is run right here instead of going through the pool queue
+            while (i != -1) {
+                node& n = nodes[i];
+
+                try {
+                    n.f();
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mu);
+                    if (!error)
+                        error = std::current_exception();
+                }
+
+                node_id next = -1;
+                for (node_id s : n.successors) {
+                    if (nodes[s].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        if (next == -1)
+                            next = s;
+                        else
+                            schedule(s);
+                    }
+                }
+
+                latch.count_down();
+                i = next;
+            }
+        }
+
+    public:
+        task_graph(thread_pool& tp = thread_pool::get_default_pool()) : tp(tp) {}
+
+        task_graph(const task_graph&) = delete;
+        task_graph& operator=(const task_graph&) = delete;
+
+        // Dependencies must be added before their dependents, so the graph is acyclic by construction.
+        template<class F>
+        node_id add(F&& f, std::initializer_list<node_id> dependencies = {}) {
+            return add(std::forward<F>(f), std::vector<node_id>(dependencies));
+        }
+
+        template<class F>
+        node_id add(F&& f, const std::vector<node_id>& dependencies) {
+            const node_id id = size();
+            node& n = nodes.emplace_back(std::function<void()>(std::forward<F>(f)));
+
+            for (node_id d : dependencies) {
+                assert(0 <= d && d < id);
+                nodes[d].successors.push_back(id);
+                n.num_dependencies++;
+            }
+
+            if (n.num_dependencies == 0)
+                roots.push_back(id);
+
+            return id;
+        }
+
+        int size() const {
+            return isize(nodes);
+        }
+
+        // Runs every node once and waits for all of them; rethrows the first exception thrown by a node.
+        // Must not be called concurrently on the same graph.
+        void run() {
+            if (nodes.empty())
+                return;
+
+            for (node& n : nodes)
+                n.pending.store(n.num_dependencies, std::memory_order_relaxed);
+
+            latch.reset(size());
+            error = nullptr;
+
+            for (node_id i : roots)
+                schedule(i);
+
+            tp.wait(latch);
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+    };
+};
@@ -23,51 +23,199 @@
 #include <c4/lock_free_queue.hpp>
 #include <c4/parallel.hpp>
 
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
 using namespace std;
 using namespace c4;
 
 lock_free_queue<uint64_t, 1 << 20> q;
 
-int main(int argc, char* argv[]) {
-    try {
-        const int readStep = 10;
-        const int writeStep = 1000;
-        const uint64_t writeIterations = 1000000000ll;
-        const uint64_t readIterations = 2 * writeIterations;
-
-        uint64_t eta = 0;
-
-        auto Producer = [writeStep, writeIterations, &eta] {
-            scoped_timer t("Producer");
-            for (uint64_t i = 0; i < writeIterations; i++) {
-                if (i % writeStep == 0) {
-                    uint64_t x = i / writeStep;
-                    q.push(x);
-                    eta = eta * 13 + x;
-                }
+void spsc_benchmark() {
+    const int readStep = 10;
+    const int writeStep = 1000;
+    const uint64_t writeIterations = 1000000000ll;
+    const uint64_t readIterations = 2 * writeIterations;
+
+    uint64_t eta = 0;
+
+    auto Producer = [writeStep, writeIterations, &eta] {
+        scoped_timer t("Producer");
+        for (uint64_t i = 0; i < writeIterations; i++) {
+            if (i % writeStep == 0) {
+                uint64_t x = i / writeStep;
+                q.push(x);
+                eta = eta * 13 + x;
             }
-        };
+        }
+    };
 
-        uint64_t test = 0;
+    uint64_t test = 0;
 
-        auto Consumer = [readStep, readIterations, &test] {
-            scoped_timer t("Consumer");
-            for (uint64_t i = 0; i < readIterations; i++) {
-                if (i % readStep == 0 && !q.empty()) {
-                    test = test * 13 + q.pop_it();
-                }
+    auto Consumer = [readStep, readIterations, &test] {
+        scoped_timer t("Consumer");
+        uint64_t x;
+        for (uint64_t i = 0; i < readIterations; i++) {
+            if (i % readStep == 0 && q.try_pop(x)) {
+                test = test * 13 + x;
             }
-        };
+        }
+    };
+
+    scoped_timer t("total");
+    parallel_invoke(Producer, Consumer);
+
+    PRINT_DEBUG(eta);
+    PRINT_DEBUG(test);
+
+    if (eta != test) {
+        THROW_EXCEPTION("ETA != TEST");
+    }
+}
 
-        scoped_timer t("total");
-        parallel_invoke(Producer, Consumer);
+lock_free_queue<uint64_t, 1 << 10, true> bq;
+
+// An idle side sleeps in std::atomic::wait instead of burning a core
+void spsc_blocking_benchmark() {
+    const uint64_t n = 10000000;
+    uint64_t sum = 0;
+
+    scoped_timer t("spsc blocking", LOG_DEBUG);
+
+    std::thread consumer([n, &sum] {
+        for (uint64_t i = 0; i < n; i++)
+            sum += bq.pop_wait();
+    });
+
+    for (uint64_t x = 1; x <= n; x++)
+        bq.push_wait(x);
+
+    consumer.join();
+
+    if (sum != n * (n + 1) / 2) {
+        THROW_EXCEPTION("spsc blocking: checksum mismatch");
+    }
+}
+
+// Baseline the MPMC queue is measured against
+class mutex_queue {
+    std::mutex mu;
+    std::deque<uint64_t> d;
+
+public:
+    void push(uint64_t x) {
+        std::lock_guard<std::mutex> lock(mu);
+        d.push_back(x);
+    }
+
+    bool try_pop(uint64_t& x) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (d.empty())
+            return false;
+
+        x = d.front();
+        d.pop_front();
+        return true;
+    }
+};
 
-        PRINT_DEBUG(eta);
-        PRINT_DEBUG(test);
+// Every producer pushes 1..n, consumers pop until all of it is gone; the checksum must add up.
+// try_pop(out) pops up to batch_size elements and returns how many.
+const int batch_size = 64;
 
-        if (eta != test) {
-            THROW_EXCEPTION("ETA != TEST");
+template<class Produce, class TryPop>
+void mpmc_benchmark(const std::string& name, int producers, int consumers, uint64_t n, Produce produce, TryPop try_pop) {
+    const uint64_t total = producers * n;
+    std::atomic<uint64_t> popped = 0;
+    std::atomic<uint64_t> sum = 0;
+
+    {
+        scoped_timer t(name + " " + to_string(producers) + "x" + to_string(consumers), LOG_DEBUG);
+
+        std::vector<std::thread> threads;
+
+        for (int i = 0; i < consumers; i++) {
+            threads.emplace_back([&] {
+                uint64_t buf[batch_size];
+                uint64_t local_sum = 0;
+
+                while (popped.load(std::memory_order_relaxed) < total) {
+                    const uint32_t k = try_pop(buf);
+                    if (k == 0) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    for (uint32_t j = 0; j < k; j++)
+                        local_sum += buf[j];
+
+                    popped += k;
+                }
+
+                sum += local_sum;
+            });
         }
+
+        for (int i = 0; i < producers; i++)
+            threads.emplace_back([&] { produce(n); });
+
+        for (auto& t : threads)
+            t.join();
+    }
+
+    if (popped != total || sum != producers * (n * (n + 1) / 2)) {
+        THROW_EXCEPTION(name + ": checksum mismatch");
+    }
+}
+
+mutex_queue mu_q;
+mpmc_queue<uint64_t, 1 << 16> mq;
+
+int main(int argc, char* argv[]) {
+    try {
+        c4::Logger::setLogLevel(c4::LOG_DEBUG);
+
+        const int producers = argc > 1 ? std::stoi(argv[1]) : 4;
+        const int consumers = argc > 2 ? std::stoi(argv[2]) : 4;
+        const uint64_t n = 10000000 / producers;
+
+        spsc_benchmark();
+        spsc_blocking_benchmark();
+
+        mpmc_benchmark("mutex_queue", producers, consumers, n, [](uint64_t n) {
+            for (uint64_t x = 1; x <= n; x++)
+                mu_q.push(x);
+        }, [](uint64_t* out) {
+            return (uint32_t)mu_q.try_pop(*out);
+        });
+
+        mpmc_benchmark("mpmc_queue", producers, consumers, n, [](uint64_t n) {
+            for (uint64_t x = 1; x <= n; x++)
+                mq.push(x);
+        }, [](uint64_t* out) {
+            return (uint32_t)mq.try_pop(*out);
+        });
+
+        mpmc_benchmark("mpmc_queue batch", producers, consumers, n, [](uint64_t n) {
+            uint64_t buf[batch_size];
+
+            for (uint64_t x = 1; x <= n; ) {
+                uint32_t k = 0;
+                for (; k < batch_size && x <= n; k++, x++)
+                    buf[k] = x;
+
+                for (uint32_t pushed = 0; pushed < k; ) {
+                    const uint32_t m = mq.try_push_n(buf + pushed, k - pushed);
+                    if (m == 0)
+                        std::this_thread::yield();
+                    pushed += m;
+                }
+            }
+        }, [](uint64_t* out) {
+            return mq.try_pop_n(out, batch_size);
+        });
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -26,6 +26,7 @@
 #include <c4/drawing.hpp>
 #include <c4/string.hpp>
 #include <c4/image_dumper.hpp>
+#include <c4/task_graph.hpp>
 #include <c4/motion_detection.hpp>
 
 int main(int argc, char* argv[]) {
@@ -35,14 +36,10 @@ int main(int argc, char* argv[]) {
 
         c4::image_dumper::getInstance().init("", true);
 
-		c4::matrix<uint8_t> prev, cur;
-        c4::read_jpeg("img0.jpg", prev);
-        c4::read_jpeg("img1.jpg", cur);
-        //c4::read_jpeg("imgs/230.jpg", prev);
-        //c4::read_jpeg("imgs/231.jpg", cur);
-
-		//prev = prev.submatrix(192, 64, 192, 192);
-		//cur = cur.submatrix(192, 64, 192, 192);
+		const std::string prevPath = "img0.jpg";
+		const std::string curPath = "img1.jpg";
+		//const std::string prevPath = "imgs/230.jpg";
+		//const std::string curPath = "imgs/231.jpg";
 
         c4::MotionDetector md;
 		c4::MotionDetector::Params params;
@@ -52,22 +49,27 @@ int main(int argc, char* argv[]) {
 		const int downscale = 2;
 
 		std::vector<c4::rectangle<int>> ignore{{400, 900, 1120, 180}};
+		std::vector<c4::rectangle<int>> ignoreDown;
+		for (const auto& r : ignore) {
+			ignoreDown.emplace_back(r.x / downscale, r.y / downscale, r.w / downscale, r.h / downscale);
+		}
 
+		c4::matrix<uint8_t> prev, cur;
+		c4::matrix<uint8_t> prevDown, curDown;
 		c4::MotionDetector::Motion motion;
-		{
-			c4::matrix<uint8_t> prevDown;
-			c4::matrix<uint8_t> curDown;
 
-			c4::downscale_bilinear_nx(prev, prevDown, downscale);
-			c4::downscale_bilinear_nx(cur, curDown, downscale);
-
-			std::vector<c4::rectangle<int>> ignoreDown;
-			for (const auto& r : ignore) {
-				ignoreDown.emplace_back(r.x / downscale, r.y / downscale, r.w / downscale, r.h / downscale);
-			}
+		// decode and downscale of both frames are independent, detection waits for both
+		c4::task_graph graph;
+		auto readPrev = graph.add([&] { c4::read_jpeg(prevPath, prev); });
+		auto readCur = graph.add([&] { c4::read_jpeg(curPath, cur); });
+		auto downPrev = graph.add([&] { c4::downscale_bilinear_nx(prev, prevDown, downscale); }, { readPrev });
+		auto downCur = graph.add([&] { c4::downscale_bilinear_nx(cur, curDown, downscale); }, { readCur });
+		graph.add([&] {
 			motion = md.detect(prevDown, curDown, params, ignoreDown);
 			motion.shift = motion.shift * downscale;
-		}
+		}, { downPrev, downCur });
+
+		graph.run();
 
 		c4::matrix<uint8_t> cura(cur.dimensions());
 		motion.apply(cur, cura);
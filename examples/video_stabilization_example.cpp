@@ -21,11 +21,15 @@
 //SOFTWARE.
 
 #include <memory>
+#include <fstream>
+#include <sstream>
+#include <iterator>
 
 #include <c4/jpeg.hpp>
 #include <c4/drawing.hpp>
 #include <c4/string.hpp>
 #include <c4/image_dumper.hpp>
+#include <c4/pipeline.hpp>
 #include <c4/video_stabilization.hpp>
 
 int main(int argc, char* argv[]) {
@@ -48,39 +52,71 @@ int main(int argc, char* argv[]) {
 		params.x_smooth = 25;
 		params.y_smooth = 25;
 		c4::VideoStabilization vs(params);
-		c4::matrix<uint8_t> image;
 
-		char buf[1024];
+		struct Item {
+			int fc;
+			std::string jpeg;
+			c4::matrix<uint8_t> image;
+			c4::VideoStabilization::FramePtr frame;
+			c4::MotionDetector::Motion motion;
+		};
 
-		for (int fc = 1; ; fc++) {
-			try {
-				std::sprintf(buf, in_filemask.c_str(), fc);
-				c4::read_jpeg(buf, image);
-			} catch (const std::exception& e) {
-				LOGD_EXCEPTION(e);
-				break;
-			}
+		int fc = 0;
 
-			c4::VideoStabilization::FramePtr frame = std::make_shared<c4::VideoStabilization::Frame>();
+		// Frames of the same size come and go all the time, the pool keeps their memory for the next ones
+		c4::buffer_pool* pool = &c4::buffer_pool::get_default_pool();
 
-			c4::downscale_bilinear_nx(image, *frame, downscale);
+		// Reading files and stabilization are in order, decoding and encoding run on all cores
+		c4::parallel_pipeline(2 * c4::thread_pool::get_default_pool().get_num_threads(),
+			c4::serial_stage([&](c4::flow_control& flow) {
+				Item item;
+				item.fc = ++fc;
 
-			c4::MotionDetector::Motion motion = vs.process(frame, ignoreDown);
-			motion.shift = motion.shift * downscale;
+				char buf[1024];
+				std::sprintf(buf, in_filemask.c_str(), item.fc);
+				std::ifstream fin(buf, std::ifstream::binary);
 
-			c4::matrix<uint8_t> stabilized(image.dimensions());
-			
-			motion.apply(image, stabilized);
-				
-			c4::draw_string(stabilized, 20, 15, "frame " + c4::to_string(fc, 3), uint8_t(255), uint8_t(0), 2);
+				if (!fin) {
+					LOGD << "no more frames after " << buf;
+					flow.stop();
+					return item;
+				}
 
-			c4::draw_string(stabilized, 20, 45, "shift: " + c4::to_string(motion.shift.x, 2) + ", " + c4::to_string(motion.shift.y, 2)
-				+ ", scale: " + c4::to_string(motion.scale, 4)
-				+ ", alpha: " + c4::to_string(motion.alpha, 4), uint8_t(255), uint8_t(0), 2);
+				item.jpeg.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+				return item;
+			}),
+			c4::parallel_stage([&](Item item) {
+				std::istringstream in(std::move(item.jpeg));
+				item.image = c4::matrix<uint8_t>(pool);
+				c4::load_jpeg_image(in, item.image);
 
-			std::sprintf(buf, out_filemask.c_str(), fc);
-			c4::write_jpeg(buf, stabilized);
-		}
+				item.frame = std::make_shared<c4::VideoStabilization::Frame>(pool);
+				c4::downscale_bilinear_nx(item.image, *item.frame, downscale);
+				return item;
+			}),
+			c4::serial_stage([&](Item item) {
+				item.motion = vs.process(item.frame, ignoreDown);
+				item.motion.shift = item.motion.shift * downscale;
+				return item;
+			}),
+			c4::parallel_stage([&](Item item) {
+				const c4::MotionDetector::Motion& motion = item.motion;
+
+				c4::matrix<uint8_t> stabilized(item.image.dimensions(), pool);
+
+				motion.apply(item.image, stabilized);
+
+				c4::draw_string(stabilized, 20, 15, "frame " + c4::to_string(item.fc, 3), uint8_t(255), uint8_t(0), 2);
+
+				c4::draw_string(stabilized, 20, 45, "shift: " + c4::to_string(motion.shift.x, 2) + ", " + c4::to_string(motion.shift.y, 2)
+					+ ", scale: " + c4::to_string(motion.scale, 4)
+					+ ", alpha: " + c4::to_string(motion.alpha, 4), uint8_t(255), uint8_t(0), 2);
+
+				char buf[1024];
+				std::sprintf(buf, out_filemask.c_str(), item.fc);
+				c4::write_jpeg(buf, stabilized);
+			})
+		);
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
     }
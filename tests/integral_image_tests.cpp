@@ -0,0 +1,152 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+#include <c4/integral_image.hpp>
+#include <c4/exception.hpp>
+
+using namespace std;
+using namespace c4;
+
+matrix<uint8_t> random_image(int height, int width) {
+    static std::mt19937 mt;
+    std::uniform_int_distribution<int> d(0, 255);
+
+    matrix<uint8_t> img(height, width, matrix_padding{ 1 });
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            img[i][j] = uint8_t(d(mt));
+
+    return img;
+}
+
+template<class D>
+void test_integral_image(int height, int width) {
+    const matrix<uint8_t> img = random_image(height, width);
+
+    matrix<D> ii, sq;
+    calc_integral_image(img, ii);
+    calc_squared_integral_image(img, sq);
+
+    ASSERT_TRUE(ii.dimensions() == img.dimensions());
+
+    // bands of rows with carries, whatever the number of cores
+    thread_pool tp(4);
+    matrix<D> banded;
+    calc_integral_image(img, banded, tp);
+    ASSERT_TRUE(std::equal(ii[0].begin(), ii[0].begin() + height * width, banded[0].begin()));
+
+    for (int i = 0; i < height; i++) {
+        D row = 0, row_sq = 0;
+        for (int j = 0; j < width; j++) {
+            row += img[i][j];
+            row_sq += D(img[i][j]) * img[i][j];
+
+            ASSERT_EQUAL(ii[i][j], (i ? ii[i - 1][j] : 0) + row);
+            ASSERT_EQUAL(sq[i][j], (i ? sq[i - 1][j] : 0) + row_sq);
+        }
+    }
+
+    std::mt19937 mt(height * 1000 + width);
+    for (int k = 0; k < 100; k++) {
+        const int x = mt() % width;
+        const int y = mt() % height;
+        const rectangle<int> r(x, y, int(mt() % (width - x)) + 1, int(mt() % (height - y)) + 1);
+
+        D s = 0;
+        for (int i = r.y; i < r.y + r.h; i++)
+            for (int j = r.x; j < r.x + r.w; j++)
+                s += img[i][j];
+
+        ASSERT_EQUAL(integral_sum(ii, r), s);
+    }
+}
+
+void test_tilted_integral_image(int height, int width) {
+    const matrix<uint8_t> img = random_image(height, width);
+
+    matrix<uint32_t> tii;
+    calc_tilted_integral_image(img, tii);
+
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            uint32_t s = 0;
+            for (int y = 0; y <= i; y++)
+                for (int x = std::max(j - (i - y), 0); x <= std::min(j + (i - y), width - 1); x++)
+                    s += img[y][x];
+
+            ASSERT_EQUAL(tii[i][j], s);
+        }
+    }
+
+    // every rectangle that fits, against the pixels between its four sides
+    for (int w = 1; w <= 4; w++) {
+        for (int h = 1; h <= 4; h++) {
+            for (int y = 0; y + w + h <= height; y++) {
+                for (int x = h - 1; x + w <= width; x++) {
+                    uint32_t s = 0;
+                    int count = 0;
+
+                    for (int i = 0; i < height; i++) {
+                        for (int j = 0; j < width; j++) {
+                            const int d = (j - i) - (x - y);
+                            const int e = (j + i) - (x + y);
+
+                            if (-2 * h < d && d <= 0 && 0 <= e && e < 2 * w) {
+                                s += img[i][j];
+                                count++;
+                            }
+                        }
+                    }
+
+                    ASSERT_EQUAL(count, 2 * w * h);
+                    ASSERT_EQUAL(tilted_integral_sum(tii, x, y, w, h), s);
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    try {
+        test_integral_image<uint32_t>(1, 1);
+        test_integral_image<uint32_t>(7, 45);
+        test_integral_image<uint32_t>(600, 333);
+        test_integral_image<uint64_t>(300, 500);
+        test_integral_image<double>(20, 17);
+        test_tilted_integral_image(1, 1);
+        test_tilted_integral_image(12, 9);
+        test_tilted_integral_image(9, 16);
+
+        cout << "All tests passed OK" << endl;
+    }
+    catch (std::exception& e) {
+        cout << e.what() << endl;
+    }
+
+    return 0;
+}
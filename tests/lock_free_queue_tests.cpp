@@ -0,0 +1,217 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <c4/lock_free_queue.hpp>
+#include <c4/exception.hpp>
+
+using namespace c4;
+using namespace std;
+
+void test_spsc_single_thread() {
+    lock_free_queue<int, 8> q;
+
+    int x = -1;
+    ASSERT_TRUE(q.empty());
+    ASSERT_TRUE(!q.try_pop(x));
+
+    for (int lap = 0; lap < 5; lap++) {
+        const int in[6] = { lap, lap + 1, lap + 2, lap + 3, lap + 4, lap + 5 };
+        ASSERT_EQUAL(q.push_n(in, 6), 6u);
+        ASSERT_EQUAL(q.push_n(in, 6), 2u);
+        ASSERT_TRUE(q.full());
+        ASSERT_TRUE(!q.try_push(0));
+
+        int out[10];
+        ASSERT_EQUAL(q.pop_n(out, 3), 3u);
+        ASSERT_EQUAL(q.pop_n(out + 3, 10), 5u);
+
+        for (int i = 0; i < 8; i++)
+            ASSERT_EQUAL(out[i], in[i % 6]);
+
+        ASSERT_TRUE(q.empty());
+    }
+}
+
+template<bool blocking>
+void test_spsc_threads() {
+    lock_free_queue<uint64_t, 16, blocking> q;
+    const uint64_t n = 200000;
+    bool ordered = true;
+
+    thread consumer([&] {
+        uint64_t buf[5];
+        for (uint64_t expected = 1; expected <= n; ) {
+            uint32_t k;
+            if constexpr (blocking) {
+                buf[0] = q.pop_wait();
+                k = 1;
+            } else {
+                k = q.pop_n(buf, 5);
+            }
+
+            for (uint32_t i = 0; i < k; i++, expected++)
+                ordered = ordered && buf[i] == expected;
+        }
+    });
+
+    for (uint64_t x = 1; x <= n; ) {
+        if constexpr (blocking) {
+            q.push_wait(x++);
+        } else {
+            const uint64_t buf[3] = { x, x + 1, x + 2 };
+            x += q.push_n(buf, (uint32_t)std::min<uint64_t>(3, n - x + 1));
+        }
+    }
+
+    consumer.join();
+
+    ASSERT_TRUE(ordered);
+    ASSERT_TRUE(q.empty());
+}
+
+void test_mpmc_single_thread() {
+    mpmc_queue<int, 8> q;
+
+    ASSERT_TRUE(q.empty());
+
+    int x = -1;
+    ASSERT_TRUE(!q.try_pop(x));
+
+    for (int i = 0; i < 8; i++)
+        ASSERT_TRUE(q.try_push(i));
+
+    ASSERT_TRUE(!q.try_push(8));
+    ASSERT_EQUAL(q.size(), 8u);
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(q.try_pop(x));
+        ASSERT_EQUAL(x, i);
+    }
+
+    ASSERT_TRUE(q.empty());
+
+    // Batches wrap around the ring and stop at full / empty
+    for (int lap = 0; lap < 5; lap++) {
+        const int in[6] = { lap, lap + 1, lap + 2, lap + 3, lap + 4, lap + 5 };
+        ASSERT_EQUAL(q.try_push_n(in, 6), 6u);
+        ASSERT_EQUAL(q.try_push_n(in, 6), 2u);
+
+        int out[10];
+        ASSERT_EQUAL(q.try_pop_n(out, 10), 8u);
+
+        for (int i = 0; i < 8; i++)
+            ASSERT_EQUAL(out[i], in[i % 6]);
+    }
+}
+
+void test_mpmc_threads(int producers, int consumers) {
+    mpmc_queue<uint64_t, 64> q;
+    const uint64_t n = 100000;
+
+    // Elements are (producer << 32) | i; each consumer must see every producer's elements in increasing order
+    vector<vector<uint64_t>> last(consumers, vector<uint64_t>(producers, 0));
+    vector<uint64_t> popped(consumers, 0);
+    std::atomic<uint64_t> total = 0;
+    std::atomic<bool> ordered = true;
+
+    vector<thread> threads;
+
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&, c] {
+            uint64_t buf[16];
+
+            while (total.load() < producers * n) {
+                const uint32_t k = c % 2 ? q.try_pop_n(buf, 16) : q.try_pop(buf[0]);
+
+                for (uint32_t j = 0; j < k; j++) {
+                    const int p = int(buf[j] >> 32);
+                    const uint64_t i = buf[j] & 0xffffffff;
+
+                    if (i <= last[c][p])
+                        ordered = false;
+
+                    last[c][p] = i;
+                }
+
+                popped[c] += k;
+                total += k;
+
+                if (k == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (uint64_t i = 1; i <= n; ) {
+                if (p % 2) {
+                    uint64_t buf[8];
+                    uint32_t k = 0;
+                    for (; k < 8 && i + k <= n; k++)
+                        buf[k] = (uint64_t(p) << 32) | (i + k);
+
+                    i += q.try_push_n(buf, k);
+                } else {
+                    q.push((uint64_t(p) << 32) | i);
+                    i++;
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    uint64_t sum = 0;
+    for (uint64_t x : popped)
+        sum += x;
+
+    ASSERT_EQUAL(sum, producers * n);
+    ASSERT_TRUE(ordered.load());
+    ASSERT_TRUE(q.empty());
+}
+
+int main() {
+    try {
+        test_spsc_single_thread();
+        test_spsc_threads<false>();
+        test_spsc_threads<true>();
+
+        test_mpmc_single_thread();
+
+        for (int producers : { 1, 2, 4 })
+            for (int consumers : { 1, 3 })
+                test_mpmc_threads(producers, consumers);
+
+        cout << "All tests passed OK" << endl;
+    }
+    catch (std::exception& e) {
+        cout << e.what() << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,526 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <cstdint>
+#include <iostream>
+#include <type_traits>
+
+#include <c4/matrix.hpp>
+#include <c4/serialize.hpp>
+#include <c4/mapped_matrix.hpp>
+#include <c4/exif_orientation.hpp>
+#include <c4/motion_detection.hpp>
+#include <c4/exception.hpp>
+
+using namespace std;
+using namespace c4;
+
+struct rgb {
+    uint8_t r, g, b;
+};
+
+bool is_aligned(const void* p) {
+    return reinterpret_cast<uintptr_t>(p) % matrix_alignment == 0;
+}
+
+template<class T>
+void test_padding(int height, int width, int border) {
+    matrix<T> m(height, width, matrix_padding{ border });
+
+    ASSERT_TRUE(m.is_padded());
+    ASSERT_EQUAL(m.border(), border);
+    ASSERT_EQUAL(m.stride_bytes() % matrix_alignment, 0);
+    ASSERT_GREATER_EQUAL(m.stride(), m.width() + 2 * border);
+
+    for (int i = 0; i < height; i++)
+        ASSERT_TRUE(is_aligned(m[i].data()));
+
+    // the border belongs to the matrix
+    for (int i = -border; i < height + border; i++)
+        for (int j = -border; j < width + border; j++)
+            m.data()[i * m.stride() + j] = T{};
+
+    m.resize(height + 3, width + 5);
+    ASSERT_TRUE(m.is_padded());
+    ASSERT_TRUE(is_aligned(m.data()));
+    ASSERT_EQUAL(m.stride_bytes() % matrix_alignment, 0);
+}
+
+void test_aligned() {
+    for (int n : { 1, 3, 17, 100 }) {
+        matrix<uint8_t> a(n, n);
+        matrix<float> b(n, n);
+        matrix<rgb> c(n, n);
+
+        ASSERT_TRUE(is_aligned(a.data()));
+        ASSERT_TRUE(is_aligned(b.data()));
+        ASSERT_TRUE(is_aligned(c.data()));
+        ASSERT_EQUAL(a.stride(), n);
+    }
+
+    for (int border : { 0, 1, 2, 20 }) {
+        for (int width : { 1, 15, 16, 63, 64, 65, 1000 }) {
+            test_padding<uint8_t>(7, width, border);
+            test_padding<float>(7, width, border);
+            test_padding<double>(7, width, border);
+            test_padding<rgb>(7, width, border);
+        }
+    }
+}
+
+void test_copy() {
+    matrix<int> a(5, 7, matrix_padding{ 2 });
+    for (int i = 0; i < a.height(); i++)
+        for (int j = 0; j < a.width(); j++)
+            a[i][j] = i * 100 + j;
+
+    matrix<int> b = a;
+    ASSERT_TRUE(b.is_padded());
+    ASSERT_EQUAL(b.stride(), a.stride());
+
+    matrix<int> c;
+    c = a;
+    ASSERT_TRUE(!c.is_padded());
+    ASSERT_EQUAL(c.stride(), c.width());
+
+    matrix<int> d(1, 1, matrix_padding{ 1 });
+    d = c;
+    ASSERT_TRUE(d.is_padded());
+
+    matrix<int> e(5, 7, 9);
+    for (int i = 0; i < e.height(); i++)
+        for (int j = 0; j < e.width(); j++)
+            e[i][j] = i * 100 + j;
+    matrix<int> f = e;
+
+    for (const matrix<int>* m : { &b, &c, &d, &f }) {
+        ASSERT_TRUE(m->dimensions() == a.dimensions());
+
+        for (int i = 0; i < a.height(); i++)
+            for (int j = 0; j < a.width(); j++)
+                ASSERT_EQUAL((*m)[i][j], i * 100 + j);
+    }
+}
+
+void test_move() {
+    static_assert(std::is_nothrow_move_constructible_v<matrix<float>>);
+    static_assert(std::is_nothrow_move_assignable_v<matrix<float>>);
+
+    matrix<int> a(5, 7, matrix_padding{ 2 });
+    a[4][6] = 42;
+    const int* p = a.data();
+
+    matrix<int> b = std::move(a);
+    ASSERT_TRUE(b.data() == p);
+    ASSERT_TRUE(b.is_padded());
+    ASSERT_EQUAL(b[4][6], 42);
+    ASSERT_EQUAL(a.height(), 0);
+    ASSERT_EQUAL(a.width(), 0);
+
+    matrix<int> c(3, 3);
+    c = std::move(b);
+    ASSERT_TRUE(c.data() == p);
+    ASSERT_EQUAL(c.border(), 2);
+
+    // a moved-from matrix is still usable
+    a.resize(2, 2);
+    ASSERT_EQUAL(a[1][1], 0);
+
+    // growing a vector of matrices moves them instead of copying the pixels
+    vector<matrix<uint8_t>> v;
+    v.emplace_back(100, 100);
+    const uint8_t* q = v[0].data();
+    for (int k = 0; k < 100; k++)
+        v.emplace_back(1, 1);
+    ASSERT_TRUE(v[0].data() == q);
+}
+
+void test_resize() {
+    matrix<int> a(2, 3);
+    for (int& x : a)
+        x = 1;
+
+    a.resize(4, 3);
+    ASSERT_EQUAL(a[0][2], 1);
+    for (int i = 2; i < 4; i++)
+        for (int j = 0; j < 3; j++)
+            ASSERT_EQUAL(a[i][j], 0);
+
+    matrix<int> b(10, 10, 10, 1);
+    b.resize_for_overwrite(20, 30);
+    ASSERT_TRUE(b.dimensions() == matrix_dimensions({ 20, 30 }));
+    ASSERT_EQUAL(b.stride(), 30);
+
+    matrix<int> c(2, 2, matrix_padding{ 1 });
+    c.resize_for_overwrite(50, 70);
+    ASSERT_TRUE(c.is_padded());
+    ASSERT_TRUE(is_aligned(c.data()));
+}
+
+void test_buffer_pool() {
+    buffer_pool pool;
+
+    for (int k = 0; k < 100; k++) {
+        matrix<uint8_t> a(480, 640, &pool);
+        matrix<float> b(a.dimensions(), &pool);
+        matrix<uint8_t> c(480, 640, matrix_padding{ 8 }, &pool);
+
+        ASSERT_TRUE(a.pool() == &pool);
+        ASSERT_TRUE(is_aligned(a.data()));
+        ASSERT_TRUE(is_aligned(c[0].data()));
+        ASSERT_EQUAL(b[479][639], 0.f);
+
+        // moves take the pool along, assignments keep the target's
+        matrix<uint8_t> d = std::move(a);
+        ASSERT_TRUE(d.pool() == &pool);
+
+        matrix<uint8_t> e;
+        e = d;
+        ASSERT_TRUE(e.pool() == nullptr);
+    }
+
+    // steady state: the same three blocks over and over
+    buffer_pool::stats_snapshot s = pool.get_stats();
+    ASSERT_EQUAL(s.allocated, 3u);
+    ASSERT_EQUAL(s.reused, 3u * 99);
+    ASSERT_GREATER(s.cached_bytes, size_t(0));
+
+    pool.trim();
+    ASSERT_EQUAL(pool.get_stats().cached_bytes, size_t(0));
+
+    // blocks freed by other threads are found too
+    vector<matrix<int>> v;
+    for (int k = 0; k < 8; k++)
+        v.emplace_back(100, 100, &pool);
+
+    vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&v, t] {
+            for (int k = t; k < 8; k += 4)
+                v[k].clear_and_shrink();
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    const uint64_t allocated = pool.get_stats().allocated;
+    for (int k = 0; k < 8; k++)
+        v[k].resize(100, 100);
+    ASSERT_EQUAL(pool.get_stats().allocated, allocated);
+
+    // a pool that keeps nothing
+    buffer_pool none(0);
+    for (int k = 0; k < 3; k++)
+        matrix<int> m(10, 10, &none);
+    ASSERT_EQUAL(none.get_stats().allocated, 3u);
+    ASSERT_EQUAL(none.get_stats().cached_bytes, size_t(0));
+}
+
+void test_expressions(int height, int width) {
+    matrix<float> a(height, width), b(height, width, matrix_padding{ 2 });
+    matrix<int> c(height, width);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            a[i][j] = float(i - j);
+            b[i][j] = float(i * j % 7);
+            c[i][j] = i + 2 * j;
+        }
+    }
+
+    matrix<float> r = lazy(a) * 0.5f + b - c;
+    ASSERT_TRUE(r.dimensions() == a.dimensions());
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            ASSERT_EQUAL(r[i][j], a[i][j] * 0.5f + b[i][j] - c[i][j]);
+
+    r = entrywise_mul(lazy(a), b) / 2.f + 1.f;
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            ASSERT_EQUAL(r[i][j], a[i][j] * b[i][j] / 2.f + 1.f);
+
+    // the target is also an operand
+    matrix<float> s = a;
+    s = 2.f * lazy(s) - a;
+    s += lazy(b) * 3.f;
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            ASSERT_EQUAL(s[i][j], a[i][j] + b[i][j] * 3.f);
+
+    // eager wrappers keep their element types
+    auto sum = c + c;
+    static_assert(std::is_same_v<decltype(sum), matrix<int>>);
+    ASSERT_EQUAL(sum[height - 1][width - 1], 2 * c[height - 1][width - 1]);
+
+    matrix<float> m = entrywise_madd(c, 0.25f, 1.f);
+    ASSERT_EQUAL(m[height - 1][0], c[height - 1][0] * 0.25f + 1.f);
+}
+
+void test_row_transforms(int height, int width) {
+    matrix<uint8_t> a(height, width, matrix_padding{ 1 });
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            a[i][j] = uint8_t(i * 31 + j * 7);
+
+    matrix<uint8_t> b(a.dimensions()), c(a.dimensions());
+
+    // a lookup table
+    uint8_t lut[256];
+    for (int k = 0; k < 256; k++)
+        lut[k] = uint8_t(255 - k / 2);
+
+    transform_rows(a, [&](const uint8_t* src, uint8_t* dst, int n) {
+        for (int j = 0; j < n; j++)
+            dst[j] = lut[src[j]];
+    }, b);
+
+    parallel_transform(a, [&](uint8_t x) { return lut[x]; }, c);
+
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            ASSERT_EQUAL(b[i][j], c[i][j]);
+
+#ifdef __C4_SIMD__
+    const simd::uint8x16 t(100);
+    transform(a, [&](simd::uint8x16 x) { return simd::max(x, t); }, b);
+    parallel_transform(a, [&](simd::uint8x16 x) { return simd::add_saturate(x, t); }, c);
+
+    matrix<float> f = transform(matrix<float>(transform(a, [](uint8_t x) { return float(x); })), [](simd::float32x4 x) {
+        return simd::mul(x, simd::float32x4(0.5f));
+    });
+
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            ASSERT_EQUAL(b[i][j], std::max<uint8_t>(a[i][j], 100));
+            ASSERT_EQUAL(c[i][j], std::min(a[i][j] + 100, 255));
+            ASSERT_EQUAL(f[i][j], a[i][j] * 0.5f);
+        }
+    }
+#endif
+
+    parallel_for_each_row(b, [](uint8_t* row, int n) {
+        std::fill(row, row + n, uint8_t(7));
+    });
+
+    int sum = 0;
+    for_each_row(static_cast<const matrix_ref<uint8_t>&>(b), [&](const uint8_t* row, int n) {
+        sum += std::accumulate(row, row + n, 0);
+    });
+    ASSERT_EQUAL(sum, 7 * height * width);
+}
+
+template<class T>
+void test_rotations(int height, int width) {
+    matrix<T> a(height, width, matrix_padding{ 3 });
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            a[i][j] = T(i * 1009 + j * 17 + 1);
+
+    matrix<T> t = transpose(a);
+    matrix<T> cw(width, height), ccw(width, height);
+    rotate90cw(a, cw);
+    rotate270cw(a, ccw);
+
+    matrix<T> r180(height, width), fh(height, width), fv(height, width);
+    rotate180(a, r180);
+    flip_horizontal(a, fh);
+    flip_vertical(a, fv);
+
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            ASSERT_TRUE(t[j][i] == a[i][j]);
+            ASSERT_TRUE(cw[j][height - 1 - i] == a[i][j]);
+            ASSERT_TRUE(ccw[width - 1 - j][i] == a[i][j]);
+            ASSERT_TRUE(r180[height - 1 - i][width - 1 - j] == a[i][j]);
+            ASSERT_TRUE(fh[i][width - 1 - j] == a[i][j]);
+            ASSERT_TRUE(fv[height - 1 - i][j] == a[i][j]);
+        }
+    }
+
+    // in place
+    matrix<T> b = a;
+    rotate90cw(b);
+    ASSERT_TRUE(b.dimensions() == cw.dimensions());
+    rotate270cw(b);
+    rotate180(b);
+    flip_horizontal(b);
+    flip_vertical(b);
+
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            ASSERT_TRUE(b[i][j] == a[i][j]);
+}
+
+void test_exif_orientation(int height, int width) {
+    matrix<uint8_t> a(height, width);
+    for (int i = 0; i < height; i++)
+        for (int j = 0; j < width; j++)
+            a[i][j] = uint8_t(i * 16 + j);
+
+    for (ExifOrienation o : { ExifOrienation::UPPER_LEFT, ExifOrienation::UNSPECIFIED }) {
+        matrix<uint8_t> b = a;
+        apply_exif_orientation(b, o);
+        ASSERT_TRUE(b.dimensions() == a.dimensions());
+
+        for (int i = 0; i < height; i++)
+            for (int j = 0; j < width; j++)
+                ASSERT_EQUAL(b[i][j], a[i][j]);
+    }
+
+    matrix<uint8_t> lr = a, ur = a, ll = a;
+    apply_exif_orientation(lr, ExifOrienation::LOWER_RIGHT);
+    apply_exif_orientation(ur, ExifOrienation::UPPER_RIGHT);
+    apply_exif_orientation(ll, ExifOrienation::LOWER_LEFT);
+
+    ASSERT_TRUE(lr.dimensions() == a.dimensions());
+    ASSERT_EQUAL(ur.height(), width);
+    ASSERT_EQUAL(ur.width(), height);
+    ASSERT_EQUAL(ll.height(), width);
+    ASSERT_EQUAL(ll.width(), height);
+
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            ASSERT_EQUAL(lr[height - 1 - i][width - 1 - j], a[i][j]);
+            ASSERT_EQUAL(ur[j][height - 1 - i], a[i][j]);
+            ASSERT_EQUAL(ll[width - 1 - j][i], a[i][j]);
+        }
+    }
+}
+
+void test_mapped_matrix() {
+    const std::string filepath = "mapped_matrix_test.bin";
+
+    matrix<float> a(37, 41, matrix_padding{ 2 });
+    for (int i = 0; i < a.height(); i++)
+        for (int j = 0; j < a.width(); j++)
+            a[i][j] = float(i * 100 + j);
+
+    c4::save(a, filepath);
+
+    mapped_matrix<float> m(filepath);
+    ASSERT_TRUE(m.dimensions() == a.dimensions());
+    for (int i = 0; i < a.height(); i++)
+        for (int j = 0; j < a.width(); j++)
+            ASSERT_EQUAL(m[i][j], a[i][j]);
+
+    matrix<float> b = transform(m, [](float x) { return x * 2; });
+    ASSERT_EQUAL(b[36][40], a[36][40] * 2);
+
+    // the same data as a headerless file with rows 41 floats apart, every other row
+    mapped_matrix<float> raw(filepath, 18, 10, 82, 16 + 41 * sizeof(float));
+    ASSERT_EQUAL(raw[0][0], a[1][0]);
+    ASSERT_EQUAL(raw[17][9], a[35][9]);
+
+    mapped_matrix<float> moved = std::move(m);
+    ASSERT_TRUE(m.data() == nullptr);
+    ASSERT_EQUAL(moved[5][5], a[5][5]);
+
+    bool thrown = false;
+    try {
+        mapped_matrix<float> too_long(filepath, 38, 41, 41, 16);
+    }
+    catch (c4::exception&) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+
+    std::remove(filepath.c_str());
+}
+
+// Even on an image wider than a tile the result must be that of whole rows stepped from column 0.
+// No rotation, so that the row starts come out the same whether or not the compiler fuses their multiply-adds.
+void test_motion_apply(int height, int width) {
+    matrix<uint8_t> src(height, width);
+    for (int i : range(height))
+        for (int j : range(width))
+            src[i][j] = uint8_t(i * 7 + j * 13 + (i * j) % 17);
+
+    MotionDetector::Motion motion;
+    motion.shift = point<double>(1.3, -0.7);
+    motion.scale = 1.01;
+
+    const float sns = float(std::sin(motion.alpha) * motion.scale);
+    const float css = float(std::cos(motion.alpha) * motion.scale);
+    const point<float> C = MotionDetector::center(src);
+    const point<float> Cps = C + point<float>(motion.shift);
+
+    matrix<uint8_t> expected(height, width);
+    matrix<uint8_t> expected_nn(height, width);
+    for (int y : range(height)) {
+        const point<float> p = point<float>(0.f, float(y)) - C;
+        point<float> t = point<float>(css * p.x - sns * p.y, sns * p.x + css * p.y) + Cps;
+
+        for (int x : range(width)) {
+            expected[y][x] = src.get_interpolate(t);
+            expected_nn[y][x] = src.clamp_get(t);
+
+            t.x += css;
+            t.y += sns;
+        }
+    }
+
+    matrix<uint8_t> dst(height, width);
+    motion.apply(src, dst);
+    for (int y : range(height))
+        for (int x : range(width))
+            ASSERT_EQUAL(int(dst[y][x]), int(expected[y][x]));
+
+    motion.apply_nn(src, dst);
+    for (int y : range(height))
+        for (int x : range(width))
+            ASSERT_EQUAL(int(dst[y][x]), int(expected_nn[y][x]));
+}
+
+int main() {
+    try {
+        test_aligned();
+        test_copy();
+        test_move();
+        test_resize();
+        test_buffer_pool();
+        test_expressions(3, 5);
+        test_expressions(300, 301);
+        test_row_transforms(5, 37);
+        test_row_transforms(400, 333);
+        test_rotations<uint8_t>(1, 1);
+        test_rotations<uint8_t>(37, 70);
+        test_rotations<uint8_t>(700, 500);
+        test_rotations<uint16_t>(29, 41);
+        test_rotations<float>(130, 67);
+        test_rotations<double>(19, 23);
+        test_exif_orientation(3, 5);
+        test_mapped_matrix();
+        test_motion_apply(40, 40000);
+        test_motion_apply(300, 301);
+
+        cout << "All tests passed OK" << endl;
+    }
+    catch (std::exception& e) {
+        cout << e.what() << endl;
+    }
+
+    return 0;
+}
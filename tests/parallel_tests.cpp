@@ -0,0 +1,901 @@
+//MIT License
+//
+//Copyright(c) 2026 Alex Kasitskyi
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files(the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions :
+//
+//The above copyright notice and this permission notice shall be included in all
+//copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//SOFTWARE.
+
+#include <iostream>
+#include <random>
+#include <numeric>
+#include <new>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// The tests check the times too
+#define C4_POOL_TIMING
+
+#include <c4/parallel.hpp>
+#include <c4/task.hpp>
+#include <c4/task_graph.hpp>
+#include <c4/pipeline.hpp>
+#include <c4/exception.hpp>
+
+using namespace c4;
+using namespace std;
+
+// ===================================================== HELPERS ================================================================
+
+// Counts heap allocations to check that submission paths don't allocate.
+// Every form of new and delete is replaced, so that whatever the library asks for is freed by the same allocator.
+static std::atomic<int64_t> allocations = 0;
+
+static void* counted_allocate(size_t size, size_t alignment) noexcept {
+    allocations++;
+    alignment = std::max(alignment, sizeof(void*));
+    size = std::max<size_t>(size, 1);
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#endif
+}
+
+static void counted_deallocate(void* p) noexcept {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static void* counted_allocate_or_throw(size_t size, size_t alignment) {
+    if (void* p = counted_allocate(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) { return counted_allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size) { return counted_allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t al) { return counted_allocate_or_throw(size, size_t(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return counted_allocate_or_throw(size, size_t(al)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return counted_allocate(size, size_t(al)); }
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return counted_allocate(size, size_t(al)); }
+
+void operator delete(void* p) noexcept { counted_deallocate(p); }
+void operator delete[](void* p) noexcept { counted_deallocate(p); }
+void operator delete(void* p, size_t) noexcept { counted_deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { counted_deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { counted_deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { counted_deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { counted_deallocate(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { counted_deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { counted_deallocate(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { counted_deallocate(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { counted_deallocate(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { counted_deallocate(p); }
+
+// ====================================================== TESTS =================================================================
+
+void test_enqueue(thread_pool& tp) {
+    vector<future<int>> futures;
+    for (int i : range(1000))
+        futures.push_back(tp.enqueue([i] { return i * i; }));
+
+    for (int i : range(futures))
+        ASSERT_EQUAL(futures[i].get(), i * i);
+}
+
+void test_enqueue_from_workers(thread_pool& tp) {
+    atomic<int> counter = 0;
+
+    vector<future<void>> futures;
+    for (int i = 0; i < 100; i++) {
+        futures.push_back(tp.enqueue([&tp, &counter] {
+            for (int k = 0; k < 100; k++) {
+                tp.enqueue([&counter] { counter++; });
+            }
+        }));
+    }
+
+    for (auto& f : futures)
+        f.get();
+
+    while (counter != 100 * 100)
+        this_thread::yield();
+}
+
+void test_priority() {
+    thread_pool tp(1);
+
+    promise<void> gate;
+    shared_future<void> opened = gate.get_future().share();
+    tp.enqueue([opened] { opened.wait(); });
+
+    mutex mu;
+    vector<int> order;
+    vector<future<void>> futures;
+    for (int p : { -1, 0, 2, 1, 0, 2 }) {
+        futures.push_back(tp.enqueue([&mu, &order, p] {
+            lock_guard<mutex> lock(mu);
+            order.push_back(p);
+        }, p));
+    }
+
+    gate.set_value();
+
+    for (auto& f : futures)
+        f.get();
+
+    ASSERT_TRUE(order == vector<int>({ 2, 2, 1, 0, 0, -1 }));
+}
+
+void test_parallel_for(thread_pool& tp) {
+    for (int n : { 0, 1, 7, 1000, 100000 }) {
+        vector<int> v(n);
+        parallel_for(range(n), [&v](int i) {
+            v[i]++;
+        }, tp);
+
+        for (int x : v)
+            ASSERT_EQUAL(x, 1);
+    }
+}
+
+void test_parallel_reduce(thread_pool& tp) {
+    for (int n : { 0, 1, 7, 1000, 100000 }) {
+        vector<int64_t> v(n);
+        iota(v.begin(), v.end(), 0);
+
+        int64_t sum = parallel_reduce(v.begin(), v.end(), int64_t(0), std::plus<int64_t>(), [](auto first, auto last) {
+            return accumulate(first, last, int64_t(0));
+        }, tp);
+
+        ASSERT_EQUAL(sum, int64_t(n) * (n - 1) / 2);
+    }
+}
+
+void test_parallel_for_allocations(thread_pool& tp) {
+    vector<int> v(10000);
+    auto body = [&v](int i) { v[i]++; };
+
+    // warm up: worker deques grow to their steady-state size
+    for (int k = 0; k < 10; k++)
+        parallel_for(range(v), 1, body, tp);
+
+    const int64_t before = allocations;
+    for (int k = 0; k < 100; k++) {
+        parallel_for(range(v), body, tp);
+        parallel_for(range(v), 16, body, tp);
+    }
+    ASSERT_EQUAL(allocations - before, 0);
+
+    // reductions over a few groups keep their results on the stack
+    int64_t sum = 0;
+    const int64_t before_reduce = allocations;
+    for (int k = 0; k < 100; k++) {
+        sum += parallel_reduce(range(v), int(v.size()) / 16, int64_t(0), std::plus<int64_t>(), [&v](range r) {
+            int64_t s = 0;
+            for (int i : r)
+                s += v[i];
+            return s;
+        }, tp);
+    }
+    ASSERT_EQUAL(allocations - before_reduce, 0);
+    ASSERT_EQUAL(sum, 100 * 210 * int64_t(v.size()));
+}
+
+void test_parallel_for_exception(thread_pool& tp) {
+    bool thrown = false;
+    try {
+        parallel_for(range(1000), 1, [](int i) {
+            if (i == 500)
+                throw std::runtime_error("failed");
+        }, tp);
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+
+void test_enumerable_thread_specific(thread_pool& tp) {
+    enumerable_thread_specific<int64_t> sums(0, tp);
+    ASSERT_EQUAL(sums.size(), tp.get_num_threads());
+
+    parallel_for(range(100000), [&sums](int i) {
+        sums.local() += i;
+    }, tp);
+
+    // threads outside the pool get their own slots
+    sums.local() += 1;
+    thread t1([&sums] { sums.local() += 2; });
+    thread t2([&sums] { sums.local() += 3; });
+    t1.join();
+    t2.join();
+    ASSERT_EQUAL(sums.size(), tp.get_num_threads() + 3);
+
+    ASSERT_EQUAL(sums.combine(std::plus<int64_t>()), int64_t(100000) * 99999 / 2 + 6);
+
+    int64_t total = 0;
+    sums.combine_each([&total](int64_t x) { total += x; });
+    ASSERT_EQUAL(total, int64_t(100000) * 99999 / 2 + 6);
+
+    int64_t iterated = 0;
+    for (int64_t x : sums)
+        iterated += x;
+    ASSERT_EQUAL(iterated, total);
+
+    // every slot sits on its own cache line
+    for (int i : range(sums.size()))
+        ASSERT_EQUAL(uintptr_t(&sums[i]) % 64, 0);
+}
+
+void test_nested_parallel_for(thread_pool& tp) {
+    const int n = 64;
+    vector<int> v(n * n * n);
+
+    parallel_for(range(n), [&](int i) {
+        parallel_for(range(n), [&](int j) {
+            parallel_for(range(n), [&](int k) {
+                v[(i * n + j) * n + k]++;
+            }, tp);
+        }, tp);
+    }, tp);
+
+    for (int x : v)
+        ASSERT_EQUAL(x, 1);
+}
+
+void test_nested_parallel_reduce(thread_pool& tp) {
+    const int n = 100;
+
+    int64_t sum = parallel_reduce(range(n), 1, int64_t(0), std::plus<int64_t>(), [&](range r) {
+        int64_t s = 0;
+        for (int i : r) {
+            s += parallel_reduce(range(n), 1, int64_t(0), std::plus<int64_t>(), [&](range q) {
+                int64_t t = 0;
+                for (int j : q)
+                    t += i * n + j;
+                return t;
+            }, tp);
+        }
+        return s;
+    }, tp);
+
+    ASSERT_EQUAL(sum, int64_t(n * n) * (n * n - 1) / 2);
+}
+
+void test_parallel_scan(thread_pool& tp) {
+    mt19937 mt(42);
+
+    for (int n : { 0, 1, 7, 1000, 100003 }) {
+        vector<int64_t> v(n);
+        for (auto& x : v)
+            x = mt() % 1000;
+
+        vector<int64_t> expected(n), r(n);
+
+        inclusive_scan(v.begin(), v.end(), expected.begin(), std::plus<int64_t>(), int64_t(5));
+        parallel_inclusive_scan(v.begin(), v.end(), r.begin(), int64_t(5), std::plus<int64_t>(), tp);
+        ASSERT_TRUE(r == expected);
+
+        exclusive_scan(v.begin(), v.end(), expected.begin(), int64_t(5), std::plus<int64_t>());
+        parallel_exclusive_scan(v.begin(), v.end(), r.begin(), 100, int64_t(5), std::plus<int64_t>(), tp);
+        ASSERT_TRUE(r == expected);
+
+        // in-place
+        parallel_exclusive_scan(v.begin(), v.end(), v.begin(), int64_t(5), std::plus<int64_t>(), tp);
+        ASSERT_TRUE(v == expected);
+    }
+}
+
+void test_parallel_sort(thread_pool& tp) {
+    mt19937 mt(42);
+
+    for (int n : { 0, 1, 7, 1000, 100003 }) {
+        vector<int> v(n);
+        for (auto& x : v)
+            x = mt() % 1000;
+
+        vector<int> expected = v;
+        sort(expected.begin(), expected.end(), std::greater<int>());
+
+        vector<int> r = v;
+        parallel_sort(r.begin(), r.end(), std::greater<int>(), tp);
+        ASSERT_TRUE(r == expected);
+
+        r = v;
+        parallel_sort(r.begin(), r.end(), 10, std::greater<int>(), tp);
+        ASSERT_TRUE(r == expected);
+
+        r = v;
+        parallel_sort(r.begin(), r.end(), tp);
+        ASSERT_TRUE(is_sorted(r.begin(), r.end()));
+
+        // an odd number of groups, so some runs have no partner on some levels
+        r = v;
+        parallel_sort(r.begin(), r.end(), std::max(n / 7, 1), std::greater<int>(), tp);
+        ASSERT_TRUE(r == expected);
+
+        // no default constructor: merged in place
+        struct item {
+            int x;
+            explicit item(int x) : x(x) {}
+        };
+
+        vector<item> items;
+        for (int x : v)
+            items.emplace_back(x);
+
+        parallel_sort(items.begin(), items.end(), 10, [](const item& a, const item& b) { return a.x > b.x; }, tp);
+        for (int i : range(n))
+            ASSERT_EQUAL(items[i].x, expected[i]);
+    }
+}
+
+void test_parallel_partition(thread_pool& tp) {
+    mt19937 mt(42);
+
+    for (int n : { 0, 1, 7, 1000, 100003 }) {
+        vector<pair<int, int>> v(n);
+        for (int i : range(n))
+            v[i] = { int(mt() % 1000), i };
+
+        auto pred = [](const pair<int, int>& p) { return p.first < 300; };
+
+        vector<pair<int, int>> expected = v;
+        auto expected_mid = stable_partition(expected.begin(), expected.end(), pred);
+
+        auto mid = parallel_partition(v.begin(), v.end(), pred, tp);
+        ASSERT_EQUAL(mid - v.begin(), expected_mid - expected.begin());
+        ASSERT_TRUE(v == expected);
+
+        // a kept scratch buffer, partitioning the result again changes nothing
+        vector<pair<int, int>> scratch;
+        mid = parallel_partition(v.begin(), v.end(), pred, scratch, tp);
+        ASSERT_EQUAL(mid - v.begin(), expected_mid - expected.begin());
+        ASSERT_TRUE(v == expected);
+        ASSERT_TRUE(scratch.empty());
+        ASSERT_TRUE(scratch.capacity() >= size_t(n));
+
+        // move-only elements
+        vector<unique_ptr<int>> u;
+        for (int i : range(n))
+            u.push_back(make_unique<int>(i));
+
+        auto umid = parallel_partition(u.begin(), u.end(), 64, [](const unique_ptr<int>& p) { return *p % 3 == 0; }, tp);
+        ASSERT_EQUAL(umid - u.begin(), (n + 2) / 3);
+        for (auto it = u.begin(); it != u.end(); ++it)
+            ASSERT_EQUAL(**it % 3 == 0, it < umid);
+    }
+}
+
+void test_parallel_for_2d(thread_pool& tp) {
+    // square, panorama, tall crop, tiny
+    for (auto [h, w] : vector<pair<int, int>>{ { 1080, 1920 }, { 64, 20000 }, { 20000, 48 }, { 3, 5 } }) {
+        vector<uint8_t> v(h * w);
+        parallel_for_2d(range2d(range(h), range(w)), sizeof(uint8_t), [&](range2d tile) {
+            ASSERT_TRUE(tile.height() > 0 && tile.width() > 0);
+            for (int i : tile.rows)
+                for (int j : tile.cols)
+                    v[i * w + j]++;
+        }, tp);
+
+        for (uint8_t x : v)
+            ASSERT_EQUAL(x, 1);
+
+        int tile_h, tile_w;
+        detail::auto_tile_size(h, w, sizeof(float), 16, tile_h, tile_w);
+        ASSERT_TRUE(1 <= tile_h && tile_h <= h && 1 <= tile_w && tile_w <= w);
+        ASSERT_LESS_EQUAL(size_t(tile_h * tile_w) * sizeof(float), detail::tile_cache_bytes);
+        if (size_t(h) * w * sizeof(float) >= 64 * detail::min_tile_bytes)
+            ASSERT_GREATER_EQUAL(int64_t(h + tile_h - 1) / tile_h * ((w + tile_w - 1) / tile_w), 16);
+    }
+
+    // elements bigger than a whole tile: one element per tile at most, and the split must stop there
+    for (size_t element_size : { size_t(32 * 1024), size_t(1 << 20) }) {
+        int tile_h, tile_w;
+        detail::auto_tile_size(3, 2, element_size, 16, tile_h, tile_w);
+        ASSERT_EQUAL(tile_h, 1);
+        ASSERT_EQUAL(tile_w, 1);
+
+        atomic<int> visited = 0;
+        parallel_for_2d(range2d(range(3), range(2)), element_size, [&](range2d tile) {
+            visited += tile.height() * tile.width();
+        }, tp);
+        ASSERT_EQUAL(visited.load(), 6);
+    }
+
+    const range2d whole(range(100), range(100));
+    atomic<int> n = 0;
+    parallel_for_2d(range2d(range(10, 90), range(20, 80)), 7, 9, [&](range2d tile) {
+        ASSERT_TRUE(tile.height() <= 7 && tile.width() <= 9);
+        range2d in = tile.inflate(2, 3, whole);
+        ASSERT_EQUAL(in.rows.begin_, tile.rows.begin_ - 2);
+        ASSERT_EQUAL(in.cols.end_, tile.cols.end_ + 3);
+        n += tile.height() * tile.width();
+    }, tp);
+    ASSERT_EQUAL(n.load(), 80 * 60);
+
+    range2d edge = range2d(range(0, 5), range(95, 100)).inflate(2, 2, whole);
+    ASSERT_EQUAL(edge.rows.begin_, 0);
+    ASSERT_EQUAL(edge.cols.end_, 100);
+}
+
+void test_task_graph(thread_pool& tp) {
+    // a -> { b, c } -> d, plus an independent chain e -> f
+    atomic<int> a = 0, b = 0, c = 0, d = 0, e = 0, f = 0;
+    atomic<bool> ok = true;
+
+    task_graph g(tp);
+    auto na = g.add([&] { a++; });
+    auto nb = g.add([&] { ok = ok && b + 1 == a; b++; }, { na });
+    auto nc = g.add([&] { ok = ok && c + 1 == a; c++; }, { na });
+    g.add([&] { ok = ok && d + 1 == b && d + 1 == c; d++; }, { nb, nc });
+    auto ne = g.add([&] { e++; });
+    g.add([&] { ok = ok && f + 1 == e; f++; }, { ne });
+
+    ASSERT_EQUAL(g.size(), 6);
+
+    for (int k : range(1, 101)) {
+        g.run();
+        ASSERT_TRUE(ok);
+        ASSERT_EQUAL(d.load(), k);
+        ASSERT_EQUAL(f.load(), k);
+    }
+
+    // graphs run from inside the pool don't block the workers
+    parallel_for(range(8), [&](int) {
+        task_graph h(tp);
+        atomic<int> x = 0;
+        auto n0 = h.add([&] { x++; });
+        h.add([&] { x++; }, { n0 });
+        h.run();
+        ok = ok && x == 2;
+    }, tp);
+    ASSERT_TRUE(ok);
+
+    task_graph bad(tp);
+    auto n0 = bad.add([] { throw std::runtime_error("node failed"); });
+    bad.add([] {}, { n0 });
+    bool thrown = false;
+    try {
+        bad.run();
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+
+void test_pipeline(thread_pool& tp) {
+    const int n = 1000;
+    const size_t max_tokens = 4;
+
+    int produced = 0;
+    atomic<int> in_flight = 0;
+    atomic<bool> ok = true;
+    vector<int> out;
+
+    parallel_pipeline(tp, max_tokens,
+        serial_stage([&](flow_control& fc) {
+            if (produced == n)
+                fc.stop();
+
+            ok = ok && ++in_flight <= int(max_tokens);
+            return produced++;
+        }),
+        parallel_stage([](int x) {
+            std::this_thread::sleep_for(std::chrono::microseconds(x % 7 * 10));
+            return 2 * x + 1;
+        }),
+        serial_stage([&](int y) {
+            out.push_back(y);
+            return y;
+        }),
+        parallel_stage([&](int) {
+            in_flight--;
+        })
+    );
+
+    ASSERT_TRUE(ok);
+    ASSERT_EQUAL(out.size(), size_t(n));
+    for (int i = 0; i < n; i++)
+        ASSERT_EQUAL(out[i], 2 * i + 1);
+
+    // pipelines run from inside the pool don't block the workers
+    parallel_for(range(4), [&](int) {
+        int k = 0;
+        int sum = 0;
+        parallel_pipeline(tp, 2,
+            serial_stage([&](flow_control& fc) {
+                if (k == 10)
+                    fc.stop();
+                return k++;
+            }),
+            serial_stage([&](int x) {
+                sum += x;
+            })
+        );
+        ok = ok && sum == 45;
+    }, tp);
+    ASSERT_TRUE(ok);
+
+    int k = 0;
+    bool thrown = false;
+    try {
+        parallel_pipeline(tp, 3,
+            serial_stage([&](flow_control&) {
+                return k++;
+            }),
+            parallel_stage([](int x) {
+                if (x == 10)
+                    throw std::runtime_error("stage failed");
+                return x;
+            }),
+            serial_stage([](int) {})
+        );
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+
+void test_parallel_invoke() {
+    atomic<int> a = 0;
+    parallel_invoke([&a] { a += 1; }, [&a] { a += 2; }, [&a] { a += 4; });
+    ASSERT_EQUAL(a.load(), 7);
+}
+
+// ======================================================= MAIN =================================================================
+
+void test_schedules(thread_pool& tp) {
+    for (Schedule schedule : { Schedule::Static, Schedule::Dynamic, Schedule::Guided, Schedule::Auto, Schedule::Affine }) {
+        for (int n : { 0, 1, 7, 1000, 10000 }) {
+            for (size_t grain : { 1, 3, 64 }) {
+                vector<std::atomic<int>> visited(n);
+
+                parallel_for(range(n), grain, schedule, [&](int i) {
+                    visited[i]++;
+                }, tp);
+
+                for (auto& v : visited)
+                    ASSERT_EQUAL(v.load(), 1);
+
+                // non-commutative reduction: the order of chunks must be kept
+                vector<int> order = parallel_reduce(range(n), (int)grain, schedule, vector<int>(), [](vector<int>&& a, const vector<int>& b) {
+                    a.insert(a.end(), b.begin(), b.end());
+                    return std::move(a);
+                }, [](range r) {
+                    return vector<int>(r.begin(), r.end());
+                }, tp);
+
+                ASSERT_EQUAL(order.size(), size_t(n));
+                for (int i = 0; i < n; i++)
+                    ASSERT_EQUAL(order[i], i);
+            }
+        }
+
+        bool thrown = false;
+        try {
+            parallel_for(range(1000), 1, schedule, [](int i) {
+                if (i == 500)
+                    throw std::runtime_error("failed");
+            }, tp);
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ASSERT_TRUE(thrown);
+    }
+}
+
+void test_grain_tuner(thread_pool& tp) {
+    grain_tuner tuner(std::chrono::microseconds(50));
+
+    ASSERT_EQUAL(tuner.grain_size(1000, tp.get_num_threads()), size_t(1));
+
+    for (int k = 0; k < 3; k++) {
+        vector<std::atomic<int>> visited(10000);
+
+        parallel_for(range(visited.size()), tuner, [&](int i) {
+            visited[i]++;
+        }, tp);
+
+        for (auto& v : visited)
+            ASSERT_EQUAL(v.load(), 1);
+    }
+
+    const size_t grain = tuner.grain_size(10000, tp.get_num_threads());
+    ASSERT_TRUE(grain >= 1 && grain <= std::max<size_t>(10000 / tp.get_num_threads(), 1));
+}
+
+task<int> square_on(thread_pool& tp, int x) {
+    co_await tp.schedule();
+    co_return x * x;
+}
+
+task<void> fail_on(thread_pool& tp) {
+    co_await tp.schedule();
+    throw std::runtime_error("failed");
+}
+
+task<int64_t> frame_on(thread_pool& tp, int n) {
+    co_await tp.schedule();
+
+    auto [a, b, c] = co_await when_all(square_on(tp, 2), square_on(tp, 3), [](thread_pool& tp) -> task<void> { co_await tp.schedule(); }(tp));
+    ASSERT_EQUAL(a, 4);
+    ASSERT_EQUAL(b, 9);
+
+    vector<int64_t> v(n);
+    co_await async_parallel_for(range(n), 7, [&](int i) {
+        v[i] = i;
+    }, tp);
+
+    co_return accumulate(v.begin(), v.end(), int64_t(0));
+}
+
+void test_tasks(thread_pool& tp) {
+    for (int n : { 0, 1, 1000 })
+        ASSERT_EQUAL(sync_wait(frame_on(tp, n)), int64_t(n) * (n - 1) / 2);
+
+    vector<task<int>> squares;
+    for (int i : range(100))
+        squares.push_back(square_on(tp, i));
+
+    vector<int> r = sync_wait(when_all(std::move(squares)));
+    for (int i : range(100))
+        ASSERT_EQUAL(r[i], i * i);
+
+    auto any = sync_wait(when_any(square_on(tp, 5), square_on(tp, 5)));
+    ASSERT_TRUE(any.index < 2);
+    ASSERT_EQUAL(any.value, 25);
+
+    bool thrown = false;
+    try {
+        sync_wait(when_all(square_on(tp, 1), fail_on(tp)));
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+
+    thrown = false;
+    try {
+        sync_wait(async_parallel_for(range(1000), 1, [](int i) {
+            if (i == 500)
+                throw std::runtime_error("failed");
+        }, tp));
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+
+void test_affinity() {
+    ASSERT_TRUE(detail::parse_cpu_list("0-3,8, 10-11") == vector<int>({ 0, 1, 2, 3, 8, 10, 11 }));
+    ASSERT_TRUE(detail::parse_cpu_list("") == vector<int>());
+
+    // both policies list every allowed CPU once, in their own order
+    vector<int> compact = affinity_cpu_list(Affinity::Compact);
+    vector<int> scatter = affinity_cpu_list(Affinity::Scatter);
+    std::sort(compact.begin(), compact.end());
+    std::sort(scatter.begin(), scatter.end());
+    ASSERT_TRUE(compact == detail::allowed_cpus());
+    ASSERT_TRUE(scatter == compact);
+
+    thread_pool tp(3, { 0 });
+
+#ifdef __linux__
+    std::atomic<int> wrong_cpu = 0;
+    parallel_for(range(100), 1, Schedule::Affine, [&](int) {
+        if (sched_getcpu() != 0)
+            wrong_cpu++;
+    }, tp);
+    ASSERT_EQUAL(wrong_cpu.load(), 0);
+#endif
+}
+
+void test_cancellation(thread_pool& tp) {
+    ASSERT_TRUE(!cancellation_token::none().cancelled());
+
+    {
+        cancellation_token ct;
+        std::atomic<int> visited = 0;
+
+        bool thrown = false;
+        try {
+            parallel_for(range(10000), 10, [&](int) {
+                if (visited++ == 100)
+                    ct.cancel();
+            }, ct, tp);
+        }
+        catch (const operation_cancelled&) {
+            thrown = true;
+        }
+        ASSERT_TRUE(thrown);
+        ASSERT_TRUE(visited.load() < 10000);
+    }
+
+    {
+        cancellation_token ct;
+        int64_t sum = parallel_reduce(range(1000), 7, int64_t(0), std::plus<int64_t>(), [](range r) {
+            return accumulate(r.begin(), r.end(), int64_t(0));
+        }, ct, tp);
+        ASSERT_EQUAL(sum, int64_t(1000) * 999 / 2);
+
+        ct.cancel();
+        bool thrown = false;
+        try {
+            parallel_reduce(range(1000), 7, int64_t(0), std::plus<int64_t>(), [](range r) {
+                return accumulate(r.begin(), r.end(), int64_t(0));
+            }, ct, tp);
+        }
+        catch (const operation_cancelled&) {
+            thrown = true;
+        }
+        ASSERT_TRUE(thrown);
+    }
+
+    {
+        cancellation_token ct(std::chrono::steady_clock::now() - std::chrono::seconds(1));
+        ASSERT_TRUE(ct.cancelled());
+
+        auto f = tp.enqueue([] { return 1; }, ct);
+        bool thrown = false;
+        try {
+            tp.wait(f);
+        }
+        catch (const operation_cancelled&) {
+            thrown = true;
+        }
+        ASSERT_TRUE(thrown);
+
+        ASSERT_TRUE(!cancellation_token(std::chrono::hours(1)).cancelled());
+    }
+}
+
+void test_stats() {
+    thread_pool tp(2);
+
+    parallel_for(range(1000), 1, [](int) {}, tp);
+    auto f = tp.enqueue([] { std::this_thread::sleep_for(std::chrono::milliseconds(10)); });
+    tp.wait(f);
+
+    auto s = tp.get_stats();
+    ASSERT_EQUAL(s.pending, 0);
+    ASSERT_EQUAL(s.submitted, s.executed + s.dropped);
+    ASSERT_EQUAL(s.dropped, 0u);
+
+#ifndef C4_POOL_STATS_DISABLED
+    // A task's counters are updated right after it finishes, i.e. maybe after whoever waited for it has moved on
+    while (s.executed < 1001)
+        s = tp.get_stats();
+
+    ASSERT_EQUAL(s.executed, 1001u);
+    ASSERT_EQUAL(s.workers.size(), size_t(2));
+    ASSERT_TRUE(s.max_pending >= 1);
+
+    uint64_t executed = 0;
+    std::chrono::nanoseconds busy{ 0 };
+    for (const auto& w : s.workers) {
+        executed += w.executed;
+        busy += w.busy;
+    }
+    ASSERT_EQUAL(executed, s.executed);
+#ifdef C4_POOL_TIMING
+    ASSERT_TRUE(busy >= std::chrono::milliseconds(10));
+#endif
+#endif
+
+    tp.reset_stats();
+    s = tp.get_stats();
+    ASSERT_EQUAL(s.executed, 0u);
+    ASSERT_EQUAL(s.stolen, 0u);
+}
+
+void test_deterministic_reduce() {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> dist(-1e6f, 1e6f);
+
+    vector<float> v(100003);
+    for (float& x : v)
+        x = dist(gen);
+
+    auto sum = [&](thread_pool& tp) {
+        return parallel_deterministic_reduce(v.begin(), v.end(), 1000, 0.f, std::plus<float>(), [](auto first, auto last) {
+            return std::accumulate(first, last, 0.f);
+        }, tp);
+    };
+
+    thread_pool tp1(1);
+    const float expected = sum(tp1);
+
+    for (int threads : { 2, 3, 8, 16 }) {
+        thread_pool tp(threads);
+        for (int k = 0; k < 5; k++)
+            ASSERT_TRUE(sum(tp) == expected);
+    }
+
+    // Non-commutative reduction keeps chunk order, for any number of chunks
+    for (int n : { 0, 1, 2, 5, 16, 17, 1000 }) {
+        vector<int> order = parallel_deterministic_reduce(range(n), 3, vector<int>(), [](vector<int>&& a, vector<int>&& b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return std::move(a);
+        }, [](range r) {
+            return vector<int>(r.begin(), r.end());
+        }, tp1);
+
+        ASSERT_EQUAL(order.size(), size_t(n));
+        for (int i = 0; i < n; i++)
+            ASSERT_EQUAL(order[i], i);
+    }
+}
+
+int main() {
+    try {
+        for (int threads : { 1, 2, 4, 16 }) {
+            thread_pool tp(threads);
+
+            for (int k = 0; k < 10; k++) {
+                test_enqueue(tp);
+                test_enqueue_from_workers(tp);
+                test_parallel_for(tp);
+                test_parallel_reduce(tp);
+                test_parallel_for_allocations(tp);
+                test_parallel_for_exception(tp);
+                test_enumerable_thread_specific(tp);
+                test_nested_parallel_for(tp);
+                test_nested_parallel_reduce(tp);
+                test_task_graph(tp);
+                test_pipeline(tp);
+                test_schedules(tp);
+                test_grain_tuner(tp);
+                test_tasks(tp);
+                test_cancellation(tp);
+            }
+
+            test_parallel_for_2d(tp);
+            test_parallel_scan(tp);
+            test_parallel_sort(tp);
+            test_parallel_partition(tp);
+        }
+
+        test_priority();
+        test_affinity();
+        test_stats();
+        test_deterministic_reduce();
+        test_parallel_invoke();
+
+        cout << "All tests passed OK" << endl;
+    }
+    catch (std::exception& e) {
+        cout << e.what() << endl;
+    }
+
+    return 0;
+}
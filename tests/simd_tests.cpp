@@ -21,6 +21,9 @@
 //SOFTWARE.
 
 #include <c4/simd.hpp>
+#include <c4/simd_avx2.hpp>
+#include <c4/blur.hpp>
+#include <c4/color_plane.hpp>
 #include <c4/math.hpp>
 
 #include <array>
@@ -1867,7 +1870,501 @@ void multitest_clz() {
     test_clz<uint32_t>();
 }
 
+template<class T, int k>
+void test_shift_lanes_up() {
+    auto a = random_array<T, 4>();
+    auto r = random_array<T, 4>();
 
+    store(r.data(), shift_lanes_up<k>(load(a.data())));
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQUAL(r[i], i < k ? T(0) : a[i - k]);
+    }
+}
+
+template<class T>
+void test_shift_lanes_up() {
+    test_shift_lanes_up<T, 1>();
+    test_shift_lanes_up<T, 2>();
+    test_shift_lanes_up<T, 3>();
+}
+
+void multitest_shift_lanes_up() {
+    test_shift_lanes_up<int32_t>();
+    test_shift_lanes_up<uint32_t>();
+}
+
+template<class T, int k>
+void test_broadcast_lane() {
+    auto a = random_array<T, 4>();
+    auto r = random_array<T, 4>();
+
+    store(r.data(), broadcast_lane<k>(load(a.data())));
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQUAL(r[i], a[k]);
+    }
+}
+
+template<class T>
+void test_broadcast_lane() {
+    test_broadcast_lane<T, 0>();
+    test_broadcast_lane<T, 1>();
+    test_broadcast_lane<T, 2>();
+    test_broadcast_lane<T, 3>();
+}
+
+void multitest_broadcast_lane() {
+    test_broadcast_lane<int32_t>();
+    test_broadcast_lane<uint32_t>();
+}
+
+
+
+// ======================================================= AVX2 =================================================================
+
+#ifdef __C4_AVX2__
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_load_store() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto r = random_array<T, n>();
+    auto lo = random_array<T, n / 2>();
+    auto hi = random_array<T, n / 2>();
+
+    auto va = avx2::load(a.data());
+    store(lo.data(), avx2::get_low(va));
+    store(hi.data(), avx2::get_high(va));
+    avx2::store(r.data(), avx2::combine(load(lo.data()), load(hi.data())));
+
+    for (int i = 0; i < n / 2; i++) {
+        ASSERT_EQUAL(lo[i], a[i]);
+        ASSERT_EQUAL(hi[i], a[n / 2 + i]);
+    }
+
+    ASSERT_TRUE(r == a);
+}
+
+void multitest_avx2_load_store() {
+    test_avx2_load_store<int8_t>();
+    test_avx2_load_store<uint8_t>();
+    test_avx2_load_store<int16_t>();
+    test_avx2_load_store<uint16_t>();
+    test_avx2_load_store<int32_t>();
+    test_avx2_load_store<uint32_t>();
+    test_avx2_load_store<float>();
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_saturate() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto b = random_array<T, n>();
+    auto r = random_array<T, n>();
+    auto s = random_array<T, n>();
+
+    auto va = avx2::load(a.data());
+    auto vb = avx2::load(b.data());
+    avx2::store(r.data(), avx2::add_saturate(va, vb));
+    avx2::store(s.data(), avx2::sub_saturate(va, vb));
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(r[i], c4::clamp<T>((int64_t)a[i] + b[i]));
+        ASSERT_EQUAL(s[i], c4::clamp<T>((int64_t)a[i] - b[i]));
+    }
+}
+
+void multitest_avx2_saturate() {
+    test_avx2_saturate<int8_t>();
+    test_avx2_saturate<uint8_t>();
+    test_avx2_saturate<int16_t>();
+    test_avx2_saturate<uint16_t>();
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_min_max() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto b = random_array<T, n>();
+    auto r0 = random_array<T, n>();
+    auto r1 = random_array<T, n>();
+
+    auto va = avx2::load(a.data());
+    auto vb = avx2::load(b.data());
+    avx2::store(r0.data(), avx2::min(va, vb));
+    avx2::store(r1.data(), avx2::max(va, vb));
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(r0[i], std::min(a[i], b[i]));
+        ASSERT_EQUAL(r1[i], std::max(a[i], b[i]));
+    }
+}
+
+void multitest_avx2_min_max() {
+    test_avx2_min_max<int8_t>();
+    test_avx2_min_max<uint8_t>();
+    test_avx2_min_max<int16_t>();
+    test_avx2_min_max<uint16_t>();
+    test_avx2_min_max<int32_t>();
+    test_avx2_min_max<uint32_t>();
+    test_avx2_min_max<float>();
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_avg_abs_diff() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto b = random_array<T, n>();
+    auto r0 = random_array<T, n>();
+    auto r1 = random_array<T, n>();
+
+    auto va = avx2::load(a.data());
+    auto vb = avx2::load(b.data());
+    avx2::store(r0.data(), avx2::avg(va, vb));
+    avx2::store(r1.data(), avx2::abs_diff(va, vb));
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(r0[i], T((a[i] + b[i] + 1) >> 1));
+        ASSERT_EQUAL(r1[i], T(std::abs(a[i] - b[i])));
+    }
+}
+
+void multitest_avx2_avg_abs_diff() {
+    test_avx2_avg_abs_diff<uint8_t>();
+    test_avx2_avg_abs_diff<uint16_t>();
+}
+
+C4_TARGET_AVX2 void test_avx2_sad() {
+    auto a = random_array<uint8_t, 32>();
+    auto b = random_array<uint8_t, 32>();
+    auto r = random_array<uint32_t, 8>();
+
+    auto vr = avx2::sad(avx2::load(a.data()), avx2::load(b.data()));
+    avx2::store(r.data(), vr);
+
+    uint32_t total = 0;
+    for (int i = 0; i < 8; i++) {
+        uint32_t e = 0;
+        if (i % 2 == 0) {
+            for (int j = 0; j < 8; j++)
+                e += std::abs(a[i * 4 + j] - b[i * 4 + j]);
+        }
+
+        ASSERT_EQUAL(r[i], e);
+        total += e;
+    }
+
+    ASSERT_EQUAL(avx2::sum0246(vr), total);
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_mul_lo() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto b = random_array<T, n>();
+    auto r = random_array<T, n>();
+
+    avx2::store(r.data(), avx2::mul_lo(avx2::load(a.data()), avx2::load(b.data())));
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(r[i], T((uint64_t)a[i] * (uint64_t)b[i]));
+    }
+}
+
+void multitest_avx2_mul_lo() {
+    test_avx2_mul_lo<int16_t>();
+    test_avx2_mul_lo<uint16_t>();
+    test_avx2_mul_lo<int32_t>();
+    test_avx2_mul_lo<uint32_t>();
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_long() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto b = random_array<T, n>();
+
+    auto va = avx2::load(a.data());
+    auto vb = avx2::load(b.data());
+
+    auto vm = avx2::long_move(va);
+    auto vp = avx2::mul_long(va, vb);
+
+    typedef typename std::remove_reference<decltype(vm.val[0])>::type::base_t long_t;
+
+    auto m = random_array<long_t, n>();
+    auto p = random_array<long_t, n>();
+
+    avx2::store(m.data(), vm.val[0]);
+    avx2::store(m.data() + n / 2, vm.val[1]);
+    avx2::store(p.data(), vp.val[0]);
+    avx2::store(p.data() + n / 2, vp.val[1]);
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(m[i], long_t(a[i]));
+        ASSERT_EQUAL(p[i], long_t(long_t(a[i]) * long_t(b[i])));
+    }
+}
+
+void multitest_avx2_long() {
+    test_avx2_long<int8_t>();
+    test_avx2_long<uint8_t>();
+    test_avx2_long<int16_t>();
+    test_avx2_long<uint16_t>();
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_long_in_lanes() {
+    auto a = random_array<T, 16>();
+    auto b = random_array<T, 16>();
+
+    auto va = avx2::load(a.data());
+    auto vb = avx2::load(b.data());
+
+    typedef typename std::remove_reference<decltype(avx2::long_move_in_lanes(va).val[0])>::type::base_t long_t;
+
+    auto m = random_array<long_t, 16>();
+    auto p = random_array<long_t, 16>();
+
+    auto m0 = avx2::get_low_in_lanes(avx2::long_move_in_lanes(va));
+    auto m1 = avx2::get_high_in_lanes(avx2::long_move_in_lanes(va));
+    auto p0 = avx2::get_low_in_lanes(avx2::mul_long_in_lanes(va, vb));
+    auto p1 = avx2::get_high_in_lanes(avx2::mul_long_in_lanes(va, vb));
+
+    for (int k = 0; k < 2; k++) {
+        store(m.data() + 4 * k, m0.val[k]);
+        store(m.data() + 8 + 4 * k, m1.val[k]);
+        store(p.data() + 4 * k, p0.val[k]);
+        store(p.data() + 8 + 4 * k, p1.val[k]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        ASSERT_EQUAL(m[i], long_t(a[i]));
+        ASSERT_EQUAL(p[i], long_t(a[i]) * long_t(b[i]));
+    }
+}
+
+void multitest_avx2_long_in_lanes() {
+    test_avx2_long_in_lanes<int16_t>();
+    test_avx2_long_in_lanes<uint16_t>();
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_narrow() {
+    typedef typename std::make_signed<T>::type S;
+    typedef decltype(avx2::load((const T*)nullptr)) V;
+
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, 2 * n>();
+    auto s = random_array<S, 2 * n>();
+
+    typedef typename decltype(avx2::narrow(c4::simd::tuple<V, 2>{}))::base_t short_t;
+
+    auto r0 = random_array<short_t, 2 * n>();
+    typedef typename std::make_signed<short_t>::type signed_short_t;
+    typedef typename std::make_unsigned<short_t>::type unsigned_short_t;
+
+    auto r1 = random_array<signed_short_t, 2 * n>();
+    auto r2 = random_array<unsigned_short_t, 2 * n>();
+
+    c4::simd::tuple<V, 2> va{ avx2::load(a.data()), avx2::load(a.data() + n) };
+    auto vs = avx2::reinterpret_signed(c4::simd::tuple<V, 2>{ avx2::load((const T*)s.data()), avx2::load((const T*)s.data() + n) });
+
+    avx2::store(r0.data(), avx2::narrow(va));
+    avx2::store(r1.data(), avx2::narrow_saturate(vs));
+    avx2::store(r2.data(), avx2::narrow_unsigned_saturate(vs));
+
+    for (int i = 0; i < 2 * n; i++) {
+        ASSERT_EQUAL(r0[i], short_t(a[i]));
+        ASSERT_EQUAL(r1[i], c4::clamp<signed_short_t>(s[i]));
+        ASSERT_EQUAL(r2[i], c4::clamp<unsigned_short_t>(s[i]));
+    }
+}
+
+void multitest_avx2_narrow() {
+    test_avx2_narrow<uint16_t>();
+    test_avx2_narrow<uint32_t>();
+}
+
+template<class T>
+C4_TARGET_AVX2 void test_avx2_interleave() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto b = random_array<T, n>();
+    auto r = random_array<T, 2 * n>();
+    auto d = random_array<T, 2 * n>();
+
+    typedef decltype(avx2::load((const T*)nullptr)) V;
+
+    c4::simd::tuple<V, 2> vi = avx2::interleave(c4::simd::tuple<V, 2>{ avx2::load(a.data()), avx2::load(b.data()) });
+    avx2::store(r.data(), vi.val[0]);
+    avx2::store(r.data() + n, vi.val[1]);
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(r[2 * i], a[i]);
+        ASSERT_EQUAL(r[2 * i + 1], b[i]);
+    }
+
+    c4::simd::tuple<V, 2> vd = avx2::load_2_interleaved(r.data());
+    avx2::store(d.data(), vd.val[0]);
+    avx2::store(d.data() + n, vd.val[1]);
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(d[i], a[i]);
+        ASSERT_EQUAL(d[n + i], b[i]);
+    }
+}
+
+void multitest_avx2_interleave() {
+    test_avx2_interleave<int8_t>();
+    test_avx2_interleave<uint8_t>();
+    test_avx2_interleave<int16_t>();
+    test_avx2_interleave<uint16_t>();
+    test_avx2_interleave<int32_t>();
+    test_avx2_interleave<uint32_t>();
+    test_avx2_interleave<float>();
+}
+
+template<class T, int k>
+C4_TARGET_AVX2 void test_avx2_shift() {
+    constexpr int n = 32 / sizeof(T);
+    auto a = random_array<T, n>();
+    auto r0 = random_array<T, n>();
+    auto r1 = random_array<T, n>();
+
+    auto va = avx2::load(a.data());
+    avx2::store(r0.data(), avx2::shift_left<k>(va));
+    avx2::store(r1.data(), avx2::shift_right<k>(va));
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUAL(r0[i], T(typename std::make_unsigned<T>::type(a[i]) << k));
+        ASSERT_EQUAL(r1[i], T(a[i] >> k));
+    }
+}
+
+void multitest_avx2_shift() {
+    test_avx2_shift<int16_t, 3>();
+    test_avx2_shift<uint16_t, 5>();
+    test_avx2_shift<int32_t, 7>();
+    test_avx2_shift<uint32_t, 11>();
+}
+
+C4_TARGET_AVX2 void test_avx2_float() {
+    auto a = random_array<float, 8>();
+    auto b = random_array<float, 8>();
+    auto r = random_array<float, 8>();
+    auto s = random_array<int32_t, 8>();
+
+    for (float& x : a)
+        x *= 1000;
+
+    auto va = avx2::load(a.data());
+    auto vb = avx2::load(b.data());
+    avx2::store(r.data(), avx2::mul_acc(va, va, vb));
+    avx2::store(s.data(), avx2::to_int(va));
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQUAL(r[i], a[i] + a[i] * b[i]);
+        ASSERT_EQUAL(s[i], int32_t(a[i]));
+    }
+
+    avx2::store(r.data(), avx2::to_float(avx2::load(s.data())));
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQUAL(r[i], float(s[i]));
+    }
+}
+
+void multitest_avx2() {
+    multitest_avx2_load_store();
+    multitest_avx2_saturate();
+    multitest_avx2_min_max();
+    multitest_avx2_avg_abs_diff();
+    test_avx2_sad();
+    multitest_avx2_mul_lo();
+    multitest_avx2_long();
+    multitest_avx2_long_in_lanes();
+    multitest_avx2_narrow();
+    multitest_avx2_interleave();
+    multitest_avx2_shift();
+    test_avx2_float();
+}
+
+#endif
+
+// ===================================================== KERNELS ================================================================
+
+// Kernels dispatch to AVX2 where it is there, either way they must match the scalar code, tails included
+void test_box_blur_vertical() {
+    for (int width : { 5, 16, 31, 32, 33, 70 }) {
+        for (int r : { 1, 3 }) {
+            const int height = 11;
+
+            c4::matrix<uint8_t> img(height, width);
+            for (int i = 0; i < height; i++)
+                for (int j = 0; j < width; j++)
+                    img[i][j] = random<uint8_t>();
+
+            c4::matrix<uint8_t> expected = img;
+            vector<uint8_t> col(height), blurred(height);
+            for (int j = 0; j < width; j++) {
+                for (int i = 0; i < height; i++)
+                    col[i] = img[i][j];
+
+                c4::box_blur_1d(col.data(), col.data() + height, blurred.data(), r);
+
+                for (int i = 0; i < height; i++)
+                    expected[i][j] = blurred[i];
+            }
+
+            c4::box_blur_vertical(img, r);
+
+            for (int i = 0; i < height; i++)
+                for (int j = 0; j < width; j++)
+                    ASSERT_EQUAL(int(img[i][j]), int(expected[i][j]));
+        }
+    }
+}
+
+template<c4::UvByteOrder uvByteOrder>
+void test_yuv420_to_rgb() {
+    for (int width : { 8, 34, 66, 100 }) {
+        const int height = 4;
+
+        c4::matrix<uint8_t> Y(height, width);
+        c4::matrix<std::pair<uint8_t, uint8_t>> UV(height / 2, width / 2);
+
+        for (int i = 0; i < height; i++)
+            for (int j = 0; j < width; j++)
+                Y[i][j] = random<uint8_t>();
+
+        for (int i = 0; i < height / 2; i++)
+            for (int j = 0; j < width / 2; j++)
+                UV[i][j] = { random<uint8_t>(), random<uint8_t>() };
+
+        const c4::yuv_to_rgb_coefficients c = c4::ITU_R;
+        const c4::pixel<int> add(3, -5, 7);
+
+        vector<uint8_t> rgb(height * width * 3);
+        c4::yuv420_to_rgb<uvByteOrder, c4::RgbByteOrder::RGB>(Y, UV, rgb.data(), width * 3, c, add);
+
+        for (int i = 0; i < height; i++) {
+            for (int j = 0; j < width; j++) {
+                const auto uv = UV[i / 2][j / 2];
+                const int u = (uvByteOrder == c4::UvByteOrder::UV ? uv.first : uv.second) - 128;
+                const int v = (uvByteOrder == c4::UvByteOrder::UV ? uv.second : uv.first) - 128;
+
+                const int y = Y[i][j];
+                const uint8_t* p = rgb.data() + (i * width + j) * 3;
+
+                ASSERT_EQUAL(int(p[0]), int(c4::clamp<uint8_t>(y + add.r + ((v * c.rv) >> 8))));
+                ASSERT_EQUAL(int(p[1]), int(c4::clamp<uint8_t>(y + add.g + ((u * c.gu + v * c.gv) >> 8))));
+                ASSERT_EQUAL(int(p[2]), int(c4::clamp<uint8_t>(y + add.b + ((u * c.bu) >> 8))));
+            }
+        }
+    }
+}
 
 // ======================================================= MAIN =================================================================
 
@@ -1946,8 +2443,19 @@ int main()
             test_div();
             test_look_up();
             multitest_clz();
+            multitest_shift_lanes_up();
+            multitest_broadcast_lane();
+
+#ifdef __C4_AVX2__
+            if (avx2::is_supported())
+                multitest_avx2();
+#endif
         }
 
+        test_box_blur_vertical();
+        test_yuv420_to_rgb<c4::UvByteOrder::UV>();
+        test_yuv420_to_rgb<c4::UvByteOrder::VU>();
+
         cout << "All tests passed OK" << endl;
     }
     catch (std::exception& e) {